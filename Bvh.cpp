@@ -0,0 +1,374 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+static AABB EmptyBounds()
+{
+	return { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+}
+
+static void Grow(AABB& bounds, const glm::vec3& min, const glm::vec3& max)
+{
+	bounds.min = glm::min(bounds.min, min);
+	bounds.max = glm::max(bounds.max, max);
+}
+
+static float SurfaceArea(const AABB& bounds)
+{
+	glm::vec3 extent = bounds.max - bounds.min;
+	if (extent.x < 0.0f) {
+		return 0.0f;
+	}
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static glm::vec3 Centroid(const AABB& bounds)
+{
+	return (bounds.min + bounds.max) * 0.5f;
+}
+
+struct BvhBuilder {
+	Bvh& bvh;
+	const AABB* bounds;
+
+	void MakeLeaf(uint32_t node_index, uint32_t first, uint32_t count)
+	{
+		bvh.nodes[node_index].index = first;
+		bvh.nodes[node_index].count = count;
+	}
+
+	void Subdivide(uint32_t node_index, uint32_t first, uint32_t count, uint32_t depth)
+	{
+		uint32_t* primitives = bvh.primitives.data() + first;
+
+		AABB node_bounds = EmptyBounds();
+		AABB centroid_bounds = EmptyBounds();
+		for (uint32_t i = 0; i < count; i++) {
+			const AABB& primitive = bounds[primitives[i]];
+			glm::vec3 centroid = Centroid(primitive);
+			Grow(node_bounds, primitive.min, primitive.max);
+			Grow(centroid_bounds, centroid, centroid);
+		}
+
+		bvh.nodes[node_index].min = node_bounds.min;
+		bvh.nodes[node_index].max = node_bounds.max;
+
+		if (count == 1 || depth >= BVH_MAX_DEPTH) {
+			MakeLeaf(node_index, first, count);
+			return;
+		}
+
+		// binned sah, primitives are binned by centroid along each axis and every bin boundary is a candidate split
+		float best_cost = FLT_MAX;
+		int best_axis = -1;
+		uint32_t best_split = 0;
+
+		glm::vec3 centroid_extent = centroid_bounds.max - centroid_bounds.min;
+
+		for (int axis = 0; axis < 3; axis++) {
+			if (centroid_extent[axis] <= 0.0f) {
+				continue;
+			}
+
+			AABB bin_bounds[BVH_BIN_COUNT];
+			uint32_t bin_counts[BVH_BIN_COUNT] = {};
+			for (auto& bin : bin_bounds) {
+				bin = EmptyBounds();
+			}
+
+			float bin_scale = BVH_BIN_COUNT / centroid_extent[axis];
+			for (uint32_t i = 0; i < count; i++) {
+				const AABB& primitive = bounds[primitives[i]];
+				uint32_t bin = std::min(uint32_t((Centroid(primitive)[axis] - centroid_bounds.min[axis]) * bin_scale), uint32_t(BVH_BIN_COUNT - 1));
+				bin_counts[bin]++;
+				Grow(bin_bounds[bin], primitive.min, primitive.max);
+			}
+
+			// sweep from the right to get the area and count of everything right of each boundary
+			float right_area[BVH_BIN_COUNT];
+			uint32_t right_count[BVH_BIN_COUNT];
+			AABB right = EmptyBounds();
+			uint32_t right_total = 0;
+			for (int bin = BVH_BIN_COUNT - 1; bin > 0; bin--) {
+				Grow(right, bin_bounds[bin].min, bin_bounds[bin].max);
+				right_total += bin_counts[bin];
+				right_area[bin] = SurfaceArea(right);
+				right_count[bin] = right_total;
+			}
+
+			AABB left = EmptyBounds();
+			uint32_t left_total = 0;
+			for (uint32_t split = 1; split < BVH_BIN_COUNT; split++) {
+				Grow(left, bin_bounds[split - 1].min, bin_bounds[split - 1].max);
+				left_total += bin_counts[split - 1];
+				if (left_total == 0 || right_count[split] == 0) {
+					continue;
+				}
+
+				float cost = left_total * SurfaceArea(left) + right_count[split] * right_area[split];
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_axis = axis;
+					best_split = split;
+				}
+			}
+		}
+
+		// splitting costs one extra box test per traversal, measured in primitive tests
+		float leaf_cost = count * SurfaceArea(node_bounds);
+		float split_cost = best_cost + SurfaceArea(node_bounds);
+
+		uint32_t left_count = 0;
+
+		if (best_axis >= 0 && (count > BVH_MAX_LEAF_SIZE || split_cost < leaf_cost)) {
+			float bin_scale = BVH_BIN_COUNT / centroid_extent[best_axis];
+			float split_min = centroid_bounds.min[best_axis];
+			uint32_t* middle = std::partition(primitives, primitives + count, [&](uint32_t primitive) {
+				uint32_t bin = std::min(uint32_t((Centroid(bounds[primitive])[best_axis] - split_min) * bin_scale), uint32_t(BVH_BIN_COUNT - 1));
+				return bin < best_split;
+			});
+			left_count = uint32_t(middle - primitives);
+		}
+		else if (count > BVH_MAX_LEAF_SIZE) {
+			// all centroids in the same spot, split in the middle so leaves stay small
+			left_count = count / 2;
+		}
+		else {
+			MakeLeaf(node_index, first, count);
+			return;
+		}
+
+		uint32_t left_index = uint32_t(bvh.nodes.size());
+		bvh.nodes.emplace_back();
+		Subdivide(left_index, first, left_count, depth + 1);
+
+		uint32_t right_index = uint32_t(bvh.nodes.size());
+		bvh.nodes.emplace_back();
+		Subdivide(right_index, first + left_count, count - left_count, depth + 1);
+
+		bvh.nodes[node_index].index = right_index;
+		bvh.nodes[node_index].count = 0;
+	}
+};
+
+void Bvh::Build(const AABB* bounds, size_t count)
+{
+	Clear();
+	if (count == 0) {
+		return;
+	}
+
+	primitives.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		primitives[i] = uint32_t(i);
+	}
+
+	nodes.reserve(2 * count);
+	nodes.emplace_back();
+
+	BvhBuilder builder = { *this, bounds };
+	builder.Subdivide(0, 0, uint32_t(count), 0);
+
+	nodes.shrink_to_fit();
+}
+
+void Bvh::Refit(const AABB* bounds)
+{
+	// children are always stored after their parent, so walking backwards visits them first
+	for (size_t i = nodes.size(); i-- > 0;) {
+		BvhNode& node = nodes[i];
+		AABB node_bounds = EmptyBounds();
+
+		if (node.count > 0) {
+			for (uint32_t j = 0; j < node.count; j++) {
+				const AABB& primitive = bounds[primitives[node.index + j]];
+				Grow(node_bounds, primitive.min, primitive.max);
+			}
+		}
+		else {
+			Grow(node_bounds, nodes[i + 1].min, nodes[i + 1].max);
+			Grow(node_bounds, nodes[node.index].min, nodes[node.index].max);
+		}
+
+		node.min = node_bounds.min;
+		node.max = node_bounds.max;
+	}
+}
+
+void Bvh::Clear()
+{
+	nodes.clear();
+	primitives.clear();
+}
+
+// tests a box against the planes in plane_mask, inside_mask gets the planes the box is not completely in front of
+static bool IntersectFrustum(const Frustum& frustum, uint32_t plane_mask, const glm::vec3& min, const glm::vec3& max, uint32_t* inside_mask)
+{
+	glm::vec3 center = (min + max) * 0.5f;
+	glm::vec3 extent = (max - min) * 0.5f;
+
+	for (int p = 0; p < 6; p++) {
+		if ((plane_mask & (1u << p)) == 0) {
+			continue;
+		}
+
+		const glm::vec4& plane = frustum.planes[p];
+		float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+		float radius = std::abs(plane.x) * extent.x + std::abs(plane.y) * extent.y + std::abs(plane.z) * extent.z;
+
+		if (distance + radius < 0.0f) {
+			return false;
+		}
+		if (distance - radius >= 0.0f) {
+			plane_mask &= ~(1u << p);
+		}
+	}
+
+	if (inside_mask != nullptr) {
+		*inside_mask = plane_mask;
+	}
+	return true;
+}
+
+size_t Bvh::Cull(const AABB* bounds, const Frustum& frustum, uint32_t* visible) const
+{
+	if (nodes.empty()) {
+		return 0;
+	}
+
+	struct StackEntry {
+		uint32_t node;
+		uint32_t plane_mask; // planes the parent was not completely inside of
+	};
+
+	StackEntry stack[BVH_MAX_DEPTH * 2];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = { 0, 0x3F };
+
+	size_t count = 0;
+
+	while (stack_size > 0) {
+		StackEntry entry = stack[--stack_size];
+		const BvhNode& node = nodes[entry.node];
+
+		uint32_t plane_mask = entry.plane_mask;
+		if (!IntersectFrustum(frustum, plane_mask, node.min, node.max, &plane_mask)) {
+			continue;
+		}
+
+		if (plane_mask == 0) {
+			// completely inside, the primitives of a subtree are contiguous and span from its leftmost to its rightmost leaf
+			uint32_t first = entry.node;
+			while (nodes[first].count == 0) {
+				first++;
+			}
+			uint32_t last = entry.node;
+			while (nodes[last].count == 0) {
+				last = nodes[last].index;
+			}
+
+			for (uint32_t i = nodes[first].index; i < nodes[last].index + nodes[last].count; i++) {
+				visible[count++] = primitives[i];
+			}
+			continue;
+		}
+
+		if (node.count > 0) {
+			// the leaf box straddles a plane, test its primitives against the planes that are left
+			for (uint32_t i = 0; i < node.count; i++) {
+				uint32_t primitive = primitives[node.index + i];
+				if (IntersectFrustum(frustum, plane_mask, bounds[primitive].min, bounds[primitive].max, nullptr)) {
+					visible[count++] = primitive;
+				}
+			}
+			continue;
+		}
+
+		stack[stack_size++] = { node.index, plane_mask };
+		stack[stack_size++] = { entry.node + 1, plane_mask };
+	}
+
+	return count;
+}
+
+// slab test, returns the entry distance or FLT_MAX when the ray misses the box within max_distance
+static float IntersectBox(const glm::vec3& origin, const glm::vec3& inverse_direction, float max_distance, const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 t0 = (min - origin) * inverse_direction;
+	glm::vec3 t1 = (max - origin) * inverse_direction;
+	glm::vec3 t_near = glm::min(t0, t1);
+	glm::vec3 t_far = glm::max(t0, t1);
+
+	float enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+	float exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, max_distance));
+
+	return enter <= exit ? enter : FLT_MAX;
+}
+
+bool Bvh::Raycast(const AABB* bounds, const glm::vec3& origin, const glm::vec3& direction, float max_distance, BvhHit& hit) const
+{
+	if (nodes.empty()) {
+		return false;
+	}
+
+	glm::vec3 inverse_direction = 1.0f / direction;
+
+	hit.primitive = UINT32_MAX;
+	hit.distance = max_distance;
+
+	struct StackEntry {
+		uint32_t node;
+		float distance; // entry distance of the node box, skipped once something closer was hit
+	};
+
+	StackEntry stack[BVH_MAX_DEPTH * 2];
+	uint32_t stack_size = 0;
+
+	float root_distance = IntersectBox(origin, inverse_direction, hit.distance, nodes[0].min, nodes[0].max);
+	if (root_distance == FLT_MAX) {
+		return false;
+	}
+	stack[stack_size++] = { 0, root_distance };
+
+	while (stack_size > 0) {
+		StackEntry entry = stack[--stack_size];
+		if (entry.distance > hit.distance) {
+			continue;
+		}
+
+		const BvhNode& node = nodes[entry.node];
+
+		if (node.count > 0) {
+			for (uint32_t i = 0; i < node.count; i++) {
+				uint32_t primitive = primitives[node.index + i];
+				float distance = IntersectBox(origin, inverse_direction, hit.distance, bounds[primitive].min, bounds[primitive].max);
+				if (distance != FLT_MAX && (distance < hit.distance || hit.primitive == UINT32_MAX)) {
+					hit.primitive = primitive;
+					hit.distance = distance;
+				}
+			}
+			continue;
+		}
+
+		uint32_t left = entry.node + 1;
+		uint32_t right = node.index;
+		float left_distance = IntersectBox(origin, inverse_direction, hit.distance, nodes[left].min, nodes[left].max);
+		float right_distance = IntersectBox(origin, inverse_direction, hit.distance, nodes[right].min, nodes[right].max);
+
+		// push the far child first so the near one is visited next and shrinks hit.distance early
+		if (left_distance > right_distance) {
+			std::swap(left, right);
+			std::swap(left_distance, right_distance);
+		}
+		if (right_distance != FLT_MAX) {
+			stack[stack_size++] = { right, right_distance };
+		}
+		if (left_distance != FLT_MAX) {
+			stack[stack_size++] = { left, left_distance };
+		}
+	}
+
+	return hit.primitive != UINT32_MAX;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Model.h"
+#include "Culling.h"
+
+#define BVH_BIN_COUNT 16
+#define BVH_MAX_LEAF_SIZE 4
+#define BVH_MAX_DEPTH 64
+
+// 32 bytes, two nodes per cache line. nodes are stored depth first, so the left child of an interior
+// node directly follows it and only the right child needs an index
+struct BvhNode {
+	glm::vec3 min;
+	uint32_t index; // right child for interior nodes, first primitive for leaves
+	glm::vec3 max;
+	uint32_t count; // primitives of a leaf, 0 for interior nodes
+};
+
+struct BvhHit {
+	uint32_t primitive;
+	float distance;
+};
+
+/**
+* bounding volume hierarchy over world space boxes, primitives are indices into the array the tree was built from.
+* built top down with the binned surface area heuristic, Refit keeps the topology and only updates the node bounds
+* so it is cheap enough to run whenever transforms change but the tree quality degrades with large motion
+*/
+struct Bvh {
+	std::vector<BvhNode> nodes;
+	std::vector<uint32_t> primitives;
+
+	void Build(const AABB* bounds, size_t count);
+	void Refit(const AABB* bounds);
+	void Clear();
+
+	/**
+	* writes the primitives whose box intersects the frustum to visible (in no particular order),
+	* bounds are the boxes the tree was built or refit from. subtrees completely inside the frustum
+	* are emitted without testing their boxes. visible has to hold primitives.size() entries
+	* @returns the number of visible primitives
+	*/
+	size_t Cull(const AABB* bounds, const Frustum& frustum, uint32_t* visible) const;
+
+	/**
+	* finds the closest primitive box hit by the ray origin + t * direction with 0 <= t <= max_distance,
+	* bounds are the boxes the tree was built or refit from. a ray starting inside a box hits it at distance 0
+	* @returns false if nothing was hit
+	*/
+	bool Raycast(const AABB* bounds, const glm::vec3& origin, const glm::vec3& direction, float max_distance, BvhHit& hit) const;
+};
@@ -0,0 +1,218 @@
+#include "Culling.h"
+
+#include <cmath>
+
+#include <immintrin.h>
+
+void CullingBounds::Reserve(size_t count)
+{
+	center_x.reserve(count);
+	center_y.reserve(count);
+	center_z.reserve(count);
+	extent_x.reserve(count);
+	extent_y.reserve(count);
+	extent_z.reserve(count);
+}
+
+void CullingBounds::Clear()
+{
+	center_x.clear();
+	center_y.clear();
+	center_z.clear();
+	extent_x.clear();
+	extent_y.clear();
+	extent_z.clear();
+}
+
+void CullingBounds::Add(const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 center = (min + max) * 0.5f;
+	glm::vec3 extent = (max - min) * 0.5f;
+
+	center_x.push_back(center.x);
+	center_y.push_back(center.y);
+	center_z.push_back(center.z);
+	extent_x.push_back(extent.x);
+	extent_y.push_back(extent.y);
+	extent_z.push_back(extent.z);
+}
+
+void CullingBounds::Set(size_t index, const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 center = (min + max) * 0.5f;
+	glm::vec3 extent = (max - min) * 0.5f;
+
+	center_x[index] = center.x;
+	center_y[index] = center.y;
+	center_z[index] = center.z;
+	extent_x[index] = extent.x;
+	extent_y[index] = extent.y;
+	extent_z[index] = extent.z;
+}
+
+Frustum ExtractFrustum(const glm::mat4& view_projection)
+{
+	// rows of the matrix, glm stores columns
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++) {
+		rows[i] = glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+	}
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0]; // left
+	frustum.planes[1] = rows[3] - rows[0]; // right
+	frustum.planes[2] = rows[3] + rows[1]; // bottom
+	frustum.planes[3] = rows[3] - rows[1]; // top
+	frustum.planes[4] = rows[3] + rows[2]; // near
+	frustum.planes[5] = rows[3] - rows[2]; // far
+
+	for (auto& plane : frustum.planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	return frustum;
+}
+
+// a box is outside when it is completely behind one of the planes, the extents projected
+// on the plane normal give the distance of the corner furthest along it
+static bool CullBox(const CullingBounds& bounds, const Frustum& frustum, size_t i)
+{
+	for (const auto& plane : frustum.planes) {
+		float distance = plane.x * bounds.center_x[i] + plane.y * bounds.center_y[i] + plane.z * bounds.center_z[i] + plane.w;
+		float radius = std::abs(plane.x) * bounds.extent_x[i] + std::abs(plane.y) * bounds.extent_y[i] + std::abs(plane.z) * bounds.extent_z[i];
+		if (distance + radius < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t CullBoundsScalar(const CullingBounds& bounds, const Frustum& frustum, uint32_t* visible)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < bounds.Size(); i++) {
+		if (CullBox(bounds, frustum, i)) {
+			visible[count++] = uint32_t(i);
+		}
+	}
+	return count;
+}
+
+size_t CullBoundsSse(const CullingBounds& bounds, const Frustum& frustum, uint32_t* visible)
+{
+	__m128 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+	__m128 abs_x[6], abs_y[6], abs_z[6];
+	for (int p = 0; p < 6; p++) {
+		plane_x[p] = _mm_set1_ps(frustum.planes[p].x);
+		plane_y[p] = _mm_set1_ps(frustum.planes[p].y);
+		plane_z[p] = _mm_set1_ps(frustum.planes[p].z);
+		plane_w[p] = _mm_set1_ps(frustum.planes[p].w);
+		abs_x[p] = _mm_set1_ps(std::abs(frustum.planes[p].x));
+		abs_y[p] = _mm_set1_ps(std::abs(frustum.planes[p].y));
+		abs_z[p] = _mm_set1_ps(std::abs(frustum.planes[p].z));
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+
+	size_t count = 0;
+	size_t size = bounds.Size();
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4) {
+		__m128 center_x = _mm_loadu_ps(&bounds.center_x[i]);
+		__m128 center_y = _mm_loadu_ps(&bounds.center_y[i]);
+		__m128 center_z = _mm_loadu_ps(&bounds.center_z[i]);
+		__m128 extent_x = _mm_loadu_ps(&bounds.extent_x[i]);
+		__m128 extent_y = _mm_loadu_ps(&bounds.extent_y[i]);
+		__m128 extent_z = _mm_loadu_ps(&bounds.extent_z[i]);
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; p++) {
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x[p], center_x), _mm_mul_ps(plane_y[p], center_y)), _mm_add_ps(_mm_mul_ps(plane_z[p], center_z), plane_w[p]));
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(abs_x[p], extent_x), _mm_mul_ps(abs_y[p], extent_y)), _mm_mul_ps(abs_z[p], extent_z));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+		}
+
+		// branchless compaction, every lane is written and the cursor only advances for visible ones
+		int mask = _mm_movemask_ps(inside);
+		for (int lane = 0; lane < 4; lane++) {
+			visible[count] = uint32_t(i + lane);
+			count += (mask >> lane) & 1;
+		}
+	}
+
+	for (; i < size; i++) {
+		if (CullBox(bounds, frustum, i)) {
+			visible[count++] = uint32_t(i);
+		}
+	}
+
+	return count;
+}
+
+#if defined(__AVX__)
+size_t CullBoundsAvx(const CullingBounds& bounds, const Frustum& frustum, uint32_t* visible)
+{
+	__m256 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+	__m256 abs_x[6], abs_y[6], abs_z[6];
+	for (int p = 0; p < 6; p++) {
+		plane_x[p] = _mm256_set1_ps(frustum.planes[p].x);
+		plane_y[p] = _mm256_set1_ps(frustum.planes[p].y);
+		plane_z[p] = _mm256_set1_ps(frustum.planes[p].z);
+		plane_w[p] = _mm256_set1_ps(frustum.planes[p].w);
+		abs_x[p] = _mm256_set1_ps(std::abs(frustum.planes[p].x));
+		abs_y[p] = _mm256_set1_ps(std::abs(frustum.planes[p].y));
+		abs_z[p] = _mm256_set1_ps(std::abs(frustum.planes[p].z));
+	}
+
+	const __m256 zero = _mm256_setzero_ps();
+
+	size_t count = 0;
+	size_t size = bounds.Size();
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8) {
+		__m256 center_x = _mm256_loadu_ps(&bounds.center_x[i]);
+		__m256 center_y = _mm256_loadu_ps(&bounds.center_y[i]);
+		__m256 center_z = _mm256_loadu_ps(&bounds.center_z[i]);
+		__m256 extent_x = _mm256_loadu_ps(&bounds.extent_x[i]);
+		__m256 extent_y = _mm256_loadu_ps(&bounds.extent_y[i]);
+		__m256 extent_z = _mm256_loadu_ps(&bounds.extent_z[i]);
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; p++) {
+#if defined(__FMA__)
+			__m256 distance = _mm256_fmadd_ps(plane_x[p], center_x, _mm256_fmadd_ps(plane_y[p], center_y, _mm256_fmadd_ps(plane_z[p], center_z, plane_w[p])));
+			distance = _mm256_fmadd_ps(abs_x[p], extent_x, _mm256_fmadd_ps(abs_y[p], extent_y, _mm256_fmadd_ps(abs_z[p], extent_z, distance)));
+#else
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(plane_x[p], center_x), _mm256_mul_ps(plane_y[p], center_y)), _mm256_add_ps(_mm256_mul_ps(plane_z[p], center_z), plane_w[p]));
+			distance = _mm256_add_ps(distance, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(abs_x[p], extent_x), _mm256_mul_ps(abs_y[p], extent_y)), _mm256_mul_ps(abs_z[p], extent_z)));
+#endif
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, zero, _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		for (int lane = 0; lane < 8; lane++) {
+			visible[count] = uint32_t(i + lane);
+			count += (mask >> lane) & 1;
+		}
+	}
+
+	for (; i < size; i++) {
+		if (CullBox(bounds, frustum, i)) {
+			visible[count++] = uint32_t(i);
+		}
+	}
+
+	return count;
+}
+#endif
+
+size_t CullBounds(const CullingBounds& bounds, const Frustum& frustum, uint32_t* visible)
+{
+#if defined(__AVX__)
+	return CullBoundsAvx(bounds, frustum, visible);
+#else
+	return CullBoundsSse(bounds, frustum, visible);
+#endif
+}
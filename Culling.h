@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// planes of a view frustum as (normal, distance), a point p is inside when dot(normal, p) + distance >= 0 for all of them
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+/**
+* world space boxes stored as structure of arrays (centers and half extents per axis),
+* so the culling kernels test 4 or 8 boxes per instruction
+*/
+struct CullingBounds {
+	std::vector<float> center_x;
+	std::vector<float> center_y;
+	std::vector<float> center_z;
+	std::vector<float> extent_x;
+	std::vector<float> extent_y;
+	std::vector<float> extent_z;
+
+	size_t Size() const { return center_x.size(); }
+	void Reserve(size_t count);
+	void Clear();
+	void Add(const glm::vec3& min, const glm::vec3& max);
+	void Set(size_t index, const glm::vec3& min, const glm::vec3& max);
+};
+
+/**
+* extracts the normalized frustum planes from a view projection matrix (OpenGL clip space, -w <= z <= w)
+*/
+Frustum ExtractFrustum(const glm::mat4& view_projection);
+
+/**
+* writes the indices of all boxes that intersect or are inside the frustum to visible, in ascending order.
+* visible has to hold bounds.Size() entries, uses the widest kernel the translation unit was compiled for
+* @returns the number of visible boxes
+*/
+size_t CullBounds(const CullingBounds& bounds, const Frustum& frustum, uint32_t* visible);
+
+/**
+* reference and per instruction set kernels of CullBounds, all of them produce the same visible list
+*/
+size_t CullBoundsScalar(const CullingBounds& bounds, const Frustum& frustum, uint32_t* visible);
+size_t CullBoundsSse(const CullingBounds& bounds, const Frustum& frustum, uint32_t* visible);
+#if defined(__AVX__)
+size_t CullBoundsAvx(const CullingBounds& bounds, const Frustum& frustum, uint32_t* visible);
+#endif
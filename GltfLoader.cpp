@@ -0,0 +1,1004 @@
+#include "GltfLoader.h"
+#include "Model.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <execution>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#define GLB_MAGIC 0x46546C67 // "glTF"
+#define GLB_CHUNK_JSON 0x4E4F534A
+#define GLB_CHUNK_BIN 0x004E4942
+
+#define GLTF_BYTE 5120
+#define GLTF_UNSIGNED_BYTE 5121
+#define GLTF_SHORT 5122
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT 5125
+#define GLTF_FLOAT 5126
+
+#define GLTF_MODE_TRIANGLES 4
+#define GLTF_MODE_TRIANGLE_STRIP 5
+#define GLTF_MODE_TRIANGLE_FAN 6
+
+#define GLTF_MAX_NODE_DEPTH 64
+
+// ------------------------------------------------------------------------------------------------
+// minimal JSON DOM, only what a glTF document needs
+
+struct JsonValue {
+	enum Type : uint8_t { TypeNull, TypeBool, TypeNumber, TypeString, TypeArray, TypeObject };
+
+	Type type = TypeNull;
+	bool boolean = false;
+	double number = 0.0;
+	std::string string;
+	std::vector<JsonValue> elements;
+	std::vector<std::string> keys; // object keys, parallel to elements
+
+	size_t Size() const { return elements.size(); }
+	const JsonValue& operator[](size_t i) const { return elements[i]; }
+
+	const JsonValue* Find(const char* key) const {
+		if (type != TypeObject) return nullptr;
+		for (size_t i = 0; i < keys.size(); i++) {
+			if (keys[i] == key) return &elements[i];
+		}
+		return nullptr;
+	}
+
+	double Number(const char* key, double fallback) const {
+		auto value = Find(key);
+		return value != nullptr && value->type == TypeNumber ? value->number : fallback;
+	}
+
+	int Int(const char* key, int fallback) const {
+		return int(Number(key, double(fallback)));
+	}
+
+	const std::string* String(const char* key) const {
+		auto value = Find(key);
+		return value != nullptr && value->type == TypeString ? &value->string : nullptr;
+	}
+};
+
+struct JsonParser {
+	const char* cur;
+	const char* end;
+	int depth = 0;
+
+	void SkipWhitespace() {
+		while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\n' || *cur == '\r')) cur++;
+	}
+
+	bool Expect(char c) {
+		SkipWhitespace();
+		if (cur >= end || *cur != c) return false;
+		cur++;
+		return true;
+	}
+
+	bool ParseLiteral(const char* literal) {
+		size_t length = strlen(literal);
+		if (size_t(end - cur) < length || memcmp(cur, literal, length) != 0) return false;
+		cur += length;
+		return true;
+	}
+
+	static void AppendUtf8(std::string& out, uint32_t code) {
+		if (code < 0x80) {
+			out += char(code);
+		}
+		else if (code < 0x800) {
+			out += char(0xC0 | (code >> 6));
+			out += char(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000) {
+			out += char(0xE0 | (code >> 12));
+			out += char(0x80 | ((code >> 6) & 0x3F));
+			out += char(0x80 | (code & 0x3F));
+		}
+		else {
+			out += char(0xF0 | (code >> 18));
+			out += char(0x80 | ((code >> 12) & 0x3F));
+			out += char(0x80 | ((code >> 6) & 0x3F));
+			out += char(0x80 | (code & 0x3F));
+		}
+	}
+
+	bool ParseHex4(uint32_t& code) {
+		if (end - cur < 4) return false;
+		code = 0;
+		for (int i = 0; i < 4; i++) {
+			char c = *cur++;
+			code <<= 4;
+			if (c >= '0' && c <= '9') code |= c - '0';
+			else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+			else return false;
+		}
+		return true;
+	}
+
+	bool ParseString(std::string& out) {
+		if (!Expect('"')) return false;
+
+		while (cur < end && *cur != '"') {
+			char c = *cur++;
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+
+			if (cur >= end) return false;
+			c = *cur++;
+			switch (c) {
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '/': out += '/'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u': {
+				uint32_t code;
+				if (!ParseHex4(code)) return false;
+				if (code >= 0xD800 && code <= 0xDBFF && end - cur >= 6 && cur[0] == '\\' && cur[1] == 'u') {
+					cur += 2;
+					uint32_t low;
+					if (!ParseHex4(low)) return false;
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				}
+				AppendUtf8(out, code);
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+
+		if (cur >= end) return false;
+		cur++;
+		return true;
+	}
+
+	bool Parse(JsonValue& value) {
+		SkipWhitespace();
+		if (cur >= end || depth > 128) return false;
+
+		switch (*cur) {
+		case '{': {
+			cur++;
+			depth++;
+			value.type = JsonValue::TypeObject;
+			SkipWhitespace();
+			if (cur < end && *cur == '}') {
+				cur++;
+				depth--;
+				return true;
+			}
+			do {
+				std::string key;
+				if (!ParseString(key) || !Expect(':')) return false;
+				value.keys.push_back(std::move(key));
+				value.elements.emplace_back();
+				if (!Parse(value.elements.back())) return false;
+			} while (Expect(','));
+			depth--;
+			return Expect('}');
+		}
+		case '[': {
+			cur++;
+			depth++;
+			value.type = JsonValue::TypeArray;
+			SkipWhitespace();
+			if (cur < end && *cur == ']') {
+				cur++;
+				depth--;
+				return true;
+			}
+			do {
+				value.elements.emplace_back();
+				if (!Parse(value.elements.back())) return false;
+			} while (Expect(','));
+			depth--;
+			return Expect(']');
+		}
+		case '"':
+			value.type = JsonValue::TypeString;
+			return ParseString(value.string);
+		case 't':
+			value.type = JsonValue::TypeBool;
+			value.boolean = true;
+			return ParseLiteral("true");
+		case 'f':
+			value.type = JsonValue::TypeBool;
+			value.boolean = false;
+			return ParseLiteral("false");
+		case 'n':
+			value.type = JsonValue::TypeNull;
+			return ParseLiteral("null");
+		default: {
+			// strtod needs a terminated string, numbers in glTF are short so copy them out
+			char buffer[64];
+			size_t length = 0;
+			while (cur + length < end && length < sizeof(buffer) - 1 && cur[length] != 0 && strchr("+-0123456789.eE", cur[length]) != nullptr) {
+				buffer[length] = cur[length];
+				length++;
+			}
+			if (length == 0) return false;
+			buffer[length] = 0;
+
+			char* number_end;
+			value.type = JsonValue::TypeNumber;
+			value.number = strtod(buffer, &number_end);
+			if (number_end != buffer + length) return false;
+			cur += length;
+			return true;
+		}
+		}
+	}
+};
+
+// ------------------------------------------------------------------------------------------------
+
+struct GltfBuffer {
+	const uint8_t* data;
+	size_t size;
+};
+
+struct GltfBufferView {
+	size_t buffer;
+	size_t offset;
+	size_t length;
+	size_t stride;
+};
+
+// a typed, bounds checked view of an accessor inside a mapped buffer
+struct GltfAccessor {
+	const uint8_t* data;
+	size_t count;
+	size_t stride;
+	int component_type;
+	int components;
+	bool normalized;
+	bool has_bounds;
+	glm::vec3 min;
+	glm::vec3 max;
+
+	float Component(const uint8_t* src) const {
+		switch (component_type) {
+		case GLTF_FLOAT: {
+			float v;
+			memcpy(&v, src, sizeof(v));
+			return v;
+		}
+		case GLTF_UNSIGNED_BYTE: {
+			uint8_t v = *src;
+			return normalized ? float(v) / 255.0f : float(v);
+		}
+		case GLTF_BYTE: {
+			int8_t v = int8_t(*src);
+			return normalized ? std::max(float(v) / 127.0f, -1.0f) : float(v);
+		}
+		case GLTF_UNSIGNED_SHORT: {
+			uint16_t v;
+			memcpy(&v, src, sizeof(v));
+			return normalized ? float(v) / 65535.0f : float(v);
+		}
+		case GLTF_SHORT: {
+			int16_t v;
+			memcpy(&v, src, sizeof(v));
+			return normalized ? std::max(float(v) / 32767.0f, -1.0f) : float(v);
+		}
+		case GLTF_UNSIGNED_INT: {
+			uint32_t v;
+			memcpy(&v, src, sizeof(v));
+			return float(v);
+		}
+		}
+		return 0.0f;
+	}
+
+	glm::vec4 Get(size_t index, glm::vec4 value) const {
+		const uint8_t* src = data + index * stride;
+		if (component_type == GLTF_FLOAT) {
+			memcpy(&value, src, sizeof(float) * components);
+			return value;
+		}
+
+		size_t component_size = ComponentSize(component_type);
+		for (int c = 0; c < components; c++) {
+			value[c] = Component(src + c * component_size);
+		}
+		return value;
+	}
+
+	uint32_t Index(size_t index) const {
+		const uint8_t* src = data + index * stride;
+		switch (component_type) {
+		case GLTF_UNSIGNED_BYTE:
+			return *src;
+		case GLTF_UNSIGNED_SHORT: {
+			uint16_t v;
+			memcpy(&v, src, sizeof(v));
+			return v;
+		}
+		default: {
+			uint32_t v;
+			memcpy(&v, src, sizeof(v));
+			return v;
+		}
+		}
+	}
+
+	static size_t ComponentSize(int component_type) {
+		switch (component_type) {
+		case GLTF_BYTE:
+		case GLTF_UNSIGNED_BYTE:
+			return 1;
+		case GLTF_SHORT:
+		case GLTF_UNSIGNED_SHORT:
+			return 2;
+		case GLTF_UNSIGNED_INT:
+		case GLTF_FLOAT:
+			return 4;
+		}
+		return 0;
+	}
+};
+
+struct GltfImage {
+	std::string path;
+	const uint8_t* data;
+	size_t size;
+};
+
+struct GltfDocument {
+	JsonValue json;
+	std::vector<GltfBuffer> buffers;
+	std::vector<GltfBufferView> buffer_views;
+	std::vector<GltfImage> images;
+
+	bool Accessor(int index, GltfAccessor& accessor) const {
+		auto accessors = json.Find("accessors");
+		if (accessors == nullptr || index < 0 || size_t(index) >= accessors->Size()) return false;
+
+		const auto& a = (*accessors)[index];
+		if (a.Find("sparse") != nullptr) return false;
+
+		static const std::pair<const char*, int> types[] = {
+			{ "SCALAR", 1 }, { "VEC2", 2 }, { "VEC3", 3 }, { "VEC4", 4 },
+		};
+
+		auto type = a.String("type");
+		accessor.components = 0;
+		for (const auto& [name, components] : types) {
+			if (type != nullptr && *type == name) accessor.components = components;
+		}
+
+		accessor.component_type = a.Int("componentType", 0);
+		accessor.count = size_t(a.Number("count", 0));
+		accessor.normalized = a.Find("normalized") != nullptr && a.Find("normalized")->boolean;
+
+		size_t component_size = GltfAccessor::ComponentSize(accessor.component_type);
+		size_t element_size = component_size * accessor.components;
+		if (element_size == 0) return false;
+
+		int view_index = a.Int("bufferView", -1);
+		if (view_index < 0 || size_t(view_index) >= buffer_views.size()) return false;
+
+		const auto& view = buffer_views[view_index];
+		size_t offset = size_t(a.Number("byteOffset", 0));
+		accessor.stride = view.stride != 0 ? view.stride : element_size;
+
+		if (accessor.count > 0) {
+			size_t last = offset + accessor.stride * (accessor.count - 1) + element_size;
+			if (last > view.length) return false;
+		}
+
+		accessor.data = buffers[view.buffer].data + view.offset + offset;
+
+		auto min = a.Find("min");
+		auto max = a.Find("max");
+		accessor.has_bounds = min != nullptr && max != nullptr && min->Size() >= 3 && max->Size() >= 3;
+		if (accessor.has_bounds) {
+			accessor.min = { float((*min)[0].number), float((*min)[1].number), float((*min)[2].number) };
+			accessor.max = { float((*max)[0].number), float((*max)[1].number), float((*max)[2].number) };
+		}
+
+		return true;
+	}
+};
+
+// the primitives referenced while walking the node tree, each one is imported once no matter how
+// many nodes use its mesh. slots maps a primitive to its index in primitives and Model::meshes
+struct GltfPrimitiveSet {
+	std::vector<const JsonValue*> primitives;
+	std::unordered_map<const JsonValue*, uint32_t> slots;
+};
+
+static std::string JoinPath(const char* root, const std::string& file)
+{
+	std::string path = root;
+	path += "\\";
+	path += file;
+	return path;
+}
+
+// uris are percent encoded, file names on disk are not
+static std::string DecodeUri(const std::string& uri)
+{
+	std::string path;
+	for (size_t i = 0; i < uri.size(); i++) {
+		if (uri[i] == '%' && i + 2 < uri.size()) {
+			path += char(strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16));
+			i += 2;
+		}
+		else {
+			path += uri[i];
+		}
+	}
+	return path;
+}
+
+static glm::mat4 NodeTransform(const JsonValue& node)
+{
+	auto matrix = node.Find("matrix");
+	if (matrix != nullptr && matrix->Size() == 16) {
+		glm::mat4 m;
+		for (int c = 0; c < 4; c++) {
+			for (int r = 0; r < 4; r++) {
+				m[c][r] = float((*matrix)[c * 4 + r].number);
+			}
+		}
+		return m;
+	}
+
+	glm::mat4 m(1.0f);
+
+	auto translation = node.Find("translation");
+	if (translation != nullptr && translation->Size() == 3) {
+		m = glm::translate(m, glm::vec3(float((*translation)[0].number), float((*translation)[1].number), float((*translation)[2].number)));
+	}
+
+	auto rotation = node.Find("rotation");
+	if (rotation != nullptr && rotation->Size() == 4) {
+		// glTF stores quaternions as xyzw, glm takes wxyz
+		glm::quat q(float((*rotation)[3].number), float((*rotation)[0].number), float((*rotation)[1].number), float((*rotation)[2].number));
+		m = m * glm::mat4_cast(q);
+	}
+
+	auto scale = node.Find("scale");
+	if (scale != nullptr && scale->Size() == 3) {
+		m = glm::scale(m, glm::vec3(float((*scale)[0].number), float((*scale)[1].number), float((*scale)[2].number)));
+	}
+
+	return m;
+}
+
+static void WalkNode(const GltfDocument& doc, int node_index, const glm::mat4& parent, int depth, GltfPrimitiveSet& items, Model& model)
+{
+	auto nodes = doc.json.Find("nodes");
+	if (nodes == nullptr || node_index < 0 || size_t(node_index) >= nodes->Size() || depth > GLTF_MAX_NODE_DEPTH) {
+		return;
+	}
+
+	const auto& node = (*nodes)[node_index];
+	glm::mat4 transform = parent * NodeTransform(node);
+
+	auto meshes = doc.json.Find("meshes");
+	int mesh_index = node.Int("mesh", -1);
+	if (meshes != nullptr && mesh_index >= 0 && size_t(mesh_index) < meshes->Size()) {
+		auto primitives = (*meshes)[mesh_index].Find("primitives");
+		for (size_t i = 0; primitives != nullptr && i < primitives->Size(); i++) {
+			const auto& primitive = (*primitives)[i];
+			int mode = primitive.Int("mode", GLTF_MODE_TRIANGLES);
+			if (mode == GLTF_MODE_TRIANGLES || mode == GLTF_MODE_TRIANGLE_STRIP || mode == GLTF_MODE_TRIANGLE_FAN) {
+				auto [slot, inserted] = items.slots.try_emplace(&primitive, uint32_t(items.primitives.size()));
+				if (inserted) {
+					items.primitives.push_back(&primitive);
+				}
+
+				model.instances.push_back({ slot->second, transform });
+			}
+		}
+	}
+
+	auto cameras = doc.json.Find("cameras");
+	int camera_index = node.Int("camera", -1);
+	if (cameras != nullptr && camera_index >= 0 && size_t(camera_index) < cameras->Size()) {
+		auto perspective = (*cameras)[camera_index].Find("perspective");
+		if (perspective != nullptr) {
+			model.camera_position = glm::vec3(transform * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+			model.camera_target = model.camera_position + glm::vec3(transform * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f));
+			model.camera_up = glm::vec3(transform * glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
+			model.camera_aspect = float(perspective->Number("aspectRatio", model.camera_aspect));
+			model.camera_fov = 2.0f * atanf(model.camera_aspect * tanf(float(perspective->Number("yfov", 0.8)) * 0.5f));
+			model.camera_near = float(perspective->Number("znear", model.camera_near));
+			model.camera_far = float(perspective->Number("zfar", model.camera_far));
+		}
+	}
+
+	auto children = node.Find("children");
+	for (size_t i = 0; children != nullptr && i < children->Size(); i++) {
+		WalkNode(doc, int((*children)[i].number), transform, depth + 1, items, model);
+	}
+}
+
+static void ComputeNormals(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, std::vector<glm::vec3>& normals)
+{
+	normals.assign(positions.size(), glm::vec3(0.0f));
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		uint32_t a = indices[i + 0], b = indices[i + 1], c = indices[i + 2];
+		// area weighted, the cross product is left unnormalized on purpose
+		glm::vec3 n = glm::cross(positions[b] - positions[a], positions[c] - positions[a]);
+		normals[a] += n;
+		normals[b] += n;
+		normals[c] += n;
+	}
+
+	for (auto& n : normals) {
+		float length = glm::length(n);
+		n = length > 0.0f ? n / length : glm::vec3(0.0f, 0.0f, 1.0f);
+	}
+}
+
+static void ComputeTangents(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals, const std::vector<glm::vec2>& uvs,
+	const std::vector<uint32_t>& indices, std::vector<glm::vec4>& tangents)
+{
+	std::vector<glm::vec3> tan(positions.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> bitan(positions.size(), glm::vec3(0.0f));
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		uint32_t a = indices[i + 0], b = indices[i + 1], c = indices[i + 2];
+
+		glm::vec3 e1 = positions[b] - positions[a];
+		glm::vec3 e2 = positions[c] - positions[a];
+		glm::vec2 d1 = uvs[b] - uvs[a];
+		glm::vec2 d2 = uvs[c] - uvs[a];
+
+		float det = d1.x * d2.y - d2.x * d1.y;
+		if (fabsf(det) < 1e-12f) {
+			continue;
+		}
+
+		float r = 1.0f / det;
+		glm::vec3 t = (e1 * d2.y - e2 * d1.y) * r;
+		glm::vec3 s = (e2 * d1.x - e1 * d2.x) * r;
+
+		tan[a] += t; tan[b] += t; tan[c] += t;
+		bitan[a] += s; bitan[b] += s; bitan[c] += s;
+	}
+
+	tangents.resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++) {
+		const glm::vec3& n = normals[i];
+		glm::vec3 t = tan[i] - n * glm::dot(n, tan[i]);
+		float length = glm::length(t);
+
+		if (length > 0.0f) {
+			t = t / length;
+		}
+		else {
+			// no usable uv gradient, any vector orthogonal to the normal will do
+			t = fabsf(n.x) < 0.9f ? glm::normalize(glm::cross(n, glm::vec3(1.0f, 0.0f, 0.0f))) : glm::normalize(glm::cross(n, glm::vec3(0.0f, 1.0f, 0.0f)));
+		}
+
+		float handedness = glm::dot(glm::cross(n, t), bitan[i]) < 0.0f ? -1.0f : 1.0f;
+		tangents[i] = glm::vec4(t, handedness);
+	}
+}
+
+static bool ProcessPrimitive(const GltfDocument& doc, const JsonValue& primitive, uint32_t options, Mesh& mesh)
+{
+	auto attributes = primitive.Find("attributes");
+	if (attributes == nullptr) return false;
+
+	GltfAccessor position_accessor;
+	if (!doc.Accessor(attributes->Int("POSITION", -1), position_accessor) || position_accessor.components != 3) {
+		return false;
+	}
+
+	size_t vertex_count = position_accessor.count;
+
+	GltfAccessor normal_accessor, tangent_accessor, uv_accessor;
+	bool has_normals = doc.Accessor(attributes->Int("NORMAL", -1), normal_accessor) && normal_accessor.count == vertex_count && normal_accessor.components == 3;
+	bool has_tangents = doc.Accessor(attributes->Int("TANGENT", -1), tangent_accessor) && tangent_accessor.count == vertex_count && tangent_accessor.components == 4;
+	bool has_uvs = doc.Accessor(attributes->Int("TEXCOORD_0", -1), uv_accessor) && uv_accessor.count == vertex_count && uv_accessor.components == 2;
+
+	std::vector<uint32_t> indices;
+	GltfAccessor index_accessor;
+	if (primitive.Find("indices") != nullptr) {
+		if (!doc.Accessor(primitive.Int("indices", -1), index_accessor) || index_accessor.components != 1) {
+			return false;
+		}
+
+		indices.resize(index_accessor.count);
+		for (size_t i = 0; i < index_accessor.count; i++) {
+			indices[i] = index_accessor.Index(i);
+			if (indices[i] >= vertex_count) return false;
+		}
+	}
+	else {
+		indices.resize(vertex_count);
+		for (size_t i = 0; i < vertex_count; i++) {
+			indices[i] = uint32_t(i);
+		}
+	}
+
+	int mode = primitive.Int("mode", GLTF_MODE_TRIANGLES);
+	if (mode != GLTF_MODE_TRIANGLES && indices.size() >= 3) {
+		std::vector<uint32_t> triangles;
+		triangles.reserve((indices.size() - 2) * 3);
+		for (size_t i = 2; i < indices.size(); i++) {
+			if (mode == GLTF_MODE_TRIANGLE_FAN) {
+				triangles.insert(triangles.end(), { indices[0], indices[i - 1], indices[i] });
+			}
+			else if (i % 2 == 0) {
+				triangles.insert(triangles.end(), { indices[i - 2], indices[i - 1], indices[i] });
+			}
+			else {
+				triangles.insert(triangles.end(), { indices[i - 1], indices[i - 2], indices[i] });
+			}
+		}
+		indices = std::move(triangles);
+	}
+
+	indices.resize(indices.size() - indices.size() % 3);
+
+	// nothing to draw, the primitive is dropped by the caller instead of failing the whole file
+	if (indices.empty()) {
+		mesh = {};
+		return true;
+	}
+
+	// positions may be quantized relative to the bounds, so they have to be known before encoding
+	AABB bounds = { glm::vec3(0.0f), glm::vec3(0.0f) };
+	if (position_accessor.has_bounds) {
+		bounds = { position_accessor.min, position_accessor.max };
+	}
+	else if (vertex_count > 0) {
+		bounds.min = bounds.max = glm::vec3(position_accessor.Get(0, glm::vec4(0.0f)));
+		for (size_t i = 1; i < vertex_count; i++) {
+			glm::vec3 p = glm::vec3(position_accessor.Get(i, glm::vec4(0.0f)));
+			bounds.min = glm::min(bounds.min, p);
+			bounds.max = glm::max(bounds.max, p);
+		}
+	}
+
+	std::vector<MeshVertex> vertices(vertex_count);
+
+	if (has_normals && (has_tangents || !has_uvs)) {
+		// everything the encoder needs is in the file, decode straight from the accessors into the packed stream
+		for (size_t i = 0; i < vertex_count; i++) {
+			glm::vec3 position = glm::vec3(position_accessor.Get(i, glm::vec4(0.0f)));
+			glm::vec3 normal = glm::vec3(normal_accessor.Get(i, glm::vec4(0.0f)));
+			glm::vec4 tangent = has_tangents ? tangent_accessor.Get(i, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)) : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+			glm::vec4 uv = has_uvs ? uv_accessor.Get(i, glm::vec4(0.0f)) : glm::vec4(0.0f);
+
+			EncodeVertex(vertices[i], bounds, position, normal, tangent, glm::vec2(uv.x, uv.y));
+		}
+	}
+	else {
+		// missing normals or tangents have to be generated from the whole triangle list first
+		std::vector<glm::vec3> positions(vertex_count);
+		std::vector<glm::vec3> normals(vertex_count);
+		std::vector<glm::vec2> uvs(vertex_count, glm::vec2(0.0f));
+		std::vector<glm::vec4> tangents(vertex_count, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+		for (size_t i = 0; i < vertex_count; i++) {
+			positions[i] = glm::vec3(position_accessor.Get(i, glm::vec4(0.0f)));
+			if (has_uvs) {
+				glm::vec4 uv = uv_accessor.Get(i, glm::vec4(0.0f));
+				uvs[i] = glm::vec2(uv.x, uv.y);
+			}
+		}
+
+		if (has_normals) {
+			for (size_t i = 0; i < vertex_count; i++) {
+				normals[i] = glm::vec3(normal_accessor.Get(i, glm::vec4(0.0f)));
+			}
+		}
+		else {
+			ComputeNormals(positions, indices, normals);
+		}
+
+		if (has_tangents) {
+			for (size_t i = 0; i < vertex_count; i++) {
+				tangents[i] = tangent_accessor.Get(i, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+			}
+		}
+		else if (has_uvs) {
+			ComputeTangents(positions, normals, uvs, indices, tangents);
+		}
+
+		for (size_t i = 0; i < vertex_count; i++) {
+			EncodeVertex(vertices[i], bounds, positions[i], normals[i], tangents[i], uvs[i]);
+		}
+	}
+
+	mesh = {
+		.textures = {},
+		.base_color = glm::vec4(1.0f),
+		.emissive_color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f),
+		.specular_color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f),
+		.bounds = bounds,
+		.visible = true,
+	};
+
+	FinalizeMeshGeometry(mesh, std::move(vertices), std::move(indices), options);
+
+	return true;
+}
+
+static void FindTexture(const GltfDocument& doc, const JsonValue* texture_info, bool srgb, MaterialTexture& texture)
+{
+	auto textures = doc.json.Find("textures");
+	if (texture_info == nullptr || textures == nullptr) return;
+
+	int texture_index = texture_info->Int("index", -1);
+	if (texture_index < 0 || size_t(texture_index) >= textures->Size()) return;
+
+	// KHR_texture_basisu points at a ktx2 image, "source" is then the fallback for loaders without ktx2
+	const auto& texture_json = (*textures)[texture_index];
+	int image_index = texture_json.Int("source", -1);
+	auto extensions = texture_json.Find("extensions");
+	auto basisu = extensions != nullptr ? extensions->Find("KHR_texture_basisu") : nullptr;
+	if (basisu != nullptr) {
+		image_index = basisu->Int("source", image_index);
+	}
+	if (image_index < 0 || size_t(image_index) >= doc.images.size()) return;
+
+	const auto& image = doc.images[image_index];
+	texture.path = image.path;
+	texture.data = image.data;
+	texture.size = image.size;
+	texture.srgb = srgb;
+}
+
+static void ApplyMaterial(const GltfDocument& doc, const JsonValue& primitive, Mesh& mesh)
+{
+	auto materials = doc.json.Find("materials");
+	int material_index = primitive.Int("material", -1);
+	if (materials == nullptr || material_index < 0 || size_t(material_index) >= materials->Size()) {
+		return;
+	}
+
+	const auto& material = (*materials)[material_index];
+
+	auto emissive = material.Find("emissiveFactor");
+	if (emissive != nullptr && emissive->Size() == 3) {
+		mesh.emissive_color = { float((*emissive)[0].number), float((*emissive)[1].number), float((*emissive)[2].number), 1.0f };
+	}
+
+	auto pbr = material.Find("pbrMetallicRoughness");
+	if (pbr == nullptr) {
+		return;
+	}
+
+	auto base_color = pbr->Find("baseColorFactor");
+	if (base_color != nullptr && base_color->Size() == 4) {
+		mesh.base_color = { float((*base_color)[0].number), float((*base_color)[1].number), float((*base_color)[2].number), float((*base_color)[3].number) };
+	}
+
+	FindTexture(doc, pbr->Find("baseColorTexture"), true, mesh.texture_sources[BASE_COLOR_MAP_INDEX]);
+	FindTexture(doc, pbr->Find("metallicRoughnessTexture"), false, mesh.texture_sources[OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX]);
+	FindTexture(doc, material.Find("normalTexture"), false, mesh.texture_sources[NORMAL_MAP_INDEX]);
+	FindTexture(doc, material.Find("emissiveTexture"), true, mesh.texture_sources[EMISSIVE_MAP_INDEX]);
+}
+
+bool IsGltfFile(const char* filename)
+{
+	std::string_view name = filename;
+	auto dot = name.rfind('.');
+	if (dot == std::string_view::npos) return false;
+
+	std::string extension(name.substr(dot));
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return char(tolower(c)); });
+	return extension == ".gltf" || extension == ".glb";
+}
+
+bool LoadGltf(const char* root, const char* filename, float scale, Model& model, std::vector<MappedFile>& mappings, std::vector<ModelCacheDependency>& dependencies)
+{
+	std::string path = JoinPath(root, filename);
+
+	MappedFile file;
+	if (!file.Open(path.c_str())) {
+		return false;
+	}
+	mappings.push_back(file);
+
+	GltfDocument doc;
+	const char* json_begin = (const char*)file.data;
+	const char* json_end = json_begin + file.size;
+	GltfBuffer glb_bin = { nullptr, 0 };
+
+	uint32_t magic = 0;
+	if (file.size >= 12) {
+		memcpy(&magic, file.data, sizeof(magic));
+	}
+
+	if (magic == GLB_MAGIC) {
+		// 12 byte header followed by the JSON chunk and an optional BIN chunk
+		size_t offset = 12;
+		bool has_json = false;
+		while (offset + 8 <= file.size) {
+			uint32_t chunk_length, chunk_type;
+			memcpy(&chunk_length, file.data + offset, sizeof(chunk_length));
+			memcpy(&chunk_type, file.data + offset + 4, sizeof(chunk_type));
+			offset += 8;
+			if (chunk_length > file.size - offset) return false;
+
+			if (chunk_type == GLB_CHUNK_JSON && !has_json) {
+				json_begin = (const char*)file.data + offset;
+				json_end = json_begin + chunk_length;
+				has_json = true;
+			}
+			else if (chunk_type == GLB_CHUNK_BIN && glb_bin.data == nullptr) {
+				glb_bin = { file.data + offset, chunk_length };
+			}
+
+			offset += (chunk_length + 3) & ~3u;
+		}
+
+		if (!has_json) return false;
+	}
+
+	JsonParser parser = { json_begin, json_end };
+	if (!parser.Parse(doc.json) || doc.json.type != JsonValue::TypeObject) {
+		printf("Failed to parse glTF %s\n", path.c_str());
+		return false;
+	}
+
+	// KHR_texture_basisu is the only extension that is handled, files requiring anything else are left to assimp
+	auto required = doc.json.Find("extensionsRequired");
+	for (size_t i = 0; required != nullptr && i < required->Size(); i++) {
+		if ((*required)[i].string != "KHR_texture_basisu") {
+			return false;
+		}
+	}
+
+	auto buffers = doc.json.Find("buffers");
+	for (size_t i = 0; buffers != nullptr && i < buffers->Size(); i++) {
+		auto uri = (*buffers)[i].String("uri");
+		size_t byte_length = size_t((*buffers)[i].Number("byteLength", 0));
+
+		if (uri == nullptr) {
+			if (i != 0 || glb_bin.data == nullptr || glb_bin.size < byte_length) return false;
+			doc.buffers.push_back(glb_bin);
+			continue;
+		}
+
+		if (uri->compare(0, 5, "data:") == 0) {
+			return false;
+		}
+
+		std::string buffer_path = JoinPath(root, DecodeUri(*uri));
+		MappedFile buffer;
+		if (!buffer.Open(buffer_path.c_str()) || buffer.size < byte_length) {
+			buffer.Close();
+			return false;
+		}
+		mappings.push_back(buffer);
+		dependencies.push_back({ buffer_path, HashBytes(buffer.data, buffer.size) });
+		doc.buffers.push_back({ buffer.data, buffer.size });
+	}
+
+	auto buffer_views = doc.json.Find("bufferViews");
+	for (size_t i = 0; buffer_views != nullptr && i < buffer_views->Size(); i++) {
+		const auto& v = (*buffer_views)[i];
+		GltfBufferView view = {
+			.buffer = size_t(v.Int("buffer", -1)),
+			.offset = size_t(v.Number("byteOffset", 0)),
+			.length = size_t(v.Number("byteLength", 0)),
+			.stride = size_t(v.Number("byteStride", 0)),
+		};
+
+		if (view.buffer >= doc.buffers.size() || view.offset > doc.buffers[view.buffer].size || view.length > doc.buffers[view.buffer].size - view.offset) {
+			return false;
+		}
+		doc.buffer_views.push_back(view);
+	}
+
+	auto images = doc.json.Find("images");
+	for (size_t i = 0; images != nullptr && i < images->Size(); i++) {
+		const auto& image = (*images)[i];
+		auto uri = image.String("uri");
+
+		if (uri != nullptr) {
+			if (uri->compare(0, 5, "data:") == 0) return false;
+			doc.images.push_back({ DecodeUri(*uri), nullptr, 0 });
+			continue;
+		}
+
+		int view_index = image.Int("bufferView", -1);
+		if (view_index < 0 || size_t(view_index) >= doc.buffer_views.size()) return false;
+
+		// same "*N" naming Assimp uses for embedded textures
+		const auto& view = doc.buffer_views[view_index];
+		doc.images.push_back({ "*" + std::to_string(i), doc.buffers[view.buffer].data + view.offset, view.length });
+	}
+
+	GltfPrimitiveSet items;
+	model.instances.clear();
+	glm::mat4 transform = glm::scale(glm::mat4(1.0f), { scale, scale, scale });
+
+	auto scenes = doc.json.Find("scenes");
+	int scene_index = doc.json.Int("scene", 0);
+	if (scenes != nullptr && scene_index >= 0 && size_t(scene_index) < scenes->Size()) {
+		auto roots = (*scenes)[scene_index].Find("nodes");
+		for (size_t i = 0; roots != nullptr && i < roots->Size(); i++) {
+			WalkNode(doc, int((*roots)[i].number), transform, 0, items, model);
+		}
+	}
+	else if (auto nodes = doc.json.Find("nodes")) {
+		// no scene, every node that is nobody's child is a root
+		std::vector<bool> is_child(nodes->Size(), false);
+		for (size_t i = 0; i < nodes->Size(); i++) {
+			auto children = (*nodes)[i].Find("children");
+			for (size_t c = 0; children != nullptr && c < children->Size(); c++) {
+				size_t child = size_t((*children)[c].number);
+				if (child < is_child.size()) is_child[child] = true;
+			}
+		}
+		for (size_t i = 0; i < nodes->Size(); i++) {
+			if (!is_child[i]) WalkNode(doc, int(i), transform, 0, items, model);
+		}
+	}
+
+	if (items.primitives.empty()) {
+		return false;
+	}
+
+	std::vector<Mesh> meshes(items.primitives.size());
+	std::vector<uint8_t> ok(items.primitives.size(), 0);
+
+	// the parallel algorithms may hand out copies of the elements, so iterate indices instead of addresses
+	std::vector<size_t> primitive_indices(items.primitives.size());
+	std::iota(primitive_indices.begin(), primitive_indices.end(), 0);
+
+	std::for_each(std::execution::par, primitive_indices.begin(), primitive_indices.end(), [&](size_t index) {
+		ok[index] = ProcessPrimitive(doc, *items.primitives[index], model.import_options, meshes[index]);
+	});
+
+	// primitives without a single triangle are left empty, the remaining meshes are renumbered
+	std::vector<uint32_t> mesh_slots(items.primitives.size(), UINT32_MAX);
+
+	model.meshes.clear();
+	for (size_t i = 0; i < items.primitives.size(); i++) {
+		if (!ok[i]) {
+			printf("Failed to read glTF primitive in %s\n", path.c_str());
+			model.meshes.clear();
+			model.instances.clear();
+			return false;
+		}
+
+		if (meshes[i].indices.empty()) {
+			continue;
+		}
+
+		ApplyMaterial(doc, *items.primitives[i], meshes[i]);
+		mesh_slots[i] = uint32_t(model.meshes.size());
+		model.meshes.push_back(std::move(meshes[i]));
+	}
+
+	std::erase_if(model.instances, [&](const MeshInstance& instance) {
+		return mesh_slots[instance.mesh] == UINT32_MAX;
+	});
+	for (auto& instance : model.instances) {
+		instance.mesh = mesh_slots[instance.mesh];
+	}
+
+	return !model.meshes.empty();
+}
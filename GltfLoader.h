@@ -0,0 +1,23 @@
+#pragma once
+#include <vector>
+
+#include "MappedFile.h"
+#include "ModelCache.h"
+
+struct Model;
+
+/**
+* checks the extension of filename for .gltf / .glb
+*/
+bool IsGltfFile(const char* filename);
+
+/**
+* imports a glTF 2.0 file (.gltf + external buffers or a single .glb) without going through Assimp.
+* buffers are memory mapped and accessors are decoded in place straight into packed MeshVertex streams,
+* embedded images are handed to the textures as views into the mappings, so keep mappings open until
+* the textures are loaded and close them afterwards (also when this fails). external buffers are added to
+* dependencies so the model cache notices when one of them changes
+* @returns false for files this loader does not handle (data uris, sparse accessors, required extensions),
+* the caller is expected to fall back to Assimp
+*/
+bool LoadGltf(const char* root, const char* filename, float scale, Model& model, std::vector<MappedFile>& mappings, std::vector<ModelCacheDependency>& dependencies);
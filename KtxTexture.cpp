@@ -0,0 +1,139 @@
+#include "KtxTexture.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <ktx.h>
+
+// vkFormat values of the formats KTX2 files are uploaded in without transcoding
+#define VK_FORMAT_R8G8B8A8_UNORM 37
+#define VK_FORMAT_R8G8B8A8_SRGB 43
+#define VK_FORMAT_BC1_RGBA_UNORM_BLOCK 133
+#define VK_FORMAT_BC1_RGBA_SRGB_BLOCK 134
+#define VK_FORMAT_BC3_UNORM_BLOCK 137
+#define VK_FORMAT_BC3_SRGB_BLOCK 138
+#define VK_FORMAT_BC4_UNORM_BLOCK 139
+#define VK_FORMAT_BC5_UNORM_BLOCK 141
+#define VK_FORMAT_BC7_UNORM_BLOCK 145
+#define VK_FORMAT_BC7_SRGB_BLOCK 146
+
+uint32_t ChooseKtxTranscodeFormat()
+{
+	if (GLEW_ARB_texture_compression_bptc) {
+		return KTX_TTF_BC7_RGBA;
+	}
+	if (GLEW_EXT_texture_compression_s3tc) {
+		return KTX_TTF_BC3_RGBA;
+	}
+	if (GLEW_KHR_texture_compression_astc_ldr) {
+		return KTX_TTF_ASTC_4x4_RGBA;
+	}
+	if (GLEW_ARB_ES3_compatibility) {
+		return KTX_TTF_ETC2_RGBA;
+	}
+	return KTX_TTF_RGBA32;
+}
+
+const char* KtxTranscodeFormatName(uint32_t transcode_format)
+{
+	switch (transcode_format) {
+	case KTX_TTF_BC7_RGBA: return "BC7";
+	case KTX_TTF_BC3_RGBA: return "BC3";
+	case KTX_TTF_ASTC_4x4_RGBA: return "ASTC 4x4";
+	case KTX_TTF_ETC2_RGBA: return "ETC2";
+	case KTX_TTF_RGBA32: return "RGBA8";
+	}
+	return "unknown";
+}
+
+bool IsKtx2(const uint8_t* data, size_t size)
+{
+	static const uint8_t identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+	return data != nullptr && size >= sizeof(identifier) && memcmp(data, identifier, sizeof(identifier)) == 0;
+}
+
+// gl format of a transcode target, compressed unless the context had no block format at all
+static int TranscodedFormat(uint32_t transcode_format, bool srgb)
+{
+	switch (transcode_format) {
+	case KTX_TTF_BC7_RGBA: return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+	case KTX_TTF_BC3_RGBA: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case KTX_TTF_ASTC_4x4_RGBA: return srgb ? GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR : GL_COMPRESSED_RGBA_ASTC_4x4_KHR;
+	case KTX_TTF_ETC2_RGBA: return srgb ? GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC : GL_COMPRESSED_RGBA8_ETC2_EAC;
+	}
+	return srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+}
+
+// the file's own format decides between the unorm and srgb variant here, it was encoded that way
+static int StoredFormat(uint32_t vk_format)
+{
+	switch (vk_format) {
+	case VK_FORMAT_R8G8B8A8_UNORM: return GL_RGBA8;
+	case VK_FORMAT_R8G8B8A8_SRGB: return GL_SRGB8_ALPHA8;
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;
+	case VK_FORMAT_BC3_UNORM_BLOCK: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case VK_FORMAT_BC3_SRGB_BLOCK: return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+	case VK_FORMAT_BC4_UNORM_BLOCK: return GL_COMPRESSED_RED_RGTC1;
+	case VK_FORMAT_BC5_UNORM_BLOCK: return GL_COMPRESSED_RG_RGTC2;
+	case VK_FORMAT_BC7_UNORM_BLOCK: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	case VK_FORMAT_BC7_SRGB_BLOCK: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+	}
+	return 0;
+}
+
+bool LoadKtx2(const uint8_t* data, size_t size, bool srgb, uint32_t transcode_format, KtxImage& image)
+{
+	ktxTexture2* texture = nullptr;
+	// loading the image data also inflates zstd supercompressed levels
+	KTX_error_code result = ktxTexture2_CreateFromMemory(data, size, KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, &texture);
+	if (result != KTX_SUCCESS) {
+		printf("Failed to read KTX2 texture: %s\n", ktxErrorString(result));
+		return false;
+	}
+
+	if (texture->numFaces != 1 || texture->numLayers > 1 || texture->baseDepth > 1) {
+		printf("KTX2 cube maps, arrays and 3d textures are not supported\n");
+		ktxTexture_Destroy(ktxTexture(texture));
+		return false;
+	}
+
+	if (ktxTexture2_NeedsTranscoding(texture)) {
+		result = ktxTexture2_TranscodeBasis(texture, ktx_transcode_fmt_e(transcode_format), 0);
+		if (result != KTX_SUCCESS) {
+			printf("Failed to transcode KTX2 texture: %s\n", ktxErrorString(result));
+			ktxTexture_Destroy(ktxTexture(texture));
+			return false;
+		}
+		image.internal_format = TranscodedFormat(transcode_format, srgb);
+		image.compressed = transcode_format != KTX_TTF_RGBA32;
+	}
+	else {
+		image.internal_format = StoredFormat(texture->vkFormat);
+		image.compressed = texture->isCompressed;
+		if (image.internal_format == 0) {
+			printf("Unsupported KTX2 format %u\n", texture->vkFormat);
+			ktxTexture_Destroy(ktxTexture(texture));
+			return false;
+		}
+	}
+
+	image.pixel_format = image.compressed ? image.internal_format : GL_RGBA;
+	image.width = int(texture->baseWidth);
+	image.height = int(texture->baseHeight);
+	image.levels.count = int(std::min<ktx_uint32_t>(texture->numLevels, TEXTURE_MAX_LEVELS));
+	for (int level = 0; level < image.levels.count; level++) {
+		ktx_size_t offset = 0;
+		ktxTexture_GetImageOffset(ktxTexture(texture), ktx_uint32_t(level), 0, 0, &offset);
+		image.levels.offsets[level] = size_t(offset);
+		image.levels.sizes[level] = size_t(ktxTexture_GetImageSize(ktxTexture(texture), ktx_uint32_t(level)));
+	}
+
+	image.size = size_t(ktxTexture_GetDataSize(ktxTexture(texture)));
+	image.data = new uint8_t[image.size];
+	memcpy(image.data, ktxTexture_GetData(ktxTexture(texture)), image.size);
+
+	ktxTexture_Destroy(ktxTexture(texture));
+	return true;
+}
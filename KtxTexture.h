@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "opengl.h"
+
+/**
+* a KTX2 texture ready for upload, levels are stored back to back in data (allocated with new[])
+*/
+struct KtxImage {
+	uint8_t* data;
+	size_t size;
+	ogl::TextureLevels levels;
+	int width, height;
+	int internal_format;
+	int pixel_format;
+	bool compressed;
+};
+
+/**
+* picks what Basis Universal (UASTC and ETC1S) textures are transcoded to, the best block format the context
+* can sample: BC7, then BC3, ASTC 4x4, ETC2 and uncompressed RGBA8 as the last resort.
+* reads the gl extension flags, call once on the gl thread and hand the result to the workers
+*/
+uint32_t ChooseKtxTranscodeFormat();
+
+const char* KtxTranscodeFormatName(uint32_t transcode_format);
+
+// checks the KTX2 file identifier, independent of the file name so embedded images are recognized too
+bool IsKtx2(const uint8_t* data, size_t size);
+
+/**
+* parses a KTX2 file, inflates Zstd supercompressed levels and transcodes Basis payloads to transcode_format.
+* textures that already hold a block or RGBA8 format are kept as they are. safe to call on worker threads
+* @param srgb picks the srgb variant of the gl format, like the other texture paths it follows the material slot
+* @returns false for unsupported files (cube maps, arrays, 3d textures, unknown formats)
+*/
+bool LoadKtx2(const uint8_t* data, size_t size, bool srgb, uint32_t transcode_format, KtxImage& image);
@@ -0,0 +1,85 @@
+#include "MappedFile.h"
+#include <cstring>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+bool MappedFile::Open(const char* path)
+{
+	Close();
+
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	data = (const uint8_t*)view;
+	size = size_t(file_size.QuadPart);
+	file_handle = file;
+	mapping_handle = mapping;
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data != nullptr) {
+		UnmapViewOfFile(data);
+	}
+
+	if (mapping_handle != nullptr) {
+		CloseHandle(mapping_handle);
+	}
+
+	if (file_handle != nullptr) {
+		CloseHandle(file_handle);
+	}
+
+	data = nullptr;
+	size = 0;
+	file_handle = nullptr;
+	mapping_handle = nullptr;
+}
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+{
+	// FNV-1a style mixing over 8 byte words, the tail is hashed byte by byte
+	const uint64_t prime = 0x100000001b3ull;
+	const uint8_t* bytes = (const uint8_t*)data;
+	uint64_t hash = seed ^ (size * prime);
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash ^= word;
+		hash *= prime;
+		hash ^= hash >> 29;
+	}
+
+	for (; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= prime;
+	}
+
+	return hash;
+}
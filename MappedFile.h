@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+/**
+* read-only memory mapping of a whole file. the view stays valid until Close is called
+*/
+struct MappedFile
+{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+
+	bool Open(const char* path);
+	void Close();
+};
+
+/**
+* 64 bit hash of a byte range, used to key on-disk caches by their source file contents
+*/
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull);
@@ -1,17 +1,23 @@
 #include "Model.h"
 #include <assimp/Importer.hpp>
+#include <assimp/DefaultIOSystem.h>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <GL/glew.h>
 #include <execution>
+#include <numeric>
 #include <sstream>
 #include <stb_image.h>
 #include <set>
+#include <map>
+#include <tuple>
 
 #include <meshoptimizer.h>
 #include <glm/ext/matrix_transform.hpp>
 
 #include "TextureLoader.h"
+#include "ModelCache.h"
+#include "GltfLoader.h"
 
 std::tuple<std::vector<MeshVertex>, std::vector<unsigned int>> Optimize(const float* vertices, const unsigned int* indices, size_t verticesCount, size_t indicesCount) {
 
@@ -29,117 +35,137 @@ std::tuple<std::vector<MeshVertex>, std::vector<unsigned int>> Optimize(const fl
 	return { std::move(optVertices), std::move(optIndices) };
 }
 
-void Model::ProcessMesh(aiMesh* mesh, const aiScene* scene, const char* root, const glm::mat4& transform, bool load_textures)
+void EncodeVertex(MeshVertex& vertex, const AABB& bounds, const glm::vec3& position, const glm::vec3& normal, const glm::vec4& tangent, const glm::vec2& uv)
 {
-	std::vector<MeshVertex> vertices(mesh->mNumVertices);
-	{
-		MeshVertex v = {
-			0, 0, 0, 0,
-			0, 0, 0, 0,
-			0, 0, 0, 0,
-			0, 0,
-		};
+	MeshVertexLayout::Encode(vertex, bounds.min, bounds.max, position, normal, tangent, uv);
+}
 
-		std::fill(vertices.begin(), vertices.end(), v);
-	}
+glm::vec3 DecodePosition(const MeshVertex& vertex, const AABB& bounds)
+{
+	return MeshVertexLayout::DecodePosition(vertex, bounds.min, bounds.max);
+}
 
-	if (mesh->HasPositions())
-	{
-		for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
-		{
-#ifdef PACK
-			vertices[i].x = meshopt_quantizeHalf(mesh->mVertices[i].x);
-			vertices[i].y = meshopt_quantizeHalf(mesh->mVertices[i].y);
-			vertices[i].z = meshopt_quantizeHalf(mesh->mVertices[i].z);
-			vertices[i].w = meshopt_quantizeHalf(1.0f);
-#else
-			vertices[i].x = mesh->mVertices[i].x;
-			vertices[i].y = mesh->mVertices[i].y;
-			vertices[i].z = mesh->mVertices[i].z;
-			vertices[i].w = 1.0f;
-#endif // PACK
+glm::mat4 PositionDequantization(const AABB& bounds)
+{
+	return MeshVertexLayout::PositionDequantization(bounds.min, bounds.max);
+}
 
-		}
+AABB TransformBounds(const AABB& bounds, const glm::mat4& transform)
+{
+	glm::vec3 center = glm::vec3(transform * glm::vec4((bounds.min + bounds.max) * 0.5f, 1.0f));
+	glm::vec3 half_extent = (bounds.max - bounds.min) * 0.5f;
+
+	glm::vec3 extent(0.0f);
+	for (int axis = 0; axis < 3; axis++) {
+		extent += glm::abs(glm::vec3(transform[axis])) * half_extent[axis];
 	}
 
-	if (mesh->HasNormals()) {
-		for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
-		{
-#ifdef PACK
-			vertices[i].nx = uint8_t(mesh->mNormals[i].x * 127.f + 127.5f);
-			vertices[i].ny = uint8_t(mesh->mNormals[i].y * 127.f + 127.5f);
-			vertices[i].nz = uint8_t(mesh->mNormals[i].z * 127.f + 127.5f);
-			vertices[i].nw = 1 * 127.f + 127.5f;
-#else
-			vertices[i].nx = mesh->mNormals[i].x;
-			vertices[i].ny = mesh->mNormals[i].y;
-			vertices[i].nz = mesh->mNormals[i].z;
-			vertices[i].nw = 1.0f;
-#endif
+	return { center - extent, center + extent };
+}
 
-			//vertices[i].normal = { mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z, 0.0f };
-		}
+// meshopt wants float positions, decode the packed ones so bounds and errors match what gets rendered
+static std::vector<glm::vec3> DecodePositions(const std::vector<MeshVertex>& vertices, const AABB& bounds)
+{
+	std::vector<glm::vec3> positions(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		positions[i] = DecodePosition(vertices[i], bounds);
 	}
+	return positions;
+}
 
-	if (mesh->HasTangentsAndBitangents())
-	{
-		for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
-		{
-#ifdef PACK
-
-			auto N = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
-			auto T = glm::vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
-			auto B = glm::vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
+void BuildLods(Mesh& mesh)
+{
+	uint32_t base_count = mesh.lods.empty() ? uint32_t(mesh.indices.size()) : mesh.lods[0].index_count;
 
-			float handedness = glm::dot(glm::cross(N, T), B) < 0.0f ? -1.0f : 1.0f;
+	mesh.indices.resize(base_count);
+	mesh.lods.clear();
+	mesh.lods.push_back({ .index_offset = 0, .index_count = base_count, .error = 0.0f });
 
-			T = T * handedness;
+	if (base_count == 0) {
+		return;
+	}
 
-			vertices[i].tx = uint8_t(T.x * 127.f + 127.5f);
-			vertices[i].ty = uint8_t(T.y * 127.f + 127.5f);
-			vertices[i].tz = uint8_t(T.z * 127.f + 127.5f);
-			vertices[i].tw = uint8_t(handedness * 127.f + 127.5f);
+	auto positions = DecodePositions(mesh.vertices, mesh.bounds);
+	float scale = meshopt_simplifyScale(&positions[0].x, positions.size(), sizeof(glm::vec3));
 
-			//vertices[i].bx = uint8_t(B.x * 127.f + 127.5f);
-			//vertices[i].by = uint8_t(B.y * 127.f + 127.5f);
-			//vertices[i].bz = uint8_t(B.z * 127.f + 127.5f);
-			//vertices[i].bw = uint8_t(1 * 127.f + 127.5f);
+	std::vector<uint32_t> source(mesh.indices);
+	std::vector<uint32_t> lod_indices(base_count);
 
-#else 
-			vertices[i].tx = mesh->mTangents[i].x;
-			vertices[i].ty = mesh->mTangents[i].y;
-			vertices[i].tz = mesh->mTangents[i].z;
-			vertices[i].tw = 1.0f;
+	// every level is simplified from the previous one, so the errors add up along the chain
+	while (mesh.lods.size() < MESH_MAX_LODS) {
+		MeshLod previous = mesh.lods.back();
+		size_t target = size_t(previous.index_count * MESH_LOD_REDUCTION) / 3 * 3;
+		if (target < MESH_LOD_MIN_INDICES) {
+			break;
+		}
 
-			//vertices[i].bx = mesh->mBitangents[i].x;
-			//vertices[i].by = mesh->mBitangents[i].y;
-			//vertices[i].bz = mesh->mBitangents[i].z;
-			//vertices[i].bw = 1.0f;
-#endif
+		float lod_error = 0.0f;
+		size_t count = meshopt_simplify(lod_indices.data(), source.data(), previous.index_count, &positions[0].x, positions.size(), sizeof(glm::vec3),
+			target, MESH_LOD_TARGET_ERROR, 0, &lod_error);
 
-			//vertices[i].tangent = { mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z, 0.0 };
+		if (count == 0 || count > previous.index_count * MESH_LOD_MIN_REDUCTION) {
+			break;
 		}
+
+		meshopt_optimizeVertexCache(lod_indices.data(), lod_indices.data(), count, positions.size());
+
+		mesh.lods.push_back({
+			.index_offset = uint32_t(mesh.indices.size()),
+			.index_count = uint32_t(count),
+			.error = previous.error + lod_error * scale,
+		});
+		mesh.indices.insert(mesh.indices.end(), lod_indices.begin(), lod_indices.begin() + count);
+		source.assign(lod_indices.begin(), lod_indices.begin() + count);
 	}
+}
 
-	if (mesh->HasTextureCoords(0))
-	{
-		for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
-		{
-			vertices[i].u = meshopt_quantizeHalf(mesh->mTextureCoords[0][i].x);
-			vertices[i].v = meshopt_quantizeHalf(mesh->mTextureCoords[0][i].y);
+void BuildMeshlets(Mesh& mesh)
+{
+	mesh.meshlets.clear();
+	mesh.meshlet_vertices.clear();
+	mesh.meshlet_triangles.clear();
 
-			//vertices[i].uv = { mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y };
-		}
+	size_t index_count = mesh.lods.empty() ? mesh.indices.size() : mesh.lods[0].index_count;
+	if (index_count == 0) {
+		return;
 	}
 
-	std::vector<unsigned int> indices;
-	indices.reserve(mesh->mNumFaces * 3);
-	for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-		aiFace face = mesh->mFaces[i];
-		for (unsigned int j = 0; j < face.mNumIndices; j++)
-			indices.push_back(face.mIndices[j]);
+	auto positions = DecodePositions(mesh.vertices, mesh.bounds);
+
+	size_t max_meshlets = meshopt_buildMeshletsBound(index_count, MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES);
+	std::vector<meshopt_Meshlet> meshlets(max_meshlets);
+	mesh.meshlet_vertices.resize(max_meshlets * MESHLET_MAX_VERTICES);
+	mesh.meshlet_triangles.resize(max_meshlets * MESHLET_MAX_TRIANGLES * 3);
+
+	size_t meshlet_count = meshopt_buildMeshlets(meshlets.data(), mesh.meshlet_vertices.data(), mesh.meshlet_triangles.data(),
+		mesh.indices.data(), index_count, &positions[0].x, positions.size(), sizeof(glm::vec3),
+		MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES, MESHLET_CONE_WEIGHT);
+
+	const auto& last = meshlets[meshlet_count - 1];
+	mesh.meshlet_vertices.resize(last.vertex_offset + last.vertex_count);
+	mesh.meshlet_triangles.resize(last.triangle_offset + ((last.triangle_count * 3 + 3) & ~3));
+
+	mesh.meshlets.resize(meshlet_count);
+	for (size_t i = 0; i < meshlet_count; i++) {
+		const auto& meshlet = meshlets[i];
+		auto bounds = meshopt_computeMeshletBounds(&mesh.meshlet_vertices[meshlet.vertex_offset], &mesh.meshlet_triangles[meshlet.triangle_offset],
+			meshlet.triangle_count, &positions[0].x, positions.size(), sizeof(glm::vec3));
+
+		mesh.meshlets[i] = {
+			.vertex_offset = meshlet.vertex_offset,
+			.triangle_offset = meshlet.triangle_offset,
+			.vertex_count = meshlet.vertex_count,
+			.triangle_count = meshlet.triangle_count,
+			.center = { bounds.center[0], bounds.center[1], bounds.center[2] },
+			.radius = bounds.radius,
+			.cone_axis = { bounds.cone_axis[0], bounds.cone_axis[1], bounds.cone_axis[2] },
+			.cone_cutoff = bounds.cone_cutoff,
+		};
 	}
+}
 
+void FinalizeMeshGeometry(Mesh& mesh, std::vector<MeshVertex>&& vertices, std::vector<uint32_t>&& indices, uint32_t options)
+{
 #define OPTIMIZE
 
 #ifdef OPTIMIZE
@@ -148,30 +174,52 @@ void Model::ProcessMesh(aiMesh* mesh, const aiScene* scene, const char* root, co
 	vertices.clear();
 	indices.clear();
 
-	auto verticesSize = sizeof(MeshVertex) * optVertices.size();
-	auto indicesSize = sizeof(unsigned int) * optIndices.size();
+	mesh.vertices = std::move(optVertices);
+	mesh.indices = std::move(optIndices);
+#else
+	mesh.vertices = std::move(vertices);
+	mesh.indices = std::move(indices);
+#endif // OPTIMIZE
 
-	Mesh gpuMesh = {
-		.vertices = std::move(optVertices),
-		.indices = std::move(optIndices),
-		.textures = {},
-		.transform = transform,
-		.bounds = {
-			.min = {mesh->mAABB.mMin.x, mesh->mAABB.mMin.y, mesh->mAABB.mMin.z},
-			.max = {mesh->mAABB.mMax.x, mesh->mAABB.mMax.y, mesh->mAABB.mMax.z},
-		},
-		.visible = true,
-	};
+	mesh.lods = { { .index_offset = 0, .index_count = uint32_t(mesh.indices.size()), .error = 0.0f } };
 
-#else
-	auto verticesSize = sizeof(MeshVertex) * vertices.size();
-	auto indicesSize = sizeof(unsigned int) * indices.size();
+	if (options & MODEL_IMPORT_LODS) {
+		BuildLods(mesh);
+	}
+
+	if (options & MODEL_IMPORT_MESHLETS) {
+		BuildMeshlets(mesh);
+	}
+}
+
+// records where the first texture of type comes from, the actual load happens in Model::LoadTextures
+static bool FindMaterialTexture(const aiMaterial* mat, const aiScene* scene, aiTextureType type, bool srgb, MaterialTexture& texture)
+{
+	if (mat->GetTextureCount(type) == 0) {
+		return false;
+	}
+
+	aiString path;
+	mat->GetTexture(type, 0, &path);
+
+	texture.path = path.C_Str();
+	texture.srgb = srgb;
+
+	if (path.C_Str()[0] == '*')
+	{
+		auto embedded = scene->GetEmbeddedTexture(path.C_Str());
+		texture.data = embedded->pcData;
+		texture.size = embedded->mWidth;
+	}
 
-	Mesh gpuMesh = {
-		.vertices = std::move(vertices),
-		.indices = std::move(indices),
+	return true;
+}
+
+void Model::ProcessMesh(const aiMesh* mesh, const aiScene* scene, Mesh& gpuMesh)
+{
+	// positions may be quantized relative to the bounds, so they have to be known before encoding
+	gpuMesh = {
 		.textures = {},
-		.transform = transform,
 		.bounds = {
 			.min = {mesh->mAABB.mMin.x, mesh->mAABB.mMin.y, mesh->mAABB.mMin.z},
 			.max = {mesh->mAABB.mMax.x, mesh->mAABB.mMax.y, mesh->mAABB.mMax.z},
@@ -179,8 +227,52 @@ void Model::ProcessMesh(aiMesh* mesh, const aiScene* scene, const char* root, co
 		.visible = true,
 	};
 
-#endif // OPTIMIZE
+	std::vector<MeshVertex> vertices(mesh->mNumVertices);
+
+	bool has_positions = mesh->HasPositions();
+	bool has_normals = mesh->HasNormals();
+	bool has_tangents = mesh->HasTangentsAndBitangents();
+	bool has_uvs = mesh->HasTextureCoords(0);
+
+	for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
+	{
+		glm::vec3 position(0.0f);
+		glm::vec3 normal(0.0f);
+		glm::vec4 tangent(0.0f, 0.0f, 0.0f, 1.0f);
+		glm::vec2 uv(0.0f);
 
+		if (has_positions) {
+			position = { mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z };
+		}
+
+		if (has_normals) {
+			normal = { mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z };
+		}
+
+		if (has_tangents) {
+			auto T = glm::vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
+			auto B = glm::vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
+
+			float handedness = glm::dot(glm::cross(normal, T), B) < 0.0f ? -1.0f : 1.0f;
+			tangent = glm::vec4(T, handedness);
+		}
+
+		if (has_uvs) {
+			uv = { mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y };
+		}
+
+		EncodeVertex(vertices[i], gpuMesh.bounds, position, normal, tangent, uv);
+	}
+
+	std::vector<unsigned int> indices;
+	indices.reserve(mesh->mNumFaces * 3);
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+		const aiFace& face = mesh->mFaces[i];
+		for (unsigned int j = 0; j < face.mNumIndices; j++)
+			indices.push_back(face.mIndices[j]);
+	}
+
+	FinalizeMeshGeometry(gpuMesh, std::move(vertices), std::move(indices), import_options);
 
 	bool is_metallic_roughness = false;
 	bool is_specular_glossiness = false;
@@ -217,119 +309,21 @@ void Model::ProcessMesh(aiMesh* mesh, const aiScene* scene, const char* root, co
 		}
 
 
-		if (load_textures) {
-			auto mat = scene->mMaterials[mesh->mMaterialIndex];
-
-			// loading base color, roughness, metallic
-			if (is_metallic_roughness) {
-
-				if (mat->GetTextureCount(aiTextureType_BASE_COLOR) > 0)
-				{
-					aiString path;
-					mat->GetTexture(aiTextureType_BASE_COLOR, 0, &path);
-
-					if (path.C_Str()[0] == '*')
-					{
-						auto texture = scene->GetEmbeddedTexture(path.C_Str());
-						gpuMesh.textures[BASE_COLOR_MAP_INDEX] = TextureLoader::Load(path.C_Str(), texture->pcData, texture->mWidth, true);
-					}
-					else {
-						std::stringstream ss;
-						ss << root << "\\" << path.C_Str();
-						gpuMesh.textures[BASE_COLOR_MAP_INDEX] = TextureLoader::Load(ss.str(), nullptr, 0, true);
-					}
-				}
-				else if (mat->GetTextureCount(aiTextureType_DIFFUSE) > 0)
-				{
-					aiString path;
-					mat->GetTexture(aiTextureType_DIFFUSE, 0, &path);
-
-					if (path.C_Str()[0] == '*')
-					{
-						auto texture = scene->GetEmbeddedTexture(path.C_Str());
-						gpuMesh.textures[BASE_COLOR_MAP_INDEX] = TextureLoader::Load(path.C_Str(), texture->pcData, texture->mWidth, true);
-					}
-					else {
-						std::stringstream ss;
-						ss << root << "\\" << path.C_Str();
-						gpuMesh.textures[BASE_COLOR_MAP_INDEX] = TextureLoader::Load(ss.str(), nullptr, 0, true);
-					}
-				}
-
-
-				// this should be the occlusion metallic roughness map
-				if (mat->GetTextureCount(aiTextureType_METALNESS) > 0)
-				{
-					aiString path;
-					mat->GetTexture(aiTextureType_METALNESS, 0, &path);
-
-					if (path.C_Str()[0] == '*')
-					{
-						auto texture = scene->GetEmbeddedTexture(path.C_Str());
-						gpuMesh.textures[OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX] = TextureLoader::Load(path.C_Str(), texture->pcData, texture->mWidth, false);
-					}
-					else {
-						std::stringstream ss;
-						ss << root << "\\" << path.C_Str();
-						gpuMesh.textures[OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX] = TextureLoader::Load(ss.str(), nullptr, 0, false);
-					}
-				}
-				else if (mat->GetTextureCount(aiTextureType_DIFFUSE_ROUGHNESS) > 0)
-				{
-					aiString path;
-					mat->GetTexture(aiTextureType_DIFFUSE_ROUGHNESS, 0, &path);
-
-					if (path.C_Str()[0] == '*')
-					{
-						auto texture = scene->GetEmbeddedTexture(path.C_Str());
-						gpuMesh.textures[OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX] = TextureLoader::Load(path.C_Str(), texture->pcData, texture->mWidth, false);
-					}
-					else {
-						std::stringstream ss;
-						ss << root << "\\" << path.C_Str();
-						gpuMesh.textures[OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX] = TextureLoader::Load(ss.str(), nullptr, 0, false);
-					}
-				}
-
-				if (mat->GetTextureCount(aiTextureType_NORMALS) > 0)
-				{
-					aiString path;
-					mat->GetTexture(aiTextureType_NORMALS, 0, &path);
-
-					if (path.C_Str()[0] == '*')
-					{
-						auto texture = scene->GetEmbeddedTexture(path.C_Str());
-						gpuMesh.textures[NORMAL_MAP_INDEX] = TextureLoader::Load(path.C_Str(), texture->pcData, texture->mWidth, false);
-					}
-					else {
-						std::stringstream ss;
-						ss << root << "\\" << path.C_Str();
-						gpuMesh.textures[NORMAL_MAP_INDEX] = TextureLoader::Load(ss.str(), nullptr, 0, false);
-					}
-				}
-
-				if (mat->GetTextureCount(aiTextureType_EMISSIVE) > 0)
-				{
-					aiString path;
-					mat->GetTexture(aiTextureType_EMISSIVE, 0, &path);
-
-					if (path.C_Str()[0] == '*')
-					{
-						auto texture = scene->GetEmbeddedTexture(path.C_Str());
-						gpuMesh.textures[EMISSIVE_MAP_INDEX] = TextureLoader::Load(path.C_Str(), texture->pcData, texture->mWidth, true);
-					}
-					else {
-						std::stringstream ss;
-						ss << root << "\\" << path.C_Str();
-						gpuMesh.textures[EMISSIVE_MAP_INDEX] = TextureLoader::Load(ss.str(), nullptr, 0, true);
-					}
-				}
+		// loading base color, roughness, metallic
+		if (is_metallic_roughness) {
+			if (!FindMaterialTexture(mat, scene, aiTextureType_BASE_COLOR, true, gpuMesh.texture_sources[BASE_COLOR_MAP_INDEX])) {
+				FindMaterialTexture(mat, scene, aiTextureType_DIFFUSE, true, gpuMesh.texture_sources[BASE_COLOR_MAP_INDEX]);
 			}
-		}
-	}
 
+			// this should be the occlusion metallic roughness map
+			if (!FindMaterialTexture(mat, scene, aiTextureType_METALNESS, false, gpuMesh.texture_sources[OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX])) {
+				FindMaterialTexture(mat, scene, aiTextureType_DIFFUSE_ROUGHNESS, false, gpuMesh.texture_sources[OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX]);
+			}
 
-	meshes.push_back(gpuMesh);
+			FindMaterialTexture(mat, scene, aiTextureType_NORMALS, false, gpuMesh.texture_sources[NORMAL_MAP_INDEX]);
+			FindMaterialTexture(mat, scene, aiTextureType_EMISSIVE, true, gpuMesh.texture_sources[EMISSIVE_MAP_INDEX]);
+		}
+	}
 }
 
 static inline glm::mat4 AssimpMat4ToGlmMat4(const aiMatrix4x4& from)
@@ -342,54 +336,51 @@ static inline glm::mat4 AssimpMat4ToGlmMat4(const aiMatrix4x4& from)
 	return to;
 }
 
-void Model::ProcessNode(aiNode* node, const aiScene* scene, const char* root, const glm::mat4& transform, bool load_textures)
+void Model::ProcessNode(const aiNode* node, const aiScene* scene, const glm::mat4& transform, std::vector<uint32_t>& mesh_slots, std::vector<const aiMesh*>& unique_meshes)
 {
 	glm::mat4 local_transform = transform * AssimpMat4ToGlmMat4(node->mTransformation);
 
 	for (unsigned int i = 0; i < node->mNumMeshes; ++i)
 	{
-		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		ProcessMesh(mesh, scene, root, local_transform, load_textures);
+		unsigned int source = node->mMeshes[i];
+		if (mesh_slots[source] == UINT32_MAX) {
+			mesh_slots[source] = uint32_t(unique_meshes.size());
+			unique_meshes.push_back(scene->mMeshes[source]);
+		}
+
+		instances.push_back({ mesh_slots[source], local_transform });
 	}
 
 	for (unsigned int i = 0; i < node->mNumChildren; ++i)
 	{
-		ProcessNode(node->mChildren[i], scene, root, local_transform, load_textures);
+		ProcessNode(node->mChildren[i], scene, local_transform, mesh_slots, unique_meshes);
 	}
 }
 
-bool Model::Load(const char* root, const char* filename, float scale, bool load_textures)
+bool Model::ImportAssimp(Assimp::Importer& importer, const char* path, unsigned int flags, float scale)
 {
-	Assimp::Importer importer;
-	char fullPath[256];
-
-	sprintf_s(fullPath, "%s\\%s", root, filename);
-
-	const aiScene* scene = importer.ReadFile(fullPath,
-		aiProcess_Triangulate |
-		aiProcess_FlipUVs |
-		aiProcess_ForceGenNormals |
-		aiProcess_CalcTangentSpace |
-		aiProcess_GenBoundingBoxes);
+	const aiScene* scene = importer.ReadFile(path, flags);
 	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
 		return false;
 	}
 
 	auto transform = AssimpMat4ToGlmMat4(scene->mRootNode->mTransformation);
 	transform *= glm::scale(glm::mat4(1.0f), { scale, scale, scale });
-	ProcessNode(scene->mRootNode, scene, root, transform, load_textures);
 
-	bounds.min = meshes[0].bounds.min;
-	bounds.max = meshes[0].bounds.max;
+	// the node walk only records instances and which meshes they use, every referenced mesh is then
+	// quantized and optimized once on its own thread. meshes are numbered in the order the walk first meets them
+	std::vector<uint32_t> mesh_slots(scene->mNumMeshes, UINT32_MAX);
+	std::vector<const aiMesh*> unique_meshes;
+	instances.clear();
+	ProcessNode(scene->mRootNode, scene, transform, mesh_slots, unique_meshes);
 
-	for (const auto& mesh : meshes) {
-		bounds.min = glm::min(bounds.min, mesh.bounds.min);
-		bounds.max = glm::max(bounds.max, mesh.bounds.max);
-	}
+	meshes.resize(unique_meshes.size());
+	std::vector<size_t> mesh_indices(unique_meshes.size());
+	std::iota(mesh_indices.begin(), mesh_indices.end(), 0);
 
-	if (load_textures) {
-		TextureLoader::Get()->LoadPromisedTextures();
-	}
+	std::for_each(std::execution::par, mesh_indices.begin(), mesh_indices.end(), [&](size_t index) {
+		ProcessMesh(unique_meshes[index], scene, meshes[index]);
+	});
 
 	if (scene->HasCameras()) {
 		for (unsigned int i = 0; i < scene->mNumCameras; ++i) {
@@ -405,16 +396,216 @@ bool Model::Load(const char* root, const char* filename, float scale, bool load_
 		}
 	}
 
+	return true;
+}
+
+// remembers every file the importer opens, besides the model itself that is the .mtl of an .obj and similar side files
+class RecordingIOSystem : public Assimp::DefaultIOSystem
+{
+public:
+	std::vector<std::string> opened;
+
+	Assimp::IOStream* Open(const char* file, const char* mode = "rb") override
+	{
+		Assimp::IOStream* stream = DefaultIOSystem::Open(file, mode);
+		if (stream != nullptr && std::find(opened.begin(), opened.end(), file) == opened.end()) {
+			opened.push_back(file);
+		}
+		return stream;
+	}
+};
+
+bool Model::Load(const char* root, const char* filename, float scale, bool load_textures)
+{
+	Assimp::Importer importer;
+	// owned by the importer
+	auto io_system = new RecordingIOSystem();
+	importer.SetIOHandler(io_system);
+	char fullPath[256];
+	char cachePath[256];
+
+	sprintf_s(fullPath, "%s\\%s", root, filename);
+	sprintf_s(cachePath, "%s.meshcache", fullPath);
+
+	bool native_gltf = IsGltfFile(filename);
+
+	const unsigned int import_flags =
+		aiProcess_Triangulate |
+		aiProcess_FlipUVs |
+		aiProcess_ForceGenNormals |
+		aiProcess_CalcTangentSpace |
+		aiProcess_GenBoundingBoxes;
+
+	ModelCacheKey cache_key = {
+		.source_hash = 0,
+		.import_flags = import_flags,
+		.import_options = native_gltf ? (import_options | MODEL_IMPORT_NATIVE_GLTF) : import_options,
+		.vertex_size = sizeof(MeshVertex),
+		.vertex_layout = MeshVertexLayout::id,
+		.scale = scale,
+	};
+
+	cache_key.source_hash = HashModelFile(fullPath);
+
+	MappedFile cache;
+	if (cache_key.source_hash != 0 && ReadModelCache(cachePath, cache_key, *this, cache)) {
+		if (load_textures) {
+			LoadTextures(root);
+		}
+
+		BuildMaterials();
+
+		cache.Close();
+		return true;
+	}
+
+	// glTF buffers are mapped and read in place, anything the native loader rejects goes through Assimp
+	std::vector<MappedFile> gltf_mappings;
+	std::vector<ModelCacheDependency> dependencies;
+	bool imported = native_gltf && LoadGltf(root, filename, scale, *this, gltf_mappings, dependencies);
+
+	if (!imported) {
+		for (auto& mapping : gltf_mappings) {
+			mapping.Close();
+		}
+		gltf_mappings.clear();
+		dependencies.clear();
+		meshes.clear();
+		instances.clear();
+
+		imported = ImportAssimp(importer, fullPath, import_flags, scale);
+
+		for (const auto& path : io_system->opened) {
+			if (path != fullPath) {
+				dependencies.push_back({ path, HashModelFile(path.c_str()) });
+			}
+		}
+	}
+
+	if (!imported || meshes.empty() || instances.empty()) {
+		return false;
+	}
+
+	bounds = TransformBounds(meshes[instances[0].mesh].bounds, instances[0].transform);
+
+	for (const auto& instance : instances) {
+		AABB instance_bounds = TransformBounds(meshes[instance.mesh].bounds, instance.transform);
+		bounds.min = glm::min(bounds.min, instance_bounds.min);
+		bounds.max = glm::max(bounds.max, instance_bounds.max);
+	}
+
+	// embedded textures still point into the scene or the glTF mappings here,
+	// so the cache has to be written before either of them is released
+	if (cache_key.source_hash != 0) {
+		WriteModelCache(cachePath, cache_key, dependencies, *this);
+	}
+
+	if (load_textures) {
+		LoadTextures(root);
+	}
+
+	BuildMaterials();
+
 	importer.FreeScene();
 
+	for (auto& mapping : gltf_mappings) {
+		mapping.Close();
+	}
+
 	return true;
 }
 
+void Model::LoadTextures(const char* root)
+{
+	for (auto& mesh : meshes)
+	{
+		for (int i = 0; i < _countof(mesh.texture_sources); i++)
+		{
+			auto& source = mesh.texture_sources[i];
+			if (source.path.empty()) {
+				continue;
+			}
+
+			if (source.data != nullptr)
+			{
+				mesh.textures[i] = TextureLoader::Load(source.path, (void*)source.data, source.size, source.srgb, false, ogl::bindless_textures_supported(), i == NORMAL_MAP_INDEX);
+			}
+			else {
+				std::stringstream ss;
+				ss << root << "\\" << source.path;
+				mesh.textures[i] = TextureLoader::Load(ss.str(), nullptr, 0, source.srgb, false, ogl::bindless_textures_supported(), i == NORMAL_MAP_INDEX);
+			}
+		}
+	}
+
+	TextureLoader::Get()->LoadPromisedTextures();
+
+	// embedded image bytes belong to the importer or the cache mapping, neither outlives Load
+	for (auto& mesh : meshes)
+	{
+		for (auto& source : mesh.texture_sources)
+		{
+			source.data = nullptr;
+			source.size = 0;
+		}
+	}
+}
+
+void Model::BuildMaterials()
+{
+	materials.clear();
+	textures.clear();
+
+	std::map<ogl::Texture2D*, uint32_t> texture_indices;
+	std::map<std::tuple<std::vector<float>, std::vector<std::string>>, uint32_t> material_indices;
+
+	for (auto& mesh : meshes)
+	{
+		Material material = {
+			.base_color = mesh.base_color,
+			.emissive_color = mesh.emissive_color,
+			.specular_color = mesh.specular_color,
+		};
+
+		std::vector<std::string> paths;
+		for (int i = 0; i < _countof(mesh.textures); i++)
+		{
+			paths.push_back(mesh.texture_sources[i].path);
+			material.textures[i] = MATERIAL_NO_TEXTURE;
+
+			if (mesh.textures[i] == nullptr) {
+				continue;
+			}
+
+			auto texture = texture_indices.try_emplace(mesh.textures[i], uint32_t(textures.size()));
+			if (texture.second) {
+				textures.push_back(mesh.textures[i]);
+			}
+			material.textures[i] = texture.first->second;
+		}
+
+		std::vector<float> factors;
+		for (const auto& factor : { mesh.base_color, mesh.emissive_color, mesh.specular_color }) {
+			factors.insert(factors.end(), { factor.x, factor.y, factor.z, factor.w });
+		}
+
+		auto key = material_indices.try_emplace({ std::move(factors), std::move(paths) }, uint32_t(materials.size()));
+		if (key.second) {
+			materials.push_back(material);
+		}
+		mesh.material = key.first->second;
+	}
+}
+
 void Model::DestroyCpuSideBuffer() {
 	for (int i = 0; i < meshes.size(); i++)
 	{
 		meshes[i].vertices.clear();
 		meshes[i].indices.clear();
+		meshes[i].lods.clear();
+		meshes[i].meshlets.clear();
+		meshes[i].meshlet_vertices.clear();
+		meshes[i].meshlet_triangles.clear();
 	}
 }
 
@@ -425,7 +616,7 @@ void Model::Destroy()
 
 	for (int i = 0; i < meshes.size(); i++)
 	{
-		for (int j = 0; j < 6; j++)
+		for (int j = 0; j < _countof(meshes[i].textures); j++)
 		{
 			if (meshes[i].textures[j] != nullptr)
 			{
@@ -435,6 +626,10 @@ void Model::Destroy()
 
 		meshes[i].vertices.clear();
 		meshes[i].indices.clear();
+		meshes[i].lods.clear();
+		meshes[i].meshlets.clear();
+		meshes[i].meshlet_vertices.clear();
+		meshes[i].meshlet_triangles.clear();
 	}
 
 	for (auto& t : unique_textures)
@@ -4,27 +4,11 @@
 #include <string>
 
 #include "opengl.h"
+#include "VertexLayout.h"
 
-#define PACK
-
-#ifdef PACK
-struct alignas(8) MeshVertex {
-	uint16_t x, y, z, w;
-	uint8_t nx, ny, nz, nw;
-	uint8_t tx, ty, tz, tw;
-	//uint8_t bx, by, bz, bw;
-	uint16_t u, v;
-};
-
-#else
-struct alignas(16) MeshVertex {
-	float x, y, z, w;
-	float nx, ny, nz, nw;
-	float tx, ty, tz, tw;
-	//float bx, by, bz, bw;
-	float u, v, _p1, _p2;
-};
-#endif
+// the layout of every uploaded vertex, see VertexLayout.h for the alternatives
+using MeshVertexLayout = CompactVertexLayout;
+using MeshVertex = MeshVertexLayout::Vertex;
 
 #define BASE_COLOR_MAP_INDEX 0
 #define OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX 1
@@ -36,26 +20,143 @@ struct AABB {
 	glm::vec3 max;
 };
 
+// where a material texture comes from, either a file relative to the model root
+// or an embedded image ("*N" paths) whose bytes live in the importer or the cache mapping
+struct MaterialTexture {
+	std::string path;
+	const void* data = nullptr;
+	size_t size = 0;
+	bool srgb = false;
+};
+
+#define MATERIAL_NO_TEXTURE UINT32_MAX
+
+// factors and textures shared by every mesh that looks the same, deduplicated at import and laid out to be
+// uploaded as is into a std430 buffer. textures are indices into Model::textures (MATERIAL_NO_TEXTURE if unset)
+struct Material {
+	glm::vec4 base_color;
+	glm::vec4 emissive_color;
+	glm::vec4 specular_color;
+	uint32_t textures[4];
+};
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_CONE_WEIGHT 0.25f
+
+// a cluster of a mesh, laid out to be uploaded as is into a std430 buffer.
+// the triangles are 8 bit indices into the meshlet's own slice of Mesh::meshlet_vertices,
+// bounds are in mesh space. a meshlet faces away from a camera at position p when
+// dot(center - p, cone_axis) >= cone_cutoff * length(center - p) + radius
+struct Meshlet {
+	uint32_t vertex_offset;   // into Mesh::meshlet_vertices
+	uint32_t triangle_offset; // into Mesh::meshlet_triangles, 3 bytes per triangle
+	uint32_t vertex_count;
+	uint32_t triangle_count;
+	glm::vec3 center;
+	float radius;
+	glm::vec3 cone_axis;
+	float cone_cutoff;
+};
+
+#define MESH_MAX_LODS 8
+#define MESH_LOD_REDUCTION 0.5f // target index count of a level relative to the previous one
+#define MESH_LOD_MIN_REDUCTION 0.85f // the chain stops once a level saves less than this
+#define MESH_LOD_TARGET_ERROR 0.05f // per level, relative to the mesh extent
+#define MESH_LOD_MIN_INDICES 96
+
+// one level of detail, a range of Mesh::indices over the shared vertex buffer.
+// error is the geometric deviation from lod 0 in mesh space units
+struct MeshLod {
+	uint32_t index_offset;
+	uint32_t index_count;
+	float error;
+};
+
+// one placement of a mesh in the scene. meshes referenced by several nodes are imported
+// and uploaded once, every reference becomes an instance
+struct MeshInstance {
+	uint32_t mesh;
+	glm::mat4 transform;
+};
+
 struct Mesh
 {
 	std::vector<MeshVertex> vertices;
 	std::vector<uint32_t> indices;
+	std::vector<MeshLod> lods;
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> meshlet_vertices;
+	std::vector<uint8_t> meshlet_triangles;
 	ogl::Texture2D* textures[4];
-	glm::mat4 transform;
+	MaterialTexture texture_sources[4];
 	glm::vec4 base_color;
 	glm::vec4 emissive_color;
 	glm::vec4 specular_color;
+	uint32_t material; // into Model::materials
 	AABB bounds;
 	bool visible;
 };
 
+/**
+* packs one vertex into MeshVertexLayout
+* @param bounds final bounds of the mesh the vertex belongs to, positions may be stored relative to them
+* @param tangent xyz tangent with the bitangent handedness (+1/-1) in w
+*/
+void EncodeVertex(MeshVertex& vertex, const AABB& bounds, const glm::vec3& position, const glm::vec3& normal, const glm::vec4& tangent, const glm::vec2& uv);
+
+/**
+* unpacks the mesh space position of a vertex written by EncodeVertex
+*/
+glm::vec3 DecodePosition(const MeshVertex& vertex, const AABB& bounds);
+
+/**
+* maps the positions stored for a mesh with these bounds back to mesh space,
+* multiply it onto the model matrix (not the normal matrix) of every draw
+*/
+glm::mat4 PositionDequantization(const AABB& bounds);
+
+// optional work done on every mesh at import, set in Model::import_options before Load.
+// the options end up in ModelCacheKey::import_options together with MODEL_IMPORT_NATIVE_GLTF,
+// which marks models that went through the native glTF loader
+#define MODEL_IMPORT_NATIVE_GLTF 0x1u
+#define MODEL_IMPORT_MESHLETS 0x2u
+#define MODEL_IMPORT_LODS 0x4u
+
+/**
+* @returns the axis aligned box around bounds transformed by transform
+*/
+AABB TransformBounds(const AABB& bounds, const glm::mat4& transform);
+
+/**
+* deduplicates and cache-optimizes the packed vertex/index streams of an imported mesh and moves them into mesh.
+* every importer goes through here so the uploaded data looks the same no matter where it came from
+* @param options MODEL_IMPORT_* bits, MODEL_IMPORT_MESHLETS also partitions the mesh into meshlets
+*/
+void FinalizeMeshGeometry(Mesh& mesh, std::vector<MeshVertex>&& vertices, std::vector<uint32_t>&& indices, uint32_t options);
+
+/**
+* simplifies lod 0 of mesh level by level and appends each level to mesh.indices until the
+* simplifier stops making progress or MESH_MAX_LODS is reached
+*/
+void BuildLods(Mesh& mesh);
+
+/**
+* splits the optimized index buffer (lod 0) of mesh into meshlets with their bounding spheres and normal cones
+*/
+void BuildMeshlets(Mesh& mesh);
+
 struct aiMesh;
 struct aiScene;
 struct aiNode;
+namespace Assimp { class Importer; }
 
 struct Model
 {
 	std::vector<Mesh> meshes;
+	std::vector<MeshInstance> instances;
+	std::vector<Material> materials;
+	std::vector<ogl::Texture2D*> textures; // every distinct loaded texture, indexed by Material::textures
 	AABB bounds;
 	glm::vec3 camera_position { 0.0f, 0.0f, 0.0f };
 	glm::vec3 camera_target { 0.0f, 0.0f, 0.0f };
@@ -64,13 +165,19 @@ struct Model
 	float camera_aspect = 16.0f / 9.0f;
 	float camera_near = 0.1f;
 	float camera_far = 1000.0f;
-
+	uint32_t import_options = 0;
 
 	bool Load(const char* root, const char* filename, float scale = 1.0f, bool load_textures = false);
 	void DestroyCpuSideBuffer();
+	void LoadTextures(const char* root);
+
+	// rebuilds materials and textures from the per mesh factors and texture sources, meshes with equal
+	// factors and texture paths share one material
+	void BuildMaterials();
 
 	void Destroy();
 
-	void ProcessMesh(aiMesh* mesh, const aiScene* scene, const char* root, const glm::mat4& transform, bool load_textures);
-	void ProcessNode(aiNode* node, const aiScene* scene, const char* root, const glm::mat4& transform, bool load_textures);
+	bool ImportAssimp(Assimp::Importer& importer, const char* path, unsigned int flags, float scale);
+	void ProcessMesh(const aiMesh* mesh, const aiScene* scene, Mesh& gpuMesh);
+	void ProcessNode(const aiNode* node, const aiScene* scene, const glm::mat4& transform, std::vector<uint32_t>& mesh_slots, std::vector<const aiMesh*>& unique_meshes);
 };
\ No newline at end of file
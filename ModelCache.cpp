@@ -0,0 +1,373 @@
+#include "ModelCache.h"
+#include "Model.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define MODEL_CACHE_MAGIC 0x434c444d // "MDLC"
+#define MODEL_CACHE_VERSION 5
+#define MODEL_CACHE_ALIGNMENT 16
+
+struct ModelCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	ModelCacheKey key;
+	uint64_t dependency_count;
+	uint64_t texture_count;
+	uint64_t mesh_count;
+	uint64_t instance_count;
+	AABB bounds;
+	glm::vec3 camera_position;
+	glm::vec3 camera_target;
+	glm::vec3 camera_up;
+	float camera_fov;
+	float camera_aspect;
+	float camera_near;
+	float camera_far;
+};
+
+struct ModelCacheMesh {
+	uint64_t vertex_count;
+	uint64_t index_count;
+	uint64_t lod_count;
+	uint64_t meshlet_count;
+	uint64_t meshlet_vertex_count;
+	uint64_t meshlet_triangle_count;
+	glm::vec4 base_color;
+	glm::vec4 emissive_color;
+	glm::vec4 specular_color;
+	AABB bounds;
+	int32_t texture_index[4];
+	uint32_t texture_srgb[4];
+};
+
+struct ModelCacheDependencyRecord {
+	uint64_t path_length;
+	uint64_t hash;
+};
+
+// material textures are shared between meshes, so paths and embedded image bytes are stored once
+struct ModelCacheTexture {
+	uint64_t path_length;
+	uint64_t data_size;
+};
+
+static bool KeysMatch(const ModelCacheKey& a, const ModelCacheKey& b)
+{
+	return a.source_hash == b.source_hash &&
+		a.import_flags == b.import_flags &&
+		a.import_options == b.import_options &&
+		a.vertex_size == b.vertex_size &&
+		a.vertex_layout == b.vertex_layout &&
+		a.scale == b.scale;
+}
+
+uint64_t HashModelFile(const char* path)
+{
+	MappedFile file;
+	if (!file.Open(path)) {
+		return 0;
+	}
+	uint64_t hash = HashBytes(file.data, file.size);
+	file.Close();
+	return hash;
+}
+
+// bounds checked cursor over the mapping, every blob starts on an aligned offset so vertex data can be
+// copied out with the alignment MeshVertex expects
+struct CacheReader {
+	const uint8_t* data;
+	size_t size;
+	size_t offset;
+
+	const uint8_t* Take(size_t bytes, size_t alignment = 1) {
+		size_t start = (offset + alignment - 1) & ~(alignment - 1);
+		if (start > size || bytes > size - start) {
+			return nullptr;
+		}
+		offset = start + bytes;
+		return data + start;
+	}
+
+	template<typename T>
+	bool Read(T& value) {
+		auto src = Take(sizeof(T));
+		if (src == nullptr) return false;
+		memcpy(&value, src, sizeof(T));
+		return true;
+	}
+};
+
+struct CacheWriter {
+	FILE* file;
+	size_t offset;
+	bool ok;
+
+	void Write(const void* data, size_t bytes, size_t alignment = 1) {
+		static const uint8_t zeros[MODEL_CACHE_ALIGNMENT] = {};
+		size_t padding = ((offset + alignment - 1) & ~(alignment - 1)) - offset;
+		if (padding > 0) {
+			ok = ok && fwrite(zeros, 1, padding, file) == padding;
+			offset += padding;
+		}
+		if (bytes > 0) {
+			ok = ok && fwrite(data, 1, bytes, file) == bytes;
+			offset += bytes;
+		}
+	}
+};
+
+bool ReadModelCache(const char* path, const ModelCacheKey& key, Model& model, MappedFile& mapping)
+{
+	if (!mapping.Open(path)) {
+		return false;
+	}
+
+	CacheReader reader = { mapping.data, mapping.size, 0 };
+
+	ModelCacheHeader header;
+	if (!reader.Read(header) ||
+		header.magic != MODEL_CACHE_MAGIC ||
+		header.version != MODEL_CACHE_VERSION ||
+		!KeysMatch(header.key, key)) {
+		mapping.Close();
+		return false;
+	}
+
+	for (uint64_t i = 0; i < header.dependency_count; i++) {
+		ModelCacheDependencyRecord record;
+		if (!reader.Read(record)) {
+			mapping.Close();
+			return false;
+		}
+
+		auto dependency_path = (const char*)reader.Take(record.path_length);
+		if (dependency_path == nullptr || HashModelFile(std::string(dependency_path, record.path_length).c_str()) != record.hash) {
+			mapping.Close();
+			return false;
+		}
+	}
+
+	struct CachedTexture {
+		const char* path;
+		const uint8_t* data;
+		ModelCacheTexture record;
+	};
+
+	std::vector<CachedTexture> textures(header.texture_count);
+
+	for (auto& texture : textures) {
+		if (!reader.Read(texture.record)) {
+			mapping.Close();
+			return false;
+		}
+
+		texture.path = (const char*)reader.Take(texture.record.path_length);
+		texture.data = reader.Take(texture.record.data_size, MODEL_CACHE_ALIGNMENT);
+		if (texture.path == nullptr || texture.data == nullptr) {
+			mapping.Close();
+			return false;
+		}
+	}
+
+	std::vector<Mesh> meshes(header.mesh_count);
+
+	for (auto& mesh : meshes) {
+		ModelCacheMesh record;
+		if (!reader.Read(record)) {
+			mapping.Close();
+			return false;
+		}
+
+		auto vertices = (const MeshVertex*)reader.Take(record.vertex_count * sizeof(MeshVertex), MODEL_CACHE_ALIGNMENT);
+		auto indices = (const uint32_t*)reader.Take(record.index_count * sizeof(uint32_t), MODEL_CACHE_ALIGNMENT);
+		auto lods = (const MeshLod*)reader.Take(record.lod_count * sizeof(MeshLod), MODEL_CACHE_ALIGNMENT);
+		auto meshlets = (const Meshlet*)reader.Take(record.meshlet_count * sizeof(Meshlet), MODEL_CACHE_ALIGNMENT);
+		auto meshlet_vertices = (const uint32_t*)reader.Take(record.meshlet_vertex_count * sizeof(uint32_t), MODEL_CACHE_ALIGNMENT);
+		auto meshlet_triangles = reader.Take(record.meshlet_triangle_count, MODEL_CACHE_ALIGNMENT);
+		if (vertices == nullptr || indices == nullptr || lods == nullptr || meshlets == nullptr || meshlet_vertices == nullptr || meshlet_triangles == nullptr) {
+			mapping.Close();
+			return false;
+		}
+
+		mesh.vertices.assign(vertices, vertices + record.vertex_count);
+		mesh.indices.assign(indices, indices + record.index_count);
+		mesh.lods.assign(lods, lods + record.lod_count);
+		if (mesh.lods.empty() || std::any_of(mesh.lods.begin(), mesh.lods.end(), [&](const MeshLod& lod) {
+			return uint64_t(lod.index_offset) + lod.index_count > record.index_count;
+		})) {
+			mapping.Close();
+			return false;
+		}
+		mesh.meshlets.assign(meshlets, meshlets + record.meshlet_count);
+		mesh.meshlet_vertices.assign(meshlet_vertices, meshlet_vertices + record.meshlet_vertex_count);
+		mesh.meshlet_triangles.assign(meshlet_triangles, meshlet_triangles + record.meshlet_triangle_count);
+		mesh.base_color = record.base_color;
+		mesh.emissive_color = record.emissive_color;
+		mesh.specular_color = record.specular_color;
+		mesh.bounds = record.bounds;
+		mesh.visible = true;
+
+		for (int i = 0; i < _countof(mesh.textures); i++) {
+			mesh.textures[i] = nullptr;
+			mesh.texture_sources[i] = {};
+
+			int32_t index = record.texture_index[i];
+			if (index < 0) {
+				continue;
+			}
+
+			if (size_t(index) >= textures.size()) {
+				mapping.Close();
+				return false;
+			}
+
+			const auto& texture = textures[index];
+			auto& source = mesh.texture_sources[i];
+			source.path.assign(texture.path, texture.record.path_length);
+			source.data = texture.record.data_size > 0 ? texture.data : nullptr;
+			source.size = texture.record.data_size;
+			source.srgb = record.texture_srgb[i] != 0;
+		}
+	}
+
+	auto instances = (const MeshInstance*)reader.Take(header.instance_count * sizeof(MeshInstance), MODEL_CACHE_ALIGNMENT);
+	if (instances == nullptr || std::any_of(instances, instances + header.instance_count, [&](const MeshInstance& instance) {
+		return instance.mesh >= header.mesh_count;
+	})) {
+		mapping.Close();
+		return false;
+	}
+
+	model.meshes = std::move(meshes);
+	model.instances.assign(instances, instances + header.instance_count);
+	model.bounds = header.bounds;
+	model.camera_position = header.camera_position;
+	model.camera_target = header.camera_target;
+	model.camera_up = header.camera_up;
+	model.camera_fov = header.camera_fov;
+	model.camera_aspect = header.camera_aspect;
+	model.camera_near = header.camera_near;
+	model.camera_far = header.camera_far;
+
+	return true;
+}
+
+bool WriteModelCache(const char* path, const ModelCacheKey& key, const std::vector<ModelCacheDependency>& dependencies, const Model& model)
+{
+	FILE* file;
+	if (fopen_s(&file, path, "wb") != 0 || file == nullptr) {
+		printf("Failed to write model cache %s\n", path);
+		return false;
+	}
+
+	CacheWriter writer = { file, 0, true };
+
+	std::vector<const MaterialTexture*> textures;
+	std::vector<std::array<int32_t, 4>> mesh_textures(model.meshes.size());
+
+	for (size_t m = 0; m < model.meshes.size(); m++) {
+		const auto& mesh = model.meshes[m];
+		for (int i = 0; i < _countof(mesh.texture_sources); i++) {
+			const auto& source = mesh.texture_sources[i];
+			mesh_textures[m][i] = -1;
+
+			if (source.path.empty()) {
+				continue;
+			}
+
+			auto it = std::find_if(textures.begin(), textures.end(), [&](const MaterialTexture* t) {
+				return t->path == source.path && t->data == source.data;
+			});
+
+			mesh_textures[m][i] = int32_t(it - textures.begin());
+			if (it == textures.end()) {
+				textures.push_back(&source);
+			}
+		}
+	}
+
+	ModelCacheHeader header = {
+		.magic = MODEL_CACHE_MAGIC,
+		.version = MODEL_CACHE_VERSION,
+		.key = key,
+		.dependency_count = dependencies.size(),
+		.texture_count = textures.size(),
+		.mesh_count = model.meshes.size(),
+		.instance_count = model.instances.size(),
+		.bounds = model.bounds,
+		.camera_position = model.camera_position,
+		.camera_target = model.camera_target,
+		.camera_up = model.camera_up,
+		.camera_fov = model.camera_fov,
+		.camera_aspect = model.camera_aspect,
+		.camera_near = model.camera_near,
+		.camera_far = model.camera_far,
+	};
+	writer.Write(&header, sizeof(header));
+
+	for (const auto& dependency : dependencies) {
+		ModelCacheDependencyRecord record = {
+			.path_length = dependency.path.size(),
+			.hash = dependency.hash,
+		};
+
+		writer.Write(&record, sizeof(record));
+		writer.Write(dependency.path.data(), record.path_length);
+	}
+
+	for (const auto texture : textures) {
+		ModelCacheTexture record = {
+			.path_length = texture->path.size(),
+			.data_size = texture->data != nullptr ? texture->size : 0,
+		};
+
+		writer.Write(&record, sizeof(record));
+		writer.Write(texture->path.data(), record.path_length);
+		writer.Write(texture->data, record.data_size, MODEL_CACHE_ALIGNMENT);
+	}
+
+	for (size_t m = 0; m < model.meshes.size(); m++) {
+		const auto& mesh = model.meshes[m];
+
+		ModelCacheMesh record = {
+			.vertex_count = mesh.vertices.size(),
+			.index_count = mesh.indices.size(),
+			.lod_count = mesh.lods.size(),
+			.meshlet_count = mesh.meshlets.size(),
+			.meshlet_vertex_count = mesh.meshlet_vertices.size(),
+			.meshlet_triangle_count = mesh.meshlet_triangles.size(),
+			.base_color = mesh.base_color,
+			.emissive_color = mesh.emissive_color,
+			.specular_color = mesh.specular_color,
+			.bounds = mesh.bounds,
+		};
+
+		for (int i = 0; i < _countof(mesh.texture_sources); i++) {
+			record.texture_index[i] = mesh_textures[m][i];
+			record.texture_srgb[i] = mesh.texture_sources[i].srgb ? 1 : 0;
+		}
+
+		writer.Write(&record, sizeof(record));
+		writer.Write(mesh.vertices.data(), mesh.vertices.size() * sizeof(MeshVertex), MODEL_CACHE_ALIGNMENT);
+		writer.Write(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t), MODEL_CACHE_ALIGNMENT);
+		writer.Write(mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod), MODEL_CACHE_ALIGNMENT);
+		writer.Write(mesh.meshlets.data(), mesh.meshlets.size() * sizeof(Meshlet), MODEL_CACHE_ALIGNMENT);
+		writer.Write(mesh.meshlet_vertices.data(), mesh.meshlet_vertices.size() * sizeof(uint32_t), MODEL_CACHE_ALIGNMENT);
+		writer.Write(mesh.meshlet_triangles.data(), mesh.meshlet_triangles.size(), MODEL_CACHE_ALIGNMENT);
+	}
+
+	writer.Write(model.instances.data(), model.instances.size() * sizeof(MeshInstance), MODEL_CACHE_ALIGNMENT);
+
+	fclose(file);
+
+	if (!writer.ok) {
+		printf("Failed to write model cache %s\n", path);
+		remove(path);
+		return false;
+	}
+
+	return true;
+}
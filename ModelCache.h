@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+
+struct Model;
+
+// everything that changes the contents of an imported model. a cache file is only used when
+// all of these match, otherwise the model is imported again and the cache rewritten
+struct ModelCacheKey {
+	uint64_t source_hash;
+	uint32_t import_flags;
+	uint32_t import_options;
+	uint32_t vertex_size;
+	uint32_t vertex_layout;
+	float scale;
+};
+
+// a file besides the source that the import read, like the external buffers of a .gltf or the .mtl of an .obj.
+// the key only covers the source itself, so these are stored with a hash of their contents and checked on load
+struct ModelCacheDependency {
+	std::string path;
+	uint64_t hash;
+};
+
+// hashes the contents of the file at path, 0 if it can't be opened
+uint64_t HashModelFile(const char* path);
+
+/**
+* maps the cache file and fills model with the meshes stored in it. vertex and index streams are copied
+* straight out of the mapping, embedded texture sources point into it so the mapping has to stay open
+* until the textures are loaded
+* @returns false if the file is missing, truncated, was written with a different key or one of the
+* dependencies stored in it changed
+*/
+bool ReadModelCache(const char* path, const ModelCacheKey& key, Model& model, MappedFile& mapping);
+
+/**
+* writes the already optimized meshes of model, their material textures and the camera to path
+* together with the files the import depended on
+*/
+bool WriteModelCache(const char* path, const ModelCacheKey& key, const std::vector<ModelCacheDependency>& dependencies, const Model& model);
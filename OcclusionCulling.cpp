@@ -0,0 +1,252 @@
+#include "OcclusionCulling.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <execution>
+#include <numeric>
+
+#include <immintrin.h>
+
+#define OCCLUSION_TILES_X (OCCLUSION_BUFFER_WIDTH / OCCLUSION_TILE_WIDTH)
+#define OCCLUSION_TILES_Y (OCCLUSION_BUFFER_HEIGHT / OCCLUSION_TILE_HEIGHT)
+
+static_assert(OCCLUSION_BUFFER_WIDTH % OCCLUSION_TILE_WIDTH == 0 && OCCLUSION_BUFFER_HEIGHT % OCCLUSION_TILE_HEIGHT == 0, "the buffer has to be made of whole tiles");
+static_assert(OCCLUSION_TILE_WIDTH % 4 == 0, "tile rows are rasterized 4 pixels at a time");
+
+OcclusionBuffer::OcclusionBuffer()
+{
+	depth.resize(OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT);
+	Clear();
+}
+
+void OcclusionBuffer::Clear()
+{
+	std::fill(depth.begin(), depth.end(), 1.0f);
+	triangles.clear();
+	stats = {};
+}
+
+// edge function of a -> b as a plane, positive on the left side which is the inside of counter clockwise triangles
+static void EdgePlane(const glm::vec3& a, const glm::vec3& b, float& plane_a, float& plane_b, float& plane_c)
+{
+	plane_a = a.y - b.y;
+	plane_b = b.x - a.x;
+	plane_c = -(plane_a * a.x + plane_b * a.y);
+}
+
+static bool SetupTriangle(const glm::vec4& clip0, const glm::vec4& clip1, const glm::vec4& clip2, OcclusionTriangle& triangle)
+{
+	// dropping triangles that cross the near plane instead of clipping them only ever makes the buffer emptier
+	if (clip0.w < OCCLUSION_NEAR_W || clip1.w < OCCLUSION_NEAR_W || clip2.w < OCCLUSION_NEAR_W) {
+		return false;
+	}
+
+	glm::vec3 screen[3];
+	const glm::vec4* clip[3] = { &clip0, &clip1, &clip2 };
+	for (int i = 0; i < 3; i++) {
+		float inverse_w = 1.0f / clip[i]->w;
+		screen[i].x = (clip[i]->x * inverse_w * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH;
+		screen[i].y = (clip[i]->y * inverse_w * 0.5f + 0.5f) * OCCLUSION_BUFFER_HEIGHT;
+		screen[i].z = clip[i]->z * inverse_w * 0.5f + 0.5f;
+	}
+
+	float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[1].y - screen[0].y) * (screen[2].x - screen[0].x);
+	if (!(area > 0.0f)) {
+		return false; // back facing or degenerate
+	}
+
+	float min_x = std::min(screen[0].x, std::min(screen[1].x, screen[2].x));
+	float max_x = std::max(screen[0].x, std::max(screen[1].x, screen[2].x));
+	float min_y = std::min(screen[0].y, std::min(screen[1].y, screen[2].y));
+	float max_y = std::max(screen[0].y, std::max(screen[1].y, screen[2].y));
+
+	// pixel centers inside the bounds
+	triangle.min_x = std::max(int(std::ceil(min_x - 0.5f)), 0);
+	triangle.max_x = std::min(int(std::floor(max_x - 0.5f)), OCCLUSION_BUFFER_WIDTH - 1);
+	triangle.min_y = std::max(int(std::ceil(min_y - 0.5f)), 0);
+	triangle.max_y = std::min(int(std::floor(max_y - 0.5f)), OCCLUSION_BUFFER_HEIGHT - 1);
+	if (triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y) {
+		return false;
+	}
+
+	// edge i is opposite of vertex i, so its function is the unnormalized barycentric of vertex i
+	EdgePlane(screen[1], screen[2], triangle.edge_a[0], triangle.edge_b[0], triangle.edge_c[0]);
+	EdgePlane(screen[2], screen[0], triangle.edge_a[1], triangle.edge_b[1], triangle.edge_c[1]);
+	EdgePlane(screen[0], screen[1], triangle.edge_a[2], triangle.edge_b[2], triangle.edge_c[2]);
+
+	// ndc depth is affine in screen space
+	float inverse_area = 1.0f / area;
+	triangle.depth_a = (triangle.edge_a[0] * screen[0].z + triangle.edge_a[1] * screen[1].z + triangle.edge_a[2] * screen[2].z) * inverse_area;
+	triangle.depth_b = (triangle.edge_b[0] * screen[0].z + triangle.edge_b[1] * screen[1].z + triangle.edge_b[2] * screen[2].z) * inverse_area;
+	triangle.depth_c = (triangle.edge_c[0] * screen[0].z + triangle.edge_c[1] * screen[1].z + triangle.edge_c[2] * screen[2].z) * inverse_area;
+
+	return true;
+}
+
+static void RasterizeTile(const OcclusionTriangle* triangles, size_t triangle_count, float* depth, int tile_x, int tile_y)
+{
+	int tile_min_x = tile_x * OCCLUSION_TILE_WIDTH;
+	int tile_min_y = tile_y * OCCLUSION_TILE_HEIGHT;
+	int tile_max_x = tile_min_x + OCCLUSION_TILE_WIDTH - 1;
+	int tile_max_y = tile_min_y + OCCLUSION_TILE_HEIGHT - 1;
+
+	const __m128 lane_offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (size_t t = 0; t < triangle_count; t++) {
+		const OcclusionTriangle& triangle = triangles[t];
+
+		int min_x = std::max(triangle.min_x, tile_min_x);
+		int max_x = std::min(triangle.max_x, tile_max_x);
+		int min_y = std::max(triangle.min_y, tile_min_y);
+		int max_y = std::min(triangle.max_y, tile_max_y);
+		if (min_x > max_x || min_y > max_y) {
+			continue;
+		}
+
+		// rows are walked in aligned groups of 4 pixels, lanes outside the triangle fail the edge tests
+		min_x &= ~3;
+
+		__m128 edge_a0 = _mm_set1_ps(triangle.edge_a[0]);
+		__m128 edge_a1 = _mm_set1_ps(triangle.edge_a[1]);
+		__m128 edge_a2 = _mm_set1_ps(triangle.edge_a[2]);
+		__m128 depth_a = _mm_set1_ps(triangle.depth_a);
+
+		for (int y = min_y; y <= max_y; y++) {
+			float pixel_y = float(y) + 0.5f;
+			__m128 row_edge0 = _mm_set1_ps(triangle.edge_b[0] * pixel_y + triangle.edge_c[0]);
+			__m128 row_edge1 = _mm_set1_ps(triangle.edge_b[1] * pixel_y + triangle.edge_c[1]);
+			__m128 row_edge2 = _mm_set1_ps(triangle.edge_b[2] * pixel_y + triangle.edge_c[2]);
+			__m128 row_depth = _mm_set1_ps(triangle.depth_b * pixel_y + triangle.depth_c);
+
+			float* row = depth + y * OCCLUSION_BUFFER_WIDTH;
+
+			for (int x = min_x; x <= max_x; x += 4) {
+				__m128 pixel_x = _mm_add_ps(_mm_set1_ps(float(x)), lane_offsets);
+
+				__m128 edge0 = _mm_add_ps(_mm_mul_ps(edge_a0, pixel_x), row_edge0);
+				__m128 edge1 = _mm_add_ps(_mm_mul_ps(edge_a1, pixel_x), row_edge1);
+				__m128 edge2 = _mm_add_ps(_mm_mul_ps(edge_a2, pixel_x), row_edge2);
+				__m128 inside = _mm_and_ps(_mm_cmpge_ps(edge0, zero), _mm_and_ps(_mm_cmpge_ps(edge1, zero), _mm_cmpge_ps(edge2, zero)));
+
+				if (_mm_movemask_ps(inside) == 0) {
+					continue;
+				}
+
+				__m128 pixel_depth = _mm_add_ps(_mm_mul_ps(depth_a, pixel_x), row_depth);
+				__m128 stored = _mm_loadu_ps(row + x);
+				__m128 nearest = _mm_min_ps(stored, pixel_depth);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, stored)));
+			}
+		}
+	}
+}
+
+void OcclusionBuffer::RasterizeOccluders(const OccluderMesh* const* meshes, const glm::mat4* model_view_projections, size_t count)
+{
+	triangles.clear();
+
+	for (size_t i = 0; i < count; i++) {
+		const OccluderMesh& mesh = *meshes[i];
+		const glm::mat4& model_view_projection = model_view_projections[i];
+
+		for (size_t j = 0; j + 2 < mesh.indices.size(); j += 3) {
+			glm::vec4 clip0 = model_view_projection * glm::vec4(mesh.positions[mesh.indices[j + 0]], 1.0f);
+			glm::vec4 clip1 = model_view_projection * glm::vec4(mesh.positions[mesh.indices[j + 1]], 1.0f);
+			glm::vec4 clip2 = model_view_projection * glm::vec4(mesh.positions[mesh.indices[j + 2]], 1.0f);
+
+			OcclusionTriangle triangle;
+			if (SetupTriangle(clip0, clip1, clip2, triangle)) {
+				triangles.push_back(triangle);
+			}
+		}
+	}
+
+	stats.occluder_count += uint32_t(count);
+	stats.triangle_count += uint32_t(triangles.size());
+
+	// every tile owns its pixels, so tiles need no synchronization
+	int tiles[OCCLUSION_TILES_X * OCCLUSION_TILES_Y];
+	std::iota(std::begin(tiles), std::end(tiles), 0);
+
+	std::for_each(std::execution::par, std::begin(tiles), std::end(tiles), [&](int tile) {
+		RasterizeTile(triangles.data(), triangles.size(), depth.data(), tile % OCCLUSION_TILES_X, tile / OCCLUSION_TILES_X);
+	});
+}
+
+bool OcclusionBuffer::TestBounds(const AABB& bounds, const glm::mat4& view_projection) const
+{
+	glm::vec2 screen_min = glm::vec2(FLT_MAX);
+	glm::vec2 screen_max = glm::vec2(-FLT_MAX);
+	float min_depth = FLT_MAX;
+
+	for (int corner = 0; corner < 8; corner++) {
+		glm::vec3 position = glm::vec3(
+			(corner & 1) ? bounds.max.x : bounds.min.x,
+			(corner & 2) ? bounds.max.y : bounds.min.y,
+			(corner & 4) ? bounds.max.z : bounds.min.z);
+
+		glm::vec4 clip = view_projection * glm::vec4(position, 1.0f);
+
+		// the box reaches the camera, nothing can be in front of it
+		if (clip.w < OCCLUSION_NEAR_W) {
+			return true;
+		}
+
+		float inverse_w = 1.0f / clip.w;
+		glm::vec2 screen = glm::vec2(
+			(clip.x * inverse_w * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH,
+			(clip.y * inverse_w * 0.5f + 0.5f) * OCCLUSION_BUFFER_HEIGHT);
+
+		screen_min = glm::min(screen_min, screen);
+		screen_max = glm::max(screen_max, screen);
+		min_depth = std::min(min_depth, clip.z * inverse_w * 0.5f + 0.5f);
+	}
+
+	// every pixel the rectangle touches, not only the covered centers
+	int min_x = std::max(int(std::floor(screen_min.x)), 0);
+	int max_x = std::min(int(std::floor(screen_max.x)), OCCLUSION_BUFFER_WIDTH - 1);
+	int min_y = std::max(int(std::floor(screen_min.y)), 0);
+	int max_y = std::min(int(std::floor(screen_max.y)), OCCLUSION_BUFFER_HEIGHT - 1);
+
+	// off screen boxes are left to frustum culling
+	if (min_x > max_x || min_y > max_y) {
+		return true;
+	}
+
+	__m128 box_depth = _mm_set1_ps(min_depth);
+
+	for (int y = min_y; y <= max_y; y++) {
+		const float* row = depth.data() + y * OCCLUSION_BUFFER_WIDTH;
+
+		int x = min_x;
+		for (; x + 3 <= max_x; x += 4) {
+			if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), box_depth)) != 0) {
+				return true;
+			}
+		}
+		for (; x <= max_x; x++) {
+			if (row[x] >= min_depth) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+size_t OcclusionBuffer::CullBounds(const AABB* bounds, uint32_t* indices, size_t count, const glm::mat4& view_projection)
+{
+	size_t visible_count = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (TestBounds(bounds[indices[i]], view_projection)) {
+			indices[visible_count++] = indices[i];
+		}
+	}
+
+	stats.tested_count += uint32_t(count);
+	stats.culled_count += uint32_t(count - visible_count);
+
+	return visible_count;
+}
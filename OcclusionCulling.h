@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Model.h"
+
+// the depth buffer is split into tiles that are rasterized in parallel, sizes are multiples of the simd width
+#define OCCLUSION_BUFFER_WIDTH 256
+#define OCCLUSION_BUFFER_HEIGHT 128
+#define OCCLUSION_TILE_WIDTH 64
+#define OCCLUSION_TILE_HEIGHT 32
+
+// clip space w below which triangles and boxes are treated as crossing the near plane
+#define OCCLUSION_NEAR_W 1e-3f
+
+// simplified lods can bulge past the silhouette of the full mesh, occluders use the coarsest lod whose
+// simplification error stays below this fraction of the mesh bounds diagonal
+#define OCCLUDER_MAX_LOD_ERROR 0.005f
+
+// occluder geometry kept on the cpu after the meshes were uploaded, usually a coarse lod
+struct OccluderMesh {
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> indices;
+};
+
+// a screen space triangle ready for rasterization, edge functions and depth as planes a * x + b * y + c
+struct OcclusionTriangle {
+	float edge_a[3];
+	float edge_b[3];
+	float edge_c[3];
+	float depth_a;
+	float depth_b;
+	float depth_c;
+	int min_x, min_y, max_x, max_y; // pixel bounds, inclusive
+};
+
+struct OcclusionStats {
+	uint32_t occluder_count;
+	uint32_t triangle_count; // triangles that survived clipping and backface culling
+	uint32_t tested_count;
+	uint32_t culled_count;
+};
+
+/**
+* low resolution cpu depth buffer for occlusion culling, no graphics api involved.
+* triangles crossing the near plane and back faces are skipped, the stored depth is the nearest ndc depth
+* (0 near, 1 far) per pixel. a box is occluded when every pixel its screen rectangle touches holds a depth closer
+* than the nearest point of the box. this is not conservative: occluders are simplified lods and pixels are covered
+* by their centers, so objects right at an occluder's silhouette can be culled although a sliver of them is visible
+*/
+struct OcclusionBuffer {
+	std::vector<float> depth;
+	std::vector<OcclusionTriangle> triangles;
+	OcclusionStats stats;
+
+	OcclusionBuffer();
+
+	void Clear();
+
+	/**
+	* rasterizes count occluder meshes, each with its own model view projection matrix.
+	* triangles are set up serially and binned, the tiles are rasterized in parallel with sse
+	*/
+	void RasterizeOccluders(const OccluderMesh* const* meshes, const glm::mat4* model_view_projections, size_t count);
+
+	/**
+	* @returns false if the world space box is completely hidden behind the rasterized occluders
+	*/
+	bool TestBounds(const AABB& bounds, const glm::mat4& view_projection) const;
+
+	/**
+	* tests count boxes and compacts indices down to the ones that are not occluded, keeping their order.
+	* indices index into bounds
+	* @returns the number of indices left
+	*/
+	size_t CullBounds(const AABB* bounds, uint32_t* indices, size_t count, const glm::mat4& view_projection);
+};
@@ -0,0 +1,137 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define SORT_KEY_PASS_SHIFT (64 - SORT_KEY_PASS_BITS)
+#define SORT_KEY_MASK(bits) ((uint64_t(1) << (bits)) - 1)
+
+uint32_t DepthBucket(float depth)
+{
+	if (!(depth > 0.0f)) {
+		return 0;
+	}
+
+	uint32_t bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	// the sign bit is known to be 0, keep the highest remaining bits
+	return uint32_t(bits >> (31 - SORT_KEY_DEPTH_BITS));
+}
+
+uint64_t MakeOpaqueSortKey(uint32_t program, uint32_t material, float depth)
+{
+	return (uint64_t(SORT_PASS_OPAQUE) << SORT_KEY_PASS_SHIFT) |
+		((program & SORT_KEY_MASK(SORT_KEY_PROGRAM_BITS)) << (SORT_KEY_MATERIAL_BITS + SORT_KEY_DEPTH_BITS)) |
+		((material & SORT_KEY_MASK(SORT_KEY_MATERIAL_BITS)) << SORT_KEY_DEPTH_BITS) |
+		(DepthBucket(depth) & SORT_KEY_MASK(SORT_KEY_DEPTH_BITS));
+}
+
+uint64_t MakeBlendedSortKey(uint32_t program, uint32_t material, float depth)
+{
+	uint64_t inverted_depth = ~uint64_t(DepthBucket(depth)) & SORT_KEY_MASK(SORT_KEY_DEPTH_BITS);
+	return (uint64_t(SORT_PASS_BLENDED) << SORT_KEY_PASS_SHIFT) |
+		(inverted_depth << (SORT_KEY_PROGRAM_BITS + SORT_KEY_MATERIAL_BITS)) |
+		((program & SORT_KEY_MASK(SORT_KEY_PROGRAM_BITS)) << SORT_KEY_MATERIAL_BITS) |
+		(material & SORT_KEY_MASK(SORT_KEY_MATERIAL_BITS));
+}
+
+uint32_t SortKeyPass(uint64_t key)
+{
+	return uint32_t(key >> SORT_KEY_PASS_SHIFT);
+}
+
+uint32_t SortKeyProgram(uint64_t key)
+{
+	int shift = SortKeyPass(key) == SORT_PASS_BLENDED ? SORT_KEY_MATERIAL_BITS : SORT_KEY_MATERIAL_BITS + SORT_KEY_DEPTH_BITS;
+	return uint32_t((key >> shift) & SORT_KEY_MASK(SORT_KEY_PROGRAM_BITS));
+}
+
+uint32_t SortKeyMaterial(uint64_t key)
+{
+	int shift = SortKeyPass(key) == SORT_PASS_BLENDED ? 0 : SORT_KEY_DEPTH_BITS;
+	return uint32_t((key >> shift) & SORT_KEY_MASK(SORT_KEY_MATERIAL_BITS));
+}
+
+void RadixSort(uint64_t* keys, uint32_t* items, uint64_t* temp_keys, uint32_t* temp_items, size_t count)
+{
+	// histograms of all eight digits in one read of the keys
+	uint32_t histograms[8][256] = {};
+	for (size_t i = 0; i < count; i++) {
+		uint64_t key = keys[i];
+		for (int digit = 0; digit < 8; digit++) {
+			histograms[digit][(key >> (digit * 8)) & 0xFF]++;
+		}
+	}
+
+	uint64_t* source_keys = keys;
+	uint32_t* source_items = items;
+	uint64_t* destination_keys = temp_keys;
+	uint32_t* destination_items = temp_items;
+
+	for (int digit = 0; digit < 8; digit++) {
+		uint32_t* histogram = histograms[digit];
+
+		// all keys share this digit, the pass would not move anything
+		uint64_t first_digit = count > 0 ? (source_keys[0] >> (digit * 8)) & 0xFF : 0;
+		if (histogram[first_digit] == count) {
+			continue;
+		}
+
+		uint32_t offsets[256];
+		uint32_t offset = 0;
+		for (int bucket = 0; bucket < 256; bucket++) {
+			offsets[bucket] = offset;
+			offset += histogram[bucket];
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			uint32_t bucket = uint32_t((source_keys[i] >> (digit * 8)) & 0xFF);
+			uint32_t position = offsets[bucket]++;
+			destination_keys[position] = source_keys[i];
+			destination_items[position] = source_items[i];
+		}
+
+		std::swap(source_keys, destination_keys);
+		std::swap(source_items, destination_items);
+	}
+
+	if (source_keys != keys) {
+		std::copy(source_keys, source_keys + count, keys);
+		std::copy(source_items, source_items + count, items);
+	}
+}
+
+static void CountStateChanges(const uint64_t* keys, size_t count, uint32_t& program_changes, uint32_t& material_changes)
+{
+	program_changes = 0;
+	material_changes = 0;
+	for (size_t i = 1; i < count; i++) {
+		program_changes += SortKeyProgram(keys[i]) != SortKeyProgram(keys[i - 1]);
+		material_changes += SortKeyMaterial(keys[i]) != SortKeyMaterial(keys[i - 1]);
+	}
+}
+
+void RenderQueue::Clear()
+{
+	keys.clear();
+	items.clear();
+}
+
+void RenderQueue::Push(uint64_t key, uint32_t item)
+{
+	keys.push_back(key);
+	items.push_back(item);
+}
+
+void RenderQueue::Sort()
+{
+	stats = {};
+	stats.draw_count = uint32_t(keys.size());
+	CountStateChanges(keys.data(), keys.size(), stats.unsorted_program_changes, stats.unsorted_material_changes);
+
+	temp_keys.resize(keys.size());
+	temp_items.resize(items.size());
+	RadixSort(keys.data(), items.data(), temp_keys.data(), temp_items.data(), keys.size());
+
+	CountStateChanges(keys.data(), keys.size(), stats.program_changes, stats.material_changes);
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// passes are submitted in this order, the pass decides how the rest of the key is laid out
+#define SORT_PASS_OPAQUE 0u
+#define SORT_PASS_BLENDED 1u
+
+// key layout from the most significant bit down:
+// opaque  | pass 4 | program 12 | material 24 | depth 24 | state first, then front to back
+// blended | pass 4 | depth 24 (inverted) | program 12 | material 24 | back to front, state only breaks ties
+#define SORT_KEY_PASS_BITS 4
+#define SORT_KEY_PROGRAM_BITS 12
+#define SORT_KEY_MATERIAL_BITS 24
+#define SORT_KEY_DEPTH_BITS 24
+
+/**
+* view depths are bucketed by their float bits, which order the same as the values for non negative floats,
+* so buckets are finer close to the camera. negative depths end up in bucket 0
+*/
+uint32_t DepthBucket(float depth);
+
+uint64_t MakeOpaqueSortKey(uint32_t program, uint32_t material, float depth);
+uint64_t MakeBlendedSortKey(uint32_t program, uint32_t material, float depth);
+
+uint32_t SortKeyPass(uint64_t key);
+uint32_t SortKeyProgram(uint64_t key);
+uint32_t SortKeyMaterial(uint64_t key);
+
+/**
+* stable lsd radix sort of count keys with their items, 8 bits per pass. passes where every key has the same
+* digit are skipped, so keys with unused high fields cost fewer passes. temp_keys and temp_items need count entries
+*/
+void RadixSort(uint64_t* keys, uint32_t* items, uint64_t* temp_keys, uint32_t* temp_items, size_t count);
+
+struct RenderQueueStats {
+	uint32_t draw_count;
+	uint32_t program_changes; // in submission order
+	uint32_t material_changes;
+	uint32_t unsorted_program_changes; // had the draws been submitted in the order they were pushed
+	uint32_t unsorted_material_changes;
+};
+
+/**
+* draws of one frame as (sort key, item) pairs, items are whatever the caller needs to find the draw again.
+* Sort orders items by key and counts the state changes in both orders
+*/
+struct RenderQueue {
+	std::vector<uint64_t> keys;
+	std::vector<uint32_t> items;
+	RenderQueueStats stats;
+
+	void Clear();
+	void Push(uint64_t key, uint32_t item);
+	void Sort();
+
+private:
+	std::vector<uint64_t> temp_keys;
+	std::vector<uint32_t> temp_items;
+};
@@ -0,0 +1,632 @@
+#include "TextureBake.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#define BAKED_TEXTURE_MAGIC 0x454b4142 // "BAKE"
+
+// usage stored in the cache header, it decides the format so a file baked for another usage is not reused
+#define BAKED_USAGE_LINEAR 0u
+#define BAKED_USAGE_SRGB 1u
+#define BAKED_USAGE_NORMAL 2u
+
+#define DXGI_FORMAT_BC4_UNORM 80
+#define DXGI_FORMAT_BC5_UNORM 83
+#define DXGI_FORMAT_BC7_UNORM 98
+#define DXGI_FORMAT_BC7_UNORM_SRGB 99
+
+#define DDS_MAGIC 0x20534444 // "DDS "
+#define DDS_FOURCC_DX10 0x30315844 // "DX10"
+#define DDSD_REQUIRED_FLAGS 0x000A1007 // caps, height, width, pixel format, mip count, linear size
+#define DDPF_FOURCC 0x4
+#define DDSCAPS_MIPMAP_TEXTURE 0x00401008 // complex, texture, mipmap
+#define DDS_DIMENSION_TEXTURE2D 3
+
+struct DDSPixelFormat {
+	uint32_t size;
+	uint32_t flags;
+	uint32_t four_cc;
+	uint32_t rgb_bit_count;
+	uint32_t masks[4];
+};
+
+struct DDSHeader {
+	uint32_t magic;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t linear_size;
+	uint32_t depth;
+	uint32_t mip_count;
+	uint32_t reserved[11]; // ours: magic, version, usage, source hash low, source hash high
+	DDSPixelFormat pixel_format;
+	uint32_t caps[4];
+	uint32_t reserved2;
+	uint32_t dxgi_format;
+	uint32_t dimension;
+	uint32_t misc_flags;
+	uint32_t array_size;
+	uint32_t misc_flags2;
+};
+
+static_assert(sizeof(DDSHeader) == 148, "dds magic, header and dx10 header");
+
+static uint32_t BakedUsage(bool srgb, bool normal_map)
+{
+	return normal_map ? BAKED_USAGE_NORMAL : srgb ? BAKED_USAGE_SRGB : BAKED_USAGE_LINEAR;
+}
+
+std::string BakedTexturePath(const std::string& path, bool srgb, bool normal_map)
+{
+	static const char* suffixes[] = { ".linear.dds", ".srgb.dds", ".normal.dds" };
+	return path + suffixes[BakedUsage(srgb, normal_map)];
+}
+
+static int BlockSize(int internal_format)
+{
+	return internal_format == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+}
+
+static size_t LevelSize(int width, int height, int internal_format)
+{
+	return size_t((width + 3) / 4) * size_t((height + 3) / 4) * BlockSize(internal_format);
+}
+
+static void LayoutLevels(int width, int height, int internal_format, ogl::TextureLevels& levels)
+{
+	levels.count = ogl::mip_level_count(width, height);
+	size_t offset = 0;
+	for (int level = 0; level < levels.count; level++) {
+		levels.offsets[level] = offset;
+		levels.sizes[level] = LevelSize(std::max(width >> level, 1), std::max(height >> level, 1), internal_format);
+		offset += levels.sizes[level];
+	}
+}
+
+// ---------------- mip chain ---------------- //
+
+static float SrgbToLinear(float c)
+{
+	return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float LinearToSrgb(float c)
+{
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+static uint8_t ToUnorm8(float c)
+{
+	return uint8_t(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+// 2x2 box filter down to the next level. srgb color is averaged in linear space, normals are renormalized,
+// odd sizes clamp at the last row and column. srgb and normal_map only apply to the first three channels
+static void DownsampleLevel(const uint8_t* source, int width, int height, int channels, bool srgb, bool normal_map, uint8_t* destination)
+{
+	static float srgb_to_linear[256];
+	static bool table_ready = [] {
+		for (int i = 0; i < 256; i++) {
+			srgb_to_linear[i] = SrgbToLinear(i / 255.0f);
+		}
+		return true;
+	}();
+	(void)table_ready;
+
+	srgb = srgb && channels >= 3;
+	normal_map = normal_map && channels >= 3;
+
+	int next_width = std::max(width >> 1, 1);
+	int next_height = std::max(height >> 1, 1);
+
+	for (int y = 0; y < next_height; y++) {
+		int y0 = std::min(y * 2, height - 1);
+		int y1 = std::min(y * 2 + 1, height - 1);
+		for (int x = 0; x < next_width; x++) {
+			int x0 = std::min(x * 2, width - 1);
+			int x1 = std::min(x * 2 + 1, width - 1);
+			const uint8_t* texels[4] = {
+				source + (size_t(y0) * width + x0) * channels,
+				source + (size_t(y0) * width + x1) * channels,
+				source + (size_t(y1) * width + x0) * channels,
+				source + (size_t(y1) * width + x1) * channels,
+			};
+
+			float sum[4] = {};
+			for (const uint8_t* texel : texels) {
+				for (int c = 0; c < channels; c++) {
+					float value = texel[c] / 255.0f;
+					if (srgb && c < 3) {
+						value = srgb_to_linear[texel[c]];
+					}
+					else if (normal_map && c < 3) {
+						value = value * 2.0f - 1.0f;
+					}
+					sum[c] += value * 0.25f;
+				}
+			}
+
+			uint8_t* out = destination + (size_t(y) * next_width + x) * channels;
+			for (int c = 0; c < channels; c++) {
+				out[c] = ToUnorm8(sum[c]);
+			}
+			if (normal_map) {
+				float length = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+				float scale = length > 0.0f ? 1.0f / length : 0.0f;
+				for (int c = 0; c < 3; c++) {
+					out[c] = ToUnorm8(sum[c] * scale * 0.5f + 0.5f);
+				}
+			}
+			else if (srgb) {
+				for (int c = 0; c < 3; c++) {
+					out[c] = ToUnorm8(LinearToSrgb(sum[c]));
+				}
+			}
+		}
+	}
+}
+
+void GenerateMipChain(const uint8_t* pixels, int width, int height, int channels, bool srgb, bool normal_map, std::vector<uint8_t>& data, ogl::TextureLevels& levels)
+{
+	levels.count = ogl::mip_level_count(width, height);
+	size_t offset = 0;
+	for (int level = 0; level < levels.count; level++) {
+		levels.offsets[level] = offset;
+		levels.sizes[level] = size_t(std::max(width >> level, 1)) * std::max(height >> level, 1) * channels;
+		offset += levels.sizes[level];
+	}
+
+	data.resize(offset);
+	memcpy(data.data(), pixels, levels.sizes[0]);
+	for (int level = 1; level < levels.count; level++) {
+		DownsampleLevel(data.data() + levels.offsets[level - 1], std::max(width >> (level - 1), 1), std::max(height >> (level - 1), 1),
+			channels, srgb, normal_map, data.data() + levels.offsets[level]);
+	}
+}
+
+// ---------------- BC4 / BC5 ---------------- //
+
+void EncodeBC4Block(const uint8_t* rgba, int channel, uint8_t* block)
+{
+	uint8_t min_value = 255;
+	uint8_t max_value = 0;
+	for (int i = 0; i < 16; i++) {
+		min_value = std::min(min_value, rgba[i * 4 + channel]);
+		max_value = std::max(max_value, rgba[i * 4 + channel]);
+	}
+
+	// endpoint 0 > endpoint 1 selects the mode with six interpolated values, the finest of the two
+	block[0] = max_value;
+	block[1] = min_value;
+	memset(block + 2, 0, 6);
+	if (max_value == min_value) {
+		return;
+	}
+
+	int palette[8];
+	palette[0] = max_value;
+	palette[1] = min_value;
+	for (int i = 1; i < 7; i++) {
+		palette[i + 1] = ((7 - i) * max_value + i * min_value + 3) / 7;
+	}
+
+	uint64_t indices = 0;
+	for (int i = 0; i < 16; i++) {
+		int value = rgba[i * 4 + channel];
+		int best = 0;
+		int best_error = 256;
+		for (int p = 0; p < 8; p++) {
+			int error = std::abs(value - palette[p]);
+			if (error < best_error) {
+				best_error = error;
+				best = p;
+			}
+		}
+		indices |= uint64_t(best) << (i * 3);
+	}
+
+	for (int i = 0; i < 6; i++) {
+		block[2 + i] = uint8_t(indices >> (i * 8));
+	}
+}
+
+void EncodeBC5Block(const uint8_t* rgba, uint8_t* block)
+{
+	EncodeBC4Block(rgba, 0, block);
+	EncodeBC4Block(rgba, 1, block + 8);
+}
+
+// ---------------- BC7 ---------------- //
+
+// BC7 mode 6 only: one subset, 7 bit rgba endpoints with a p bit each and 4 bit indices. it handles alpha and
+// smooth gradients well and is what most fast encoders fall back to, multi subset modes would only help blocks
+// with several distinct colors
+
+static const int bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BC7Endpoints {
+	int color[2][4]; // 7 bit
+	int p[2];
+};
+
+static int BC7Expand(const BC7Endpoints& endpoints, int e, int c)
+{
+	return (endpoints.color[e][c] << 1) | endpoints.p[e];
+}
+
+// picks the 7 bit values and p bit that come closest to an unquantized endpoint
+static void BC7Quantize(const float* endpoint, int* color, int& p)
+{
+	float best_error = 1e30f;
+	for (int bit = 0; bit < 2; bit++) {
+		int candidate[4];
+		float error = 0.0f;
+		for (int c = 0; c < 4; c++) {
+			candidate[c] = std::clamp(int(std::lround((endpoint[c] - bit) * 0.5f)), 0, 127);
+			float difference = float((candidate[c] << 1) | bit) - endpoint[c];
+			error += difference * difference;
+		}
+		if (error < best_error) {
+			best_error = error;
+			p = bit;
+			std::copy(candidate, candidate + 4, color);
+		}
+	}
+}
+
+// assigns every pixel its closest palette entry, returns the squared error of the block
+static int BC7AssignIndices(const uint8_t* rgba, const BC7Endpoints& endpoints, int* indices)
+{
+	int palette[16][4];
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 4; c++) {
+			palette[i][c] = ((64 - bc7_weights[i]) * BC7Expand(endpoints, 0, c) + bc7_weights[i] * BC7Expand(endpoints, 1, c) + 32) >> 6;
+		}
+	}
+
+	int axis[4];
+	int axis_length = 0;
+	for (int c = 0; c < 4; c++) {
+		axis[c] = palette[15][c] - palette[0][c];
+		axis_length += axis[c] * axis[c];
+	}
+
+	// the projection onto the endpoint line lands next to the closest entry, only its neighbours are compared
+	int total_error = 0;
+	for (int i = 0; i < 16; i++) {
+		int projection = 0;
+		for (int c = 0; c < 4; c++) {
+			projection += (rgba[i * 4 + c] - palette[0][c]) * axis[c];
+		}
+		int guess = axis_length > 0 ? std::clamp(int(std::lround(15.0f * projection / axis_length)), 0, 15) : 0;
+
+		int best_error = INT32_MAX;
+		for (int p = std::max(guess - 1, 0); p <= std::min(guess + 1, 15); p++) {
+			int error = 0;
+			for (int c = 0; c < 4; c++) {
+				int difference = rgba[i * 4 + c] - palette[p][c];
+				error += difference * difference;
+			}
+			if (error < best_error) {
+				best_error = error;
+				indices[i] = p;
+			}
+		}
+		total_error += best_error;
+	}
+	return total_error;
+}
+
+// least squares endpoints for fixed indices, keeps the old ones when every pixel uses the same weight
+static bool BC7FitEndpoints(const uint8_t* rgba, const int* indices, float endpoints[2][4])
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+	for (int i = 0; i < 16; i++) {
+		float b = bc7_weights[indices[i]] / 64.0f;
+		float a = 1.0f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < 4; c++) {
+			ax[c] += a * rgba[i * 4 + c];
+			bx[c] += b * rgba[i * 4 + c];
+		}
+	}
+
+	float determinant = aa * bb - ab * ab;
+	if (std::abs(determinant) < 1e-6f) {
+		return false;
+	}
+
+	for (int c = 0; c < 4; c++) {
+		endpoints[0][c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+		endpoints[1][c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+static void BC7WriteBits(uint8_t* block, int& bit, uint32_t value, int count)
+{
+	for (int i = 0; i < count; i++, bit++) {
+		block[bit >> 3] |= uint8_t(((value >> i) & 1) << (bit & 7));
+	}
+}
+
+void EncodeBC7Block(const uint8_t* rgba, uint8_t* block)
+{
+	// endpoints at the extremes of the principal axis of the pixels
+	float mean[4] = {};
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 4; c++) {
+			mean[c] += rgba[i * 4 + c] / 16.0f;
+		}
+	}
+
+	float covariance[4][4] = {};
+	for (int i = 0; i < 16; i++) {
+		float d[4];
+		for (int c = 0; c < 4; c++) {
+			d[c] = rgba[i * 4 + c] - mean[c];
+		}
+		for (int r = 0; r < 4; r++) {
+			for (int c = 0; c < 4; c++) {
+				covariance[r][c] += d[r] * d[c];
+			}
+		}
+	}
+
+	float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float next[4] = {};
+		for (int r = 0; r < 4; r++) {
+			for (int c = 0; c < 4; c++) {
+				next[r] += covariance[r][c] * axis[c];
+			}
+		}
+		float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+		if (length < 1e-6f) {
+			break;
+		}
+		for (int c = 0; c < 4; c++) {
+			axis[c] = next[c] / length;
+		}
+	}
+
+	float min_t = 1e30f, max_t = -1e30f;
+	for (int i = 0; i < 16; i++) {
+		float t = 0.0f;
+		for (int c = 0; c < 4; c++) {
+			t += (rgba[i * 4 + c] - mean[c]) * axis[c];
+		}
+		min_t = std::min(min_t, t);
+		max_t = std::max(max_t, t);
+	}
+
+	float endpoints[2][4];
+	for (int c = 0; c < 4; c++) {
+		endpoints[0][c] = std::clamp(mean[c] + min_t * axis[c], 0.0f, 255.0f);
+		endpoints[1][c] = std::clamp(mean[c] + max_t * axis[c], 0.0f, 255.0f);
+	}
+
+	BC7Endpoints best = {};
+	int best_indices[16];
+	int best_error = INT32_MAX;
+
+	// a couple of refinement rounds, each fits the endpoints to the indices the previous round chose
+	for (int iteration = 0; iteration < 3; iteration++) {
+		BC7Endpoints candidate;
+		BC7Quantize(endpoints[0], candidate.color[0], candidate.p[0]);
+		BC7Quantize(endpoints[1], candidate.color[1], candidate.p[1]);
+
+		int indices[16];
+		int error = BC7AssignIndices(rgba, candidate, indices);
+		if (error < best_error) {
+			best_error = error;
+			best = candidate;
+			std::copy(indices, indices + 16, best_indices);
+		}
+		if (best_error == 0 || !BC7FitEndpoints(rgba, indices, endpoints)) {
+			break;
+		}
+	}
+
+	// the anchor (first) index is stored without its high bit, so it has to be below 8
+	if (best_indices[0] >= 8) {
+		std::swap(best.color[0], best.color[1]);
+		std::swap(best.p[0], best.p[1]);
+		for (int& index : best_indices) {
+			index = 15 - index;
+		}
+	}
+
+	memset(block, 0, 16);
+	int bit = 0;
+	BC7WriteBits(block, bit, 1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		BC7WriteBits(block, bit, best.color[0][c], 7);
+		BC7WriteBits(block, bit, best.color[1][c], 7);
+	}
+	BC7WriteBits(block, bit, best.p[0], 1);
+	BC7WriteBits(block, bit, best.p[1], 1);
+	BC7WriteBits(block, bit, best_indices[0], 3);
+	for (int i = 1; i < 16; i++) {
+		BC7WriteBits(block, bit, best_indices[i], 4);
+	}
+}
+
+// ---------------- bake ---------------- //
+
+static void EncodeLevel(const uint8_t* rgba, int width, int height, int internal_format, uint8_t* blocks)
+{
+	int block_size = BlockSize(internal_format);
+	int blocks_x = (width + 3) / 4;
+	int blocks_y = (height + 3) / 4;
+
+	for (int by = 0; by < blocks_y; by++) {
+		for (int bx = 0; bx < blocks_x; bx++) {
+			// blocks hanging over the edge repeat the last row and column
+			uint8_t block_pixels[16 * 4];
+			for (int y = 0; y < 4; y++) {
+				int sy = std::min(by * 4 + y, height - 1);
+				for (int x = 0; x < 4; x++) {
+					int sx = std::min(bx * 4 + x, width - 1);
+					memcpy(block_pixels + (y * 4 + x) * 4, rgba + (size_t(sy) * width + sx) * 4, 4);
+				}
+			}
+
+			uint8_t* block = blocks + (size_t(by) * blocks_x + bx) * block_size;
+			switch (internal_format) {
+			case GL_COMPRESSED_RED_RGTC1:
+				EncodeBC4Block(block_pixels, 0, block);
+				break;
+			case GL_COMPRESSED_RG_RGTC2:
+				EncodeBC5Block(block_pixels, block);
+				break;
+			default:
+				EncodeBC7Block(block_pixels, block);
+				break;
+			}
+		}
+	}
+}
+
+void BakeTexture(const uint8_t* pixels, int width, int height, int channels, bool srgb, bool normal_map, BakedTexture& baked)
+{
+	// single and dual channel data keeps sampling as (r, 0, 0, 1) and (r, g, 0, 1) like the uncompressed formats
+	if (normal_map || channels == 2) {
+		baked.internal_format = GL_COMPRESSED_RG_RGTC2;
+	}
+	else if (channels == 1) {
+		baked.internal_format = GL_COMPRESSED_RED_RGTC1;
+	}
+	else {
+		baked.internal_format = srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+
+	baked.width = width;
+	baked.height = height;
+	LayoutLevels(width, height, baked.internal_format, baked.levels);
+	baked.data.resize(baked.levels.offsets[baked.levels.count - 1] + baked.levels.sizes[baked.levels.count - 1]);
+
+	// every level is filtered from the previous one in rgba8
+	std::vector<uint8_t> level(size_t(width) * height * 4);
+	for (size_t i = 0; i < size_t(width) * height; i++) {
+		const uint8_t* source = pixels + i * channels;
+		uint8_t* destination = level.data() + i * 4;
+		destination[0] = source[0];
+		destination[1] = channels > 1 ? source[1] : 0;
+		destination[2] = channels > 2 ? source[2] : 0;
+		destination[3] = channels > 3 ? source[3] : 255;
+	}
+
+	std::vector<uint8_t> next_level;
+	for (int l = 0; l < baked.levels.count; l++) {
+		int level_width = std::max(width >> l, 1);
+		int level_height = std::max(height >> l, 1);
+		EncodeLevel(level.data(), level_width, level_height, baked.internal_format, baked.data.data() + baked.levels.offsets[l]);
+
+		if (l + 1 < baked.levels.count) {
+			next_level.resize(size_t(std::max(level_width >> 1, 1)) * std::max(level_height >> 1, 1) * 4);
+			DownsampleLevel(level.data(), level_width, level_height, 4, srgb && channels > 2, normal_map, next_level.data());
+			level.swap(next_level);
+		}
+	}
+}
+
+// ---------------- cache ---------------- //
+
+static uint32_t DxgiFormat(int internal_format)
+{
+	switch (internal_format) {
+	case GL_COMPRESSED_RED_RGTC1: return DXGI_FORMAT_BC4_UNORM;
+	case GL_COMPRESSED_RG_RGTC2: return DXGI_FORMAT_BC5_UNORM;
+	case GL_COMPRESSED_RGBA_BPTC_UNORM: return DXGI_FORMAT_BC7_UNORM;
+	case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM: return DXGI_FORMAT_BC7_UNORM_SRGB;
+	}
+	return 0;
+}
+
+static int GLFormat(uint32_t dxgi_format)
+{
+	switch (dxgi_format) {
+	case DXGI_FORMAT_BC4_UNORM: return GL_COMPRESSED_RED_RGTC1;
+	case DXGI_FORMAT_BC5_UNORM: return GL_COMPRESSED_RG_RGTC2;
+	case DXGI_FORMAT_BC7_UNORM: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	case DXGI_FORMAT_BC7_UNORM_SRGB: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+	}
+	return 0;
+}
+
+bool WriteBakedTexture(const char* path, uint64_t source_hash, bool srgb, bool normal_map, const BakedTexture& baked)
+{
+	DDSHeader header = {};
+	header.magic = DDS_MAGIC;
+	header.size = 124;
+	header.flags = DDSD_REQUIRED_FLAGS;
+	header.height = uint32_t(baked.height);
+	header.width = uint32_t(baked.width);
+	header.linear_size = uint32_t(baked.levels.sizes[0]);
+	header.mip_count = uint32_t(baked.levels.count);
+	header.reserved[0] = BAKED_TEXTURE_MAGIC;
+	header.reserved[1] = TEXTURE_BAKE_VERSION;
+	header.reserved[2] = BakedUsage(srgb, normal_map);
+	header.reserved[3] = uint32_t(source_hash);
+	header.reserved[4] = uint32_t(source_hash >> 32);
+	header.pixel_format.size = sizeof(DDSPixelFormat);
+	header.pixel_format.flags = DDPF_FOURCC;
+	header.pixel_format.four_cc = DDS_FOURCC_DX10;
+	header.caps[0] = DDSCAPS_MIPMAP_TEXTURE;
+	header.dxgi_format = DxgiFormat(baked.internal_format);
+	header.dimension = DDS_DIMENSION_TEXTURE2D;
+	header.array_size = 1;
+
+	FILE* file = nullptr;
+	if (fopen_s(&file, path, "wb") != 0 || file == nullptr) {
+		return false;
+	}
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(baked.data.data(), 1, baked.data.size(), file) == baked.data.size();
+	fclose(file);
+
+	// a partial file must not be mistaken for a cache hit next time
+	if (!written) {
+		remove(path);
+	}
+	return written;
+}
+
+size_t ReadBakedTexture(const uint8_t* data, size_t size, uint64_t source_hash, bool srgb, bool normal_map, BakedTexture& baked)
+{
+	if (size < sizeof(DDSHeader)) {
+		return 0;
+	}
+
+	DDSHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != DDS_MAGIC || header.pixel_format.four_cc != DDS_FOURCC_DX10 ||
+		header.reserved[0] != BAKED_TEXTURE_MAGIC || header.reserved[1] != TEXTURE_BAKE_VERSION ||
+		header.reserved[2] != BakedUsage(srgb, normal_map) ||
+		header.reserved[3] != uint32_t(source_hash) || header.reserved[4] != uint32_t(source_hash >> 32)) {
+		return 0;
+	}
+
+	baked.internal_format = GLFormat(header.dxgi_format);
+	baked.width = int(header.width);
+	baked.height = int(header.height);
+	if (baked.internal_format == 0 || baked.width <= 0 || baked.height <= 0) {
+		return 0;
+	}
+
+	LayoutLevels(baked.width, baked.height, baked.internal_format, baked.levels);
+	size_t data_size = baked.levels.offsets[baked.levels.count - 1] + baked.levels.sizes[baked.levels.count - 1];
+	if (header.mip_count != uint32_t(baked.levels.count) || size - sizeof(DDSHeader) < data_size) {
+		return 0;
+	}
+
+	return sizeof(DDSHeader);
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "opengl.h"
+
+// bumped whenever the encoders or the mip filter change, older cache files are baked again
+#define TEXTURE_BAKE_VERSION 1
+
+/**
+* block compressed texture with its full mip chain, levels are stored back to back in data
+*/
+struct BakedTexture {
+	std::vector<uint8_t> data;
+	ogl::TextureLevels levels;
+	int width, height;
+	int internal_format;
+};
+
+/**
+* where the baked version of the file at path is cached, next to it and named after how it is sampled
+* so the same image used as color and as data gets one file for each
+*/
+std::string BakedTexturePath(const std::string& path, bool srgb, bool normal_map);
+
+/**
+* builds the mip chain of pixels and block compresses every level. base color and emissive (srgb) become BC7
+* with mips filtered in linear space, normal maps BC5 (x and y, z is rebuilt in the shader), other data maps
+* BC4, BC5 or BC7 depending on how many channels the image has
+*/
+void BakeTexture(const uint8_t* pixels, int width, int height, int channels, bool srgb, bool normal_map, BakedTexture& baked);
+
+/**
+* builds every level of an uncompressed image below level 0 with the same filter the bake uses (srgb color
+* averaged in linear space, normals renormalized). levels keep the channel count of pixels, level 0 is copied
+*/
+void GenerateMipChain(const uint8_t* pixels, int width, int height, int channels, bool srgb, bool normal_map, std::vector<uint8_t>& data, ogl::TextureLevels& levels);
+
+/**
+* writes baked as a dds file, the source hash and bake version go into the reserved header fields
+*/
+bool WriteBakedTexture(const char* path, uint64_t source_hash, bool srgb, bool normal_map, const BakedTexture& baked);
+
+/**
+* checks that data holds a dds file written by WriteBakedTexture for the same source and usage
+* @returns the offset of level 0 in data, 0 if the file can't be used
+*/
+size_t ReadBakedTexture(const uint8_t* data, size_t size, uint64_t source_hash, bool srgb, bool normal_map, BakedTexture& baked);
+
+// 16 rgba8 pixels in, one 8 byte (BC4) or 16 byte (BC5, BC7) block out
+void EncodeBC4Block(const uint8_t* rgba, int channel, uint8_t* block);
+void EncodeBC5Block(const uint8_t* rgba, uint8_t* block);
+void EncodeBC7Block(const uint8_t* rgba, uint8_t* block);
@@ -1,11 +1,18 @@
 #include "TextureLoader.h"
-#include <execution>
+#include "BoundedQueue.h"
+#include "KtxTexture.h"
+#include "MappedFile.h"
+#include "TextureBake.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include "stb_image.h"
 #include <gli/gli.hpp>
 
 TextureLoader* TextureLoader::instance = nullptr;
 
-ogl::Texture2D* TextureLoader::Load(const std::string& path, void* data, size_t size,bool srgb, bool flip, bool bindless)
+ogl::Texture2D* TextureLoader::Load(const std::string& path, void* data, size_t size,bool srgb, bool flip, bool bindless, bool normal_map)
 {
 	if (instance == nullptr)
 	{
@@ -14,8 +21,8 @@ ogl::Texture2D* TextureLoader::Load(const std::string& path, void* data, size_t
 
 	for (const auto& p : instance->promises)
 	{
-		const auto& [_path, _data, _size, _free_data, _srgb, _flip, _bindless, _index] = p;
-		if (path == _path && data == _data && size == _size && srgb == _srgb &&  flip == _flip && bindless == _bindless)
+		const auto& [_path, _data, _size, _free_data, _srgb, _flip, _bindless, _normal_map, _index] = p;
+		if (path == _path && data == _data && size == _size && srgb == _srgb &&  flip == _flip && bindless == _bindless && normal_map == _normal_map)
 		{
 			printf("Re-Using Texture %s\n", path.c_str());
 			return instance->textures[_index];
@@ -23,14 +30,30 @@ ogl::Texture2D* TextureLoader::Load(const std::string& path, void* data, size_t
 	}
 
 	// if the data is owned by the caller, we don't free it
-	instance->promises.push_back({ path , data, size, data == nullptr, srgb, flip, bindless, instance->index++ });
+	instance->promises.push_back({ path , data, size, data == nullptr, srgb, flip, bindless, normal_map, instance->index++ });
 	instance->textures.push_back(new ogl::Texture2D{});
 	return instance->textures.back();
 }
 
+// how many textures may wait between two stages, enough to keep every stage busy without holding the whole set in memory
+#define TEXTURE_PIPELINE_DEPTH 8
+
+// decoded pixels are copied here by the workers and uploaded from it without blocking the gl thread
+#define TEXTURE_STAGING_BUFFER_SIZE (64 * 1024 * 1024)
+
+struct ReadTexture
+{
+	int index;
+	unsigned char* data;
+	int data_size;
+	bool owned; // read from a file by the loader, not handed in by the caller
+	unsigned char* baked; // the bake cache file of the source, nullptr if there is none
+	int baked_size;
+};
+
 struct PromisedTexture
 {
-	std::string path;
+	int index;
 	unsigned char* data;
 	int data_size;
 	int width, height, channels;
@@ -40,118 +63,395 @@ struct PromisedTexture
 	int internal_format;
 	int pixel_format;
 	bool is_stb;
+	ogl::TextureLevels levels; // count is 0 when only level 0 is in data
+	bool from_bake_cache;
+	bool baked;
+	bool ktx;
+	ogl::StagingAllocation staging; // holds the pixels instead of data when the staging buffer had room
 };
 
-void TextureLoader::LoadPromisedTextures()
+static double MillisecondsSince(std::chrono::steady_clock::time_point start)
 {
-	if (instance == nullptr)
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool ReadWholeFile(const char* path, unsigned char*& data, int& size)
+{
+	FILE* file;
+	fopen_s(&file, path, "rb");
+	if (!file)
+	{
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	auto file_size = ftell(file);
+	rewind(file);
+	data = new unsigned char[file_size];
+	fread_s(data, file_size, 1, file_size, file);
+	fclose(file);
+	size = int(file_size);
+	return true;
+}
+
+// png, jpeg and the like are block compressed and cached, dds and ktx2 files already are
+static bool ShouldBake(const std::string& path, const ReadTexture& read)
+{
+	return read.owned && path.find(".dds") == std::string::npos && !IsKtx2(read.data, size_t(read.data_size));
+}
+
+static ReadTexture ReadPromisedTexture(const std::string& path, void* data, size_t size, bool srgb, bool normal_map, int index)
+{
+	if (data != nullptr && size > 0)
+	{
+		return { index, (unsigned char*)data, int(size), false, nullptr, 0 };
+	}
+
+	ReadTexture read = { index, nullptr, 0, true, nullptr, 0 };
+	if (!ReadWholeFile(path.c_str(), read.data, read.data_size))
+	{
+		printf("Failed to load texture %s\n", path.c_str());
+		return { index, nullptr, 0, false, nullptr, 0 };
+	}
+
+	if (ShouldBake(path, read))
+	{
+		ReadWholeFile(BakedTexturePath(path, srgb, normal_map).c_str(), read.baked, read.baked_size);
+	}
+	return read;
+}
+
+// takes the mip chain straight out of a valid bake cache file, no decoding involved
+static bool LoadFromBakeCache(const ReadTexture& read, uint64_t source_hash, bool srgb, bool normal_map, PromisedTexture& p)
+{
+	BakedTexture baked;
+	size_t offset = ReadBakedTexture(read.baked, size_t(read.baked_size), source_hash, srgb, normal_map, baked);
+	if (offset == 0)
+	{
+		return false;
+	}
+
+	// the blocks are moved to the front so the buffer can be freed like any other
+	size_t size = baked.levels.offsets[baked.levels.count - 1] + baked.levels.sizes[baked.levels.count - 1];
+	memmove(read.baked, read.baked + offset, size);
+
+	p.width = baked.width;
+	p.height = baked.height;
+	p.channels = 0;
+	p.internal_format = baked.internal_format;
+	p.pixel_format = baked.internal_format;
+	p.data = read.baked;
+	p.data_size = int(size);
+	p.levels = baked.levels;
+	p.compressed = true;
+	p.is_stb = false;
+	p.from_bake_cache = true;
+	return true;
+}
+
+static void BakePixels(const std::string& path, uint64_t source_hash, bool srgb, bool normal_map, PromisedTexture& p)
+{
+	BakedTexture baked;
+	BakeTexture(p.data, p.width, p.height, p.channels, srgb, normal_map, baked);
+	if (!WriteBakedTexture(BakedTexturePath(path, srgb, normal_map).c_str(), source_hash, srgb, normal_map, baked))
+	{
+		printf("Failed to write baked texture for %s\n", path.c_str());
+	}
+
+	stbi_image_free(p.data);
+	p.data = new unsigned char[baked.data.size()];
+	memcpy(p.data, baked.data.data(), baked.data.size());
+	p.data_size = int(baked.data.size());
+	p.channels = 0;
+	p.internal_format = baked.internal_format;
+	p.pixel_format = baked.internal_format;
+	p.levels = baked.levels;
+	p.compressed = true;
+	p.is_stb = false;
+	p.baked = true;
+}
+
+static void LoadKtxPixels(const ReadTexture& read, bool srgb, uint32_t ktx_format, PromisedTexture& p)
+{
+	KtxImage image;
+	if (!LoadKtx2(read.data, size_t(read.data_size), srgb, ktx_format, image))
 	{
-		instance = new TextureLoader;
 		return;
 	}
 
-	if (promises.empty()) return;
+	p.width = image.width;
+	p.height = image.height;
+	p.channels = 0;
+	p.internal_format = image.internal_format;
+	p.pixel_format = image.pixel_format;
+	p.data = image.data;
+	p.data_size = int(image.size);
+	p.levels = image.levels;
+	p.compressed = image.compressed;
+	p.is_stb = false;
+	p.ktx = true;
+}
+
+// images that are not baked (embedded ones) still get their mips filtered here instead of on the gl thread
+static void BuildMipChain(bool srgb, bool normal_map, PromisedTexture& p)
+{
+	std::vector<uint8_t> levels;
+	GenerateMipChain(p.data, p.width, p.height, p.channels, srgb, normal_map, levels, p.levels);
 
-	auto promisedTextures = new PromisedTexture[promises.size()];
-	memset(promisedTextures, 0, sizeof(PromisedTexture) * promises.size());
+	stbi_image_free(p.data);
+	p.data = new unsigned char[levels.size()];
+	memcpy(p.data, levels.data(), levels.size());
+	p.data_size = int(levels.size());
+	p.is_stb = false;
+}
 
-	for (size_t i = 0; i < promises.size(); i++)
+static PromisedTexture DecodePromisedTexture(const std::string& path, const ReadTexture& read, bool srgb, bool flip, bool bindless, bool normal_map, uint32_t ktx_format)
+{
+	PromisedTexture p = {};
+	p.index = read.index;
+	p.bindless = bindless;
+	p.srgb = srgb;
+	if (read.data == nullptr)
 	{
-		const auto& [path, data, size, free_data, srgb, flip, bindless, index] = promises[i];
+		return p;
+	}
 
-		if (data != nullptr && size > 0)
+	if (IsKtx2(read.data, size_t(read.data_size)))
+	{
+		LoadKtxPixels(read, srgb, ktx_format, p);
+		if (read.owned)
 		{
-			promisedTextures[i].data = (unsigned char*)data;
-			promisedTextures[i].data_size = int(size);
-			promisedTextures[i].bindless = bindless;
-			promisedTextures[i].srgb = srgb;
-			continue;
+			delete[] read.data;
 		}
+		return p;
+	}
+
+	// flipped images bake differently, so the flag is part of the key
+	bool bake = ShouldBake(path, read);
+	uint64_t source_hash = bake ? HashBytes(read.data, size_t(read.data_size)) + (flip ? 1 : 0) : 0;
 
-		FILE* file;
-		fopen_s(&file, path.c_str(), "rb");
-		if (file) {
-			fseek(file, 0, SEEK_END);
-			auto size = ftell(file);
-			rewind(file);
-			auto buffer = new unsigned char[size];
-			if (buffer) {
-				fread_s(buffer, size, 1, size, file);
-				promisedTextures[i].data = buffer;
-				promisedTextures[i].data_size = int(size);
-				promisedTextures[i].bindless = bindless;
-				promisedTextures[i].srgb = srgb;
+	if (bake && read.baked != nullptr && LoadFromBakeCache(read, source_hash, srgb, normal_map, p))
+	{
+		delete[] read.data;
+		return p;
+	}
+	delete[] read.baked;
+
+	if (path.find(".dds") != std::string::npos)
+	{
+		gli::texture tex = gli::load_dds((const char*)read.data, read.data_size);
+		if (tex.empty() || tex.levels() == 0)
+		{
+			// left without data like a file stb can't decode
+			printf_s("Failed to read dds texture %s\n", path.c_str());
+			if (read.owned)
+			{
+				delete[] read.data;
 			}
+			return p;
+		}
+
+		gli::gl GL(gli::gl::PROFILE_GL33);
+		gli::gl::format const Format = GL.translate(tex.format(), tex.swizzles());
+
+		// every level the file has, they are stored back to back for a single face and layer
+		p.levels.count = int(std::min<size_t>(tex.levels(), TEXTURE_MAX_LEVELS));
+		for (int level = 0; level < p.levels.count; level++)
+		{
+			p.levels.offsets[level] = size_t((const char*)tex.data(0, 0, level) - (const char*)tex.data());
+			p.levels.sizes[level] = tex.size(level);
+		}
+		size_t size = p.levels.offsets[p.levels.count - 1] + p.levels.sizes[p.levels.count - 1];
+
+		char* buffer = new char[size];
+		memcpy(buffer, tex.data(), size);
+
+		printf_s("internal format 0x%X, levels %d\n", Format.Internal, int(tex.levels()));
+
+		p.width = tex.extent().x;
+		p.height = tex.extent().y;
+		p.channels = 0;
+		p.internal_format = Format.Internal;
+		p.pixel_format = Format.Internal;
+		p.data = (unsigned char*)buffer;
+		p.data_size = int(size);
+		p.compressed = gli::is_compressed(tex.format());
+		p.is_stb = false;
+	}
+	else {
+		// the flip flag is per thread, decode workers don't race on it
+		stbi_set_flip_vertically_on_load_thread(flip);
+		p.data = stbi_load_from_memory(read.data, read.data_size, &p.width, &p.height, &p.channels, 0);
+		p.data_size = -1;
+		p.internal_format = 0;
+		p.pixel_format = 0;
+		p.compressed = false;
+		p.is_stb = true;
+
+		if (bake && p.data != nullptr)
+		{
+			BakePixels(path, source_hash, srgb, normal_map, p);
 		}
-		else
+		else if (p.data != nullptr)
 		{
-			printf("Failed to load texture %s\n", path.c_str());
+			BuildMipChain(srgb, normal_map, p);
 		}
 	}
 
-	std::for_each(std::execution::par_unseq, promises.begin(), promises.end(),
-		[&](std::tuple<std::string, void*, size_t, bool, bool, bool, bool, int>& promise) {
-			const auto& [path, data, size, free_data, srgb, flip, bindless, index] = promise;
-			auto& p = promisedTextures[index];
-			if (p.data != nullptr)
+	if (read.owned)
+	{
+		delete[] read.data;
+	}
+	return p;
+}
+
+static void FreePixels(PromisedTexture& p)
+{
+	if (p.is_stb) {
+		stbi_image_free(p.data);
+	} else{
+		delete[] p.data;
+	}
+	p.data = nullptr;
+}
+
+static size_t PixelSize(const PromisedTexture& p)
+{
+	return p.compressed || p.levels.count > 0 ? size_t(p.data_size) : size_t(p.width) * p.height * p.channels;
+}
+
+// moves the pixels into staging memory, leaves them where they are if the staging buffer is full
+static void StagePixels(ogl::StagingBuffer* staging, PromisedTexture& p, bool blocking)
+{
+	size_t size = PixelSize(p);
+	ogl::StagingAllocation allocation = blocking ? ogl::staging_buffer_allocate(staging, size) : ogl::staging_buffer_try_allocate(staging, size);
+	if (allocation.data == nullptr)
+	{
+		return;
+	}
+
+	memcpy(allocation.data, p.data, size);
+	allocation.size = size;
+	FreePixels(p);
+	p.staging = allocation;
+}
+
+void TextureLoader::LoadPromisedTextures()
+{
+	if (instance == nullptr)
+	{
+		instance = new TextureLoader;
+		return;
+	}
+
+	if (promises.empty()) return;
+
+	auto start = std::chrono::steady_clock::now();
+
+	// file reads -> decode workers -> uploads on this thread, the only one allowed to call gl.
+	// the bounded queues let every stage work on a different texture at the same time
+	BoundedQueue<ReadTexture> read_queue(TEXTURE_PIPELINE_DEPTH);
+	BoundedQueue<PromisedTexture> decoded_queue(TEXTURE_PIPELINE_DEPTH);
+	ogl::StagingBuffer* staging = ogl::create_staging_buffer(TEXTURE_STAGING_BUFFER_SIZE);
+	uint32_t ktx_format = ChooseKtxTranscodeFormat();
+
+	double read_ms = 0.0;
+	std::thread reader([&] {
+		auto read_start = std::chrono::steady_clock::now();
+		for (const auto& [path, data, size, free_data, srgb, flip, bindless, normal_map, index] : promises)
+		{
+			read_queue.Push(ReadPromisedTexture(path, data, size, srgb, normal_map, index));
+		}
+		read_ms = MillisecondsSince(read_start);
+		read_queue.Close();
+	});
+
+	// the reader and this thread mostly wait on io and the driver, leave them a core
+	unsigned int worker_count = std::min(std::max(std::thread::hardware_concurrency(), 2u) - 1, unsigned(promises.size()));
+	std::atomic<unsigned int> running_workers = worker_count;
+	std::atomic<int64_t> decode_us = 0;
+	std::atomic<unsigned int> cache_hits = 0;
+	std::atomic<unsigned int> baked_count = 0;
+	std::atomic<unsigned int> ktx_count = 0;
+	std::vector<std::thread> workers;
+	for (unsigned int i = 0; i < worker_count; i++)
+	{
+		workers.emplace_back([&] {
+			ReadTexture read;
+			while (read_queue.Pop(read))
 			{
-				if (path.find(".dds") != std::string::npos)
+				auto decode_start = std::chrono::steady_clock::now();
+				const auto& [path, data, size, free_data, srgb, flip, bindless, normal_map, index] = promises[read.index];
+				PromisedTexture decoded = DecodePromisedTexture(path, read, srgb, flip, bindless, normal_map, ktx_format);
+				if (decoded.data != nullptr)
 				{
-					gli::texture tex = gli::load_dds((const char*)p.data, p.data_size);
-					gli::gl GL(gli::gl::PROFILE_GL33);
-					gli::gl::format const Format = GL.translate(tex.format(), tex.swizzles());
-					GLenum Target = GL.translate(tex.target());
-
-					char* buffer = new char[tex.size(0)];
-					memcpy(buffer, tex.data(), tex.size(0));
-
-					printf_s("internal format 0x%X, levels %d\n", Format.Internal, tex.levels());
-
-					p.width = tex.extent().x;
-					p.height = tex.extent().y;
-					p.channels = 0;
-					p.internal_format = Format.Internal;
-					p.pixel_format = Format.Internal;
-					p.data = (unsigned char*)buffer;
-					p.data_size = int(tex.size(0));
-					p.srgb = srgb;
-					p.compressed = gli::is_compressed(tex.format());
-					p.is_stb = false;
-				}
-				else {
-					stbi_set_flip_vertically_on_load(flip);
-					auto buffer = stbi_load_from_memory(p.data, p.data_size, &p.width, &p.height, &p.channels, 0);
-					if (free_data) {
-						delete[] p.data;
-					}
-
-					p.data = buffer;
-					p.data_size = -1;
-					p.internal_format = 0;
-					p.pixel_format = 0;
-					p.compressed = false;
-					p.srgb = srgb;
-					p.is_stb = (!free_data);
+					StagePixels(staging, decoded, false);
 				}
+				decode_us += int64_t(MillisecondsSince(decode_start) * 1000.0);
+				cache_hits += decoded.from_bake_cache;
+				baked_count += decoded.baked;
+				ktx_count += decoded.ktx;
+				decoded_queue.Push(decoded);
+			}
+			if (--running_workers == 0)
+			{
+				decoded_queue.Close();
 			}
 		});
+	}
 
-	for (int i = 0; i < promises.size(); i++)
+	double upload_ms = 0.0;
+	PromisedTexture p;
+	while (decoded_queue.Pop(p))
 	{
-		auto& p = promisedTextures[i];
-		if (p.data != nullptr)
+		if (p.data == nullptr && p.staging.data == nullptr)
 		{
-			auto texture = ogl::create_texture_from_bytes(p.data, p.data_size, p.width, p.height, p.channels, p.srgb, p.compressed, p.internal_format, p.pixel_format);
-			textures[i]->id = texture.id;
-			if (p.is_stb) {
-				stbi_image_free(p.data);
-			} else{
-				delete[] p.data;
-			}
+			continue;
 		}
+
+		auto upload_start = std::chrono::steady_clock::now();
+
+		// the workers found no room, wait here for earlier uploads instead. only textures larger than the
+		// whole staging buffer are uploaded from client memory, which blocks until the driver copied them
+		if (p.staging.data == nullptr)
+		{
+			StagePixels(staging, p, true);
+		}
+
+		ogl::Texture2D texture;
+		if (p.staging.data != nullptr)
+		{
+			texture = ogl::create_texture_from_staging(staging, p.staging, p.width, p.height, p.channels, p.srgb, p.compressed, p.internal_format, p.pixel_format, p.levels.count > 0 ? &p.levels : nullptr);
+		}
+		else {
+			texture = ogl::create_texture_from_bytes(p.data, p.data_size, p.width, p.height, p.channels, p.srgb, p.compressed, p.internal_format, p.pixel_format, p.levels.count > 0 ? &p.levels : nullptr);
+			FreePixels(p);
+		}
+
+		textures[p.index]->id = texture.id;
+		if (p.bindless && ogl::bindless_textures_supported()) {
+			ogl::make_texture_resident(*textures[p.index]);
+		}
+
+		// frees the room of finished uploads for the workers
+		ogl::staging_buffer_retire(staging);
+		upload_ms += MillisecondsSince(upload_start);
+	}
+
+	reader.join();
+	for (auto& worker : workers)
+	{
+		worker.join();
 	}
+	ogl::delete_staging_buffer(staging);
 
-	delete[] promisedTextures;
+	// decode time is summed over the workers, the total should be close to the slowest stage rather than the sum
+	printf("Loaded %zu textures in %.1f ms (read %.1f ms, decode %.1f ms on %u threads, upload %.1f ms), %u from the bake cache, %u baked\n",
+		promises.size(), MillisecondsSince(start), read_ms, decode_us / 1000.0, worker_count, upload_ms, cache_hits.load(), baked_count.load());
+	if (ktx_count > 0)
+	{
+		printf("%u KTX2 textures, basis payloads transcoded to %s\n", ktx_count.load(), KtxTranscodeFormatName(ktx_format));
+	}
 
 	index = 0;
 	promises.clear();
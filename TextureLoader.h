@@ -19,20 +19,25 @@ public:
 	* keep in mind to free them carefully since two or more textures can be the same
 	* @param path path to the texture file (relative to the .exe)
 	* @param flip flip the texture vertically
-	* @param bindless if you want to use texture in bindless mode
+	* @param bindless make a resident bindless handle (Texture2D::handle) after creation, ignored without ARB_bindless_texture
+	* @param normal_map tangent space normals, only x and y are kept when the texture is baked (BC5)
 	*/
-	static ogl::Texture2D* Load(const std::string& path, void* data, size_t size, bool srgb, bool flip = false, bool bindless = false);
+	static ogl::Texture2D* Load(const std::string& path, void* data, size_t size, bool srgb, bool flip = false, bool bindless = false, bool normal_map = false);
 
 	/**
-	* actually loads all the textures that were promised to this point. the loading is done on multiple threads
-	* but the texture creation and data copy is done on the main thread since OpenGL is single threaded
+	* actually loads all the textures that were promised to this point. files are read on one thread and decoded on
+	* several, while the texture creation and data copy run on the calling thread since OpenGL is single threaded.
+	* the three stages overlap, textures are uploaded as soon as they are decoded.
+	* image files are block compressed with a full mip chain the first time and cached next to the source
+	* (see TextureBake.h), later loads upload the cached blocks without decoding anything.
+	* KTX2 files (recognized by content) are transcoded on the workers to the best block format the context supports
 	*/
 	void LoadPromisedTextures();
 
 private:
 	static TextureLoader* instance;
 	int index{ 0 };
-	// (path, void* data, size_t size, free_data, srgb, flip, bindless, index)
-	std::vector<std::tuple<std::string, void*, size_t, bool, bool, bool, bool, int>> promises;
+	// (path, void* data, size_t size, free_data, srgb, flip, bindless, normal_map, index)
+	std::vector<std::tuple<std::string, void*, size_t, bool, bool, bool, bool, bool, int>> promises;
 	std::vector<ogl::Texture2D*> textures;
 };
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include "Transforms.h"
+
+#include <algorithm>
+
+#include <immintrin.h>
+
+void TransformSystem::Reserve(size_t count)
+{
+	transforms.reserve(count);
+	model_offsets.reserve(count);
+	matrices.reserve(count);
+	dirty.reserve(count);
+}
+
+void TransformSystem::Clear()
+{
+	transforms.clear();
+	model_offsets.clear();
+	matrices.clear();
+	changed_ranges.clear();
+	changed.clear();
+	dirty.clear();
+	dirty_list.clear();
+}
+
+uint32_t TransformSystem::Add(const glm::mat4& transform, const glm::mat4& model_offset)
+{
+	uint32_t index = uint32_t(transforms.size());
+	transforms.push_back(transform);
+	model_offsets.push_back(model_offset);
+	matrices.push_back({});
+	dirty.push_back(1);
+	dirty_list.push_back(index);
+	return index;
+}
+
+void TransformSystem::Set(uint32_t index, const glm::mat4& transform)
+{
+	transforms[index] = transform;
+	if (!dirty[index]) {
+		dirty[index] = 1;
+		dirty_list.push_back(index);
+	}
+}
+
+bool TransformSystem::Update()
+{
+	changed_ranges.clear();
+	changed.clear();
+
+	if (dirty_list.empty()) {
+		return false;
+	}
+
+	changed.swap(dirty_list);
+	std::sort(changed.begin(), changed.end());
+
+	std::vector<glm::mat4> normal_matrices(changed.size());
+	ComputeNormalMatrices(transforms.data(), changed.data(), changed.size(), normal_matrices.data());
+
+	for (size_t i = 0; i < changed.size(); i++) {
+		uint32_t index = changed[i];
+		matrices[index].model = transforms[index] * model_offsets[index];
+		matrices[index].normal_matrix = normal_matrices[i];
+		dirty[index] = 0;
+
+		if (!changed_ranges.empty() && index - (changed_ranges.back().first + changed_ranges.back().count) <= TRANSFORM_RANGE_MERGE_GAP) {
+			changed_ranges.back().count = index + 1 - changed_ranges.back().first;
+		}
+		else {
+			changed_ranges.push_back({ index, 1 });
+		}
+	}
+
+	return true;
+}
+
+// the cofactor matrix divided by the determinant is the inverse transpose, so no transpose is needed at the end.
+// a[c][r] holds element (column c, row r) of four matrices, one per lane
+static void InverseTranspose(const __m128 a[4][4], __m128 b[4][4])
+{
+	// 2x2 determinants of the first two and of the last two columns
+	__m128 s0 = _mm_sub_ps(_mm_mul_ps(a[0][0], a[1][1]), _mm_mul_ps(a[1][0], a[0][1]));
+	__m128 s1 = _mm_sub_ps(_mm_mul_ps(a[0][0], a[1][2]), _mm_mul_ps(a[1][0], a[0][2]));
+	__m128 s2 = _mm_sub_ps(_mm_mul_ps(a[0][0], a[1][3]), _mm_mul_ps(a[1][0], a[0][3]));
+	__m128 s3 = _mm_sub_ps(_mm_mul_ps(a[0][1], a[1][2]), _mm_mul_ps(a[1][1], a[0][2]));
+	__m128 s4 = _mm_sub_ps(_mm_mul_ps(a[0][1], a[1][3]), _mm_mul_ps(a[1][1], a[0][3]));
+	__m128 s5 = _mm_sub_ps(_mm_mul_ps(a[0][2], a[1][3]), _mm_mul_ps(a[1][2], a[0][3]));
+	__m128 c5 = _mm_sub_ps(_mm_mul_ps(a[2][2], a[3][3]), _mm_mul_ps(a[3][2], a[2][3]));
+	__m128 c4 = _mm_sub_ps(_mm_mul_ps(a[2][1], a[3][3]), _mm_mul_ps(a[3][1], a[2][3]));
+	__m128 c3 = _mm_sub_ps(_mm_mul_ps(a[2][1], a[3][2]), _mm_mul_ps(a[3][1], a[2][2]));
+	__m128 c2 = _mm_sub_ps(_mm_mul_ps(a[2][0], a[3][3]), _mm_mul_ps(a[3][0], a[2][3]));
+	__m128 c1 = _mm_sub_ps(_mm_mul_ps(a[2][0], a[3][2]), _mm_mul_ps(a[3][0], a[2][2]));
+	__m128 c0 = _mm_sub_ps(_mm_mul_ps(a[2][0], a[3][1]), _mm_mul_ps(a[3][0], a[2][1]));
+
+	__m128 determinant = _mm_add_ps(
+		_mm_add_ps(_mm_sub_ps(_mm_mul_ps(s0, c5), _mm_mul_ps(s1, c4)), _mm_add_ps(_mm_mul_ps(s2, c3), _mm_mul_ps(s3, c2))),
+		_mm_sub_ps(_mm_mul_ps(s5, c0), _mm_mul_ps(s4, c1)));
+
+	// a zero determinant gives a zero matrix instead of infinities
+	__m128 inverse_determinant = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), determinant), _mm_cmpneq_ps(determinant, _mm_setzero_ps()));
+
+	auto combine = [&](__m128 x, __m128 p, __m128 y, __m128 q, __m128 z, __m128 r) {
+		return _mm_mul_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(x, p), _mm_mul_ps(y, q)), _mm_mul_ps(z, r)), inverse_determinant);
+	};
+	__m128 zero = _mm_setzero_ps();
+	auto negate = [&](__m128 x) { return _mm_sub_ps(zero, x); };
+
+	// inverse element (i, j) ends up at (j, i)
+	b[0][0] = combine(a[1][1], c5, a[1][2], c4, a[1][3], c3);
+	b[1][0] = negate(combine(a[0][1], c5, a[0][2], c4, a[0][3], c3));
+	b[2][0] = combine(a[3][1], s5, a[3][2], s4, a[3][3], s3);
+	b[3][0] = negate(combine(a[2][1], s5, a[2][2], s4, a[2][3], s3));
+	b[0][1] = negate(combine(a[1][0], c5, a[1][2], c2, a[1][3], c1));
+	b[1][1] = combine(a[0][0], c5, a[0][2], c2, a[0][3], c1);
+	b[2][1] = negate(combine(a[3][0], s5, a[3][2], s2, a[3][3], s1));
+	b[3][1] = combine(a[2][0], s5, a[2][2], s2, a[2][3], s1);
+	b[0][2] = combine(a[1][0], c4, a[1][1], c2, a[1][3], c0);
+	b[1][2] = negate(combine(a[0][0], c4, a[0][1], c2, a[0][3], c0));
+	b[2][2] = combine(a[3][0], s4, a[3][1], s2, a[3][3], s0);
+	b[3][2] = negate(combine(a[2][0], s4, a[2][1], s2, a[2][3], s0));
+	b[0][3] = negate(combine(a[1][0], c3, a[1][1], c1, a[1][2], c0));
+	b[1][3] = combine(a[0][0], c3, a[0][1], c1, a[0][2], c0);
+	b[2][3] = negate(combine(a[3][0], s3, a[3][1], s1, a[3][2], s0));
+	b[3][3] = combine(a[2][0], s3, a[2][1], s1, a[2][2], s0);
+}
+
+void ComputeNormalMatrices(const glm::mat4* transforms, const uint32_t* indices, size_t count, glm::mat4* normal_matrices)
+{
+	for (size_t i = 0; i < count; i += 4) {
+		// the last batch repeats its last matrix, those lanes are not stored
+		size_t lanes = std::min<size_t>(count - i, 4);
+		const float* source[4];
+		for (size_t lane = 0; lane < 4; lane++) {
+			source[lane] = reinterpret_cast<const float*>(&transforms[indices[i + std::min(lane, lanes - 1)]]);
+		}
+
+		__m128 a[4][4];
+		for (int column = 0; column < 4; column++) {
+			a[column][0] = _mm_loadu_ps(source[0] + column * 4);
+			a[column][1] = _mm_loadu_ps(source[1] + column * 4);
+			a[column][2] = _mm_loadu_ps(source[2] + column * 4);
+			a[column][3] = _mm_loadu_ps(source[3] + column * 4);
+			_MM_TRANSPOSE4_PS(a[column][0], a[column][1], a[column][2], a[column][3]);
+		}
+
+		__m128 b[4][4];
+		InverseTranspose(a, b);
+
+		float result[4][16];
+		for (int column = 0; column < 4; column++) {
+			_MM_TRANSPOSE4_PS(b[column][0], b[column][1], b[column][2], b[column][3]);
+			for (int lane = 0; lane < 4; lane++) {
+				_mm_storeu_ps(result[lane] + column * 4, b[column][lane]);
+			}
+		}
+
+		for (size_t lane = 0; lane < lanes; lane++) {
+			std::copy(result[lane], result[lane] + 16, reinterpret_cast<float*>(&normal_matrices[i + lane]));
+		}
+	}
+}
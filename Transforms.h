@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// dirty entries closer than this are uploaded as one range, a few clean matrices are cheaper than another call
+#define TRANSFORM_RANGE_MERGE_GAP 8
+
+// the per instance matrices exactly as the vertex shaders read them from the instance buffer
+struct alignas(16) InstanceMatrices {
+	glm::mat4 model;
+	glm::mat4 normal_matrix;
+};
+
+struct TransformRange {
+	uint32_t first;
+	uint32_t count;
+};
+
+/**
+* world transforms of the scene instances and the matrices derived from them, stored contiguously in instance order
+* so matrices can be uploaded as is. Set only records the new transform, Update recomputes the entries changed since
+* the last call (normal matrices four at a time with sse) and collects the ranges that need to be uploaded.
+* when nothing changed Update returns immediately, static scenes spend no time on matrices
+*/
+struct TransformSystem {
+	std::vector<glm::mat4> transforms; // local to world
+	std::vector<glm::mat4> model_offsets; // applied before the transform, e.g. position dequantization
+	std::vector<InstanceMatrices> matrices;
+	std::vector<TransformRange> changed_ranges; // of the last Update, ascending
+	std::vector<uint32_t> changed; // of the last Update, ascending
+
+	size_t Size() const { return transforms.size(); }
+	void Reserve(size_t count);
+	void Clear();
+
+	// appends an instance, its matrices are computed by the next Update
+	uint32_t Add(const glm::mat4& transform, const glm::mat4& model_offset);
+
+	void Set(uint32_t index, const glm::mat4& transform);
+	const glm::mat4& Get(uint32_t index) const { return transforms[index]; }
+
+	/**
+	* recomputes the matrices of every entry set since the last call
+	* @returns false if nothing changed, changed and changed_ranges are empty then
+	*/
+	bool Update();
+
+private:
+	std::vector<uint8_t> dirty;
+	std::vector<uint32_t> dirty_list;
+};
+
+/**
+* writes transpose(inverse(transforms[indices[i]])) to normal_matrices[i], four matrices per iteration with sse.
+* singular transforms produce a zero matrix
+*/
+void ComputeNormalMatrices(const glm::mat4* transforms, const uint32_t* indices, size_t count, glm::mat4* normal_matrices);
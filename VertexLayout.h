@@ -0,0 +1,312 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <meshoptimizer.h>
+
+// vertex layouts are described by one encoding per attribute. the C++ encoder/decoder and the GLSL
+// struct + unpack functions are both generated from the same descriptor, so switching MeshVertexLayout
+// in Model.h is the only edit needed to try a different layout.
+// vertices are stored as plain 32 bit words, every attribute starts on a word boundary so the shaders
+// can unpack them with the core unpack* builtins and don't need any 8/16 bit storage extension.
+
+enum class PositionFormat : uint8_t {
+	Float,   // 3 words
+	Half,    // 2 words, x|y and z|unused
+	Unorm16, // 2 words, x|y and z|unused relative to the mesh bounds, see PositionDequantization
+};
+
+// normal + tangent, the shaders get the bitangent as cross(N, T.xyz) * T.w
+enum class TangentFrameFormat : uint8_t {
+	Float,        // 7 words
+	Unorm8,       // 2 words, xyzw * 127 + 127 per byte
+	Octahedral8,  // 1 word, octahedral normal and tangent as 2x snorm8 each
+	Octahedral16, // 2 words, octahedral normal and tangent as 2x snorm16 each
+};
+
+enum class UvFormat : uint8_t {
+	Float, // 2 words
+	Half,  // 1 word
+};
+
+constexpr uint32_t PositionWords(PositionFormat format)
+{
+	return format == PositionFormat::Float ? 3 : 2;
+}
+
+constexpr uint32_t TangentFrameWords(TangentFrameFormat format)
+{
+	switch (format) {
+	case TangentFrameFormat::Float: return 7;
+	case TangentFrameFormat::Unorm8: return 2;
+	case TangentFrameFormat::Octahedral8: return 1;
+	default: return 2;
+	}
+}
+
+constexpr uint32_t UvWords(UvFormat format)
+{
+	return format == UvFormat::Float ? 2 : 1;
+}
+
+inline uint32_t PackFloat(float value)
+{
+	uint32_t word;
+	memcpy(&word, &value, sizeof(word));
+	return word;
+}
+
+inline float UnpackFloat(uint32_t word)
+{
+	float value;
+	memcpy(&value, &word, sizeof(value));
+	return value;
+}
+
+inline uint32_t PackHalf2(float x, float y)
+{
+	return uint32_t(meshopt_quantizeHalf(x)) | uint32_t(meshopt_quantizeHalf(y)) << 16;
+}
+
+inline uint32_t PackUnorm8(float value)
+{
+	return uint32_t(uint8_t(value * 127.f + 127.5f));
+}
+
+inline uint32_t PackSnorm8(float value)
+{
+	return uint32_t(meshopt_quantizeSnorm(value, 8)) & 0xff;
+}
+
+inline uint32_t PackSnorm16(float value)
+{
+	return uint32_t(meshopt_quantizeSnorm(value, 16)) & 0xffff;
+}
+
+inline uint32_t PackUnorm16(float value)
+{
+	return uint32_t(meshopt_quantizeUnorm(std::clamp(value, 0.0f, 1.0f), 16));
+}
+
+// octahedral tangents keep the handedness in the lowest bit of their last snorm component,
+// set means mirrored. costs one bit of precision on that component only
+inline uint32_t WithHandedness(uint32_t snorm, float handedness)
+{
+	return (snorm & ~1u) | (handedness < 0.0f ? 1u : 0u);
+}
+
+// maps a unit vector onto the [-1, 1] square, the lower hemisphere is folded over the diagonals
+inline glm::vec2 OctahedralEncode(const glm::vec3& v)
+{
+	glm::vec3 n = v / (fabsf(v.x) + fabsf(v.y) + fabsf(v.z));
+	if (n.z < 0.0f) {
+		return {
+			(1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+			(1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f),
+		};
+	}
+	return { n.x, n.y };
+}
+
+template<PositionFormat P, TangentFrameFormat T, UvFormat U>
+struct VertexLayout
+{
+	static constexpr PositionFormat position_format = P;
+	static constexpr TangentFrameFormat tangent_frame_format = T;
+	static constexpr UvFormat uv_format = U;
+
+	static constexpr uint32_t position_offset = 0;
+	static constexpr uint32_t tangent_frame_offset = position_offset + PositionWords(P);
+	static constexpr uint32_t uv_offset = tangent_frame_offset + TangentFrameWords(T);
+	static constexpr uint32_t word_count = uv_offset + UvWords(U);
+
+	// stored in the mesh cache key, changes whenever any attribute encoding changes
+	static constexpr uint32_t id = uint32_t(P) | uint32_t(T) << 8 | uint32_t(U) << 16;
+
+	struct Vertex {
+		uint32_t words[word_count];
+	};
+
+	/**
+	* model space transform from the stored positions to mesh space, identity unless positions are
+	* quantized relative to the bounds. fold it into the model matrix but not into the normal matrix
+	*/
+	static glm::mat4 PositionDequantization(const glm::vec3& bounds_min, const glm::vec3& bounds_max)
+	{
+		glm::mat4 dequantization(1.0f);
+		if constexpr (P == PositionFormat::Unorm16) {
+			glm::vec3 extent = bounds_max - bounds_min;
+			dequantization[0][0] = extent.x;
+			dequantization[1][1] = extent.y;
+			dequantization[2][2] = extent.z;
+			dequantization[3] = glm::vec4(bounds_min, 1.0f);
+		}
+		return dequantization;
+	}
+
+	/**
+	* @param bounds_min, bounds_max mesh bounds, every position has to be inside of them
+	* @param tangent xyz tangent with the bitangent handedness (+1/-1) in w
+	*/
+	static void Encode(Vertex& vertex, const glm::vec3& bounds_min, const glm::vec3& bounds_max,
+		const glm::vec3& position, const glm::vec3& normal, const glm::vec4& tangent, const glm::vec2& uv)
+	{
+		uint32_t* p = vertex.words + position_offset;
+		if constexpr (P == PositionFormat::Float) {
+			p[0] = PackFloat(position.x);
+			p[1] = PackFloat(position.y);
+			p[2] = PackFloat(position.z);
+		}
+		else if constexpr (P == PositionFormat::Half) {
+			p[0] = PackHalf2(position.x, position.y);
+			p[1] = PackHalf2(position.z, 1.0f);
+		}
+		else {
+			glm::vec3 extent = bounds_max - bounds_min;
+			glm::vec3 q = (position - bounds_min) / glm::max(extent, glm::vec3(FLT_MIN));
+			p[0] = PackUnorm16(q.x) | PackUnorm16(q.y) << 16;
+			p[1] = PackUnorm16(q.z);
+		}
+
+		float handedness = tangent.w < 0.0f ? -1.0f : 1.0f;
+		glm::vec3 t = glm::vec3(tangent);
+
+		// degenerate frames (no uvs) still need a valid direction for the octahedral encodings
+		glm::vec2 n_oct = OctahedralEncode(glm::dot(normal, normal) > 0.0f ? normal : glm::vec3(0.0f, 0.0f, 1.0f));
+		glm::vec2 t_oct = OctahedralEncode(glm::dot(t, t) > 0.0f ? t : glm::vec3(1.0f, 0.0f, 0.0f));
+
+		uint32_t* f = vertex.words + tangent_frame_offset;
+		if constexpr (T == TangentFrameFormat::Float) {
+			f[0] = PackFloat(normal.x);
+			f[1] = PackFloat(normal.y);
+			f[2] = PackFloat(normal.z);
+			f[3] = PackFloat(t.x);
+			f[4] = PackFloat(t.y);
+			f[5] = PackFloat(t.z);
+			f[6] = PackFloat(handedness);
+		}
+		else if constexpr (T == TangentFrameFormat::Unorm8) {
+			f[0] = PackUnorm8(normal.x) | PackUnorm8(normal.y) << 8 | PackUnorm8(normal.z) << 16 | PackUnorm8(1.0f) << 24;
+			f[1] = PackUnorm8(t.x) | PackUnorm8(t.y) << 8 | PackUnorm8(t.z) << 16 | PackUnorm8(handedness) << 24;
+		}
+		else if constexpr (T == TangentFrameFormat::Octahedral8) {
+			f[0] = PackSnorm8(n_oct.x) | PackSnorm8(n_oct.y) << 8 | PackSnorm8(t_oct.x) << 16 | WithHandedness(PackSnorm8(t_oct.y), handedness) << 24;
+		}
+		else {
+			f[0] = PackSnorm16(n_oct.x) | PackSnorm16(n_oct.y) << 16;
+			f[1] = PackSnorm16(t_oct.x) | WithHandedness(PackSnorm16(t_oct.y), handedness) << 16;
+		}
+
+		uint32_t* u = vertex.words + uv_offset;
+		if constexpr (U == UvFormat::Float) {
+			u[0] = PackFloat(uv.x);
+			u[1] = PackFloat(uv.y);
+		}
+		else {
+			u[0] = PackHalf2(uv.x, uv.y);
+		}
+	}
+
+	/**
+	* @returns the mesh space position, the bounds have to be the ones the vertex was encoded with
+	*/
+	static glm::vec3 DecodePosition(const Vertex& vertex, const glm::vec3& bounds_min, const glm::vec3& bounds_max)
+	{
+		const uint32_t* p = vertex.words + position_offset;
+		if constexpr (P == PositionFormat::Float) {
+			return { UnpackFloat(p[0]), UnpackFloat(p[1]), UnpackFloat(p[2]) };
+		}
+		else if constexpr (P == PositionFormat::Half) {
+			return {
+				glm::unpackHalf1x16(uint16_t(p[0])),
+				glm::unpackHalf1x16(uint16_t(p[0] >> 16)),
+				glm::unpackHalf1x16(uint16_t(p[1])),
+			};
+		}
+		else {
+			glm::vec3 q = {
+				glm::unpackUnorm1x16(uint16_t(p[0])),
+				glm::unpackUnorm1x16(uint16_t(p[0] >> 16)),
+				glm::unpackUnorm1x16(uint16_t(p[1])),
+			};
+			return bounds_min + q * (bounds_max - bounds_min);
+		}
+	}
+
+	/**
+	* GLSL for `struct Vertex` and the vertex_position/vertex_normal/vertex_tangent/vertex_uv(Vertex)
+	* functions matching this layout, injected into shaders in place of `#pragma vertex_layout`.
+	* vertex_position returns the stored position, apply PositionDequantization through the model matrix
+	*/
+	static std::string Glsl()
+	{
+		std::string glsl;
+		glsl += "struct Vertex {\n    uint words[" + std::to_string(word_count) + "];\n};\n\n";
+
+		auto word = [](uint32_t index) { return "v.words[" + std::to_string(index) + "]"; };
+		auto fword = [&](uint32_t index) { return "uintBitsToFloat(" + word(index) + ")"; };
+
+		uint32_t p = position_offset;
+		if constexpr (P == PositionFormat::Float) {
+			glsl += "vec3 vertex_position(Vertex v) { return vec3(" + fword(p) + ", " + fword(p + 1) + ", " + fword(p + 2) + "); }\n";
+		}
+		else if constexpr (P == PositionFormat::Half) {
+			glsl += "vec3 vertex_position(Vertex v) { return vec3(unpackHalf2x16(" + word(p) + "), unpackHalf2x16(" + word(p + 1) + ").x); }\n";
+		}
+		else {
+			glsl += "vec3 vertex_position(Vertex v) { return vec3(unpackUnorm2x16(" + word(p) + "), unpackUnorm2x16(" + word(p + 1) + ").x); }\n";
+		}
+
+		uint32_t f = tangent_frame_offset;
+		if constexpr (T == TangentFrameFormat::Float) {
+			glsl += "vec3 vertex_normal(Vertex v) { return vec3(" + fword(f) + ", " + fword(f + 1) + ", " + fword(f + 2) + "); }\n";
+			glsl += "vec4 vertex_tangent(Vertex v) { return vec4(" + fword(f + 3) + ", " + fword(f + 4) + ", " + fword(f + 5) + ", " + fword(f + 6) + "); }\n";
+		}
+		else if constexpr (T == TangentFrameFormat::Unorm8) {
+			glsl += "vec3 vertex_normal(Vertex v) { return unpackUnorm4x8(" + word(f) + ").xyz * (255.0 / 127.0) - 1.0; }\n";
+			glsl += "vec4 vertex_tangent(Vertex v) { vec4 t = unpackUnorm4x8(" + word(f + 1) + ") * (255.0 / 127.0) - 1.0; return vec4(t.xyz, t.w < 0.0 ? -1.0 : 1.0); }\n";
+		}
+		else {
+			glsl +=
+				"vec3 octahedral_decode(vec2 e) {\n"
+				"    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+				"    float t = max(-n.z, 0.0);\n"
+				"    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);\n"
+				"    return normalize(n);\n"
+				"}\n";
+			if constexpr (T == TangentFrameFormat::Octahedral8) {
+				glsl += "vec3 vertex_normal(Vertex v) { return octahedral_decode(unpackSnorm4x8(" + word(f) + ").xy); }\n";
+				glsl += "vec4 vertex_tangent(Vertex v) { return vec4(octahedral_decode(unpackSnorm4x8(" + word(f) + ").zw), (" + word(f) + " & 0x1000000u) != 0u ? -1.0 : 1.0); }\n";
+			}
+			else {
+				glsl += "vec3 vertex_normal(Vertex v) { return octahedral_decode(unpackSnorm2x16(" + word(f) + ")); }\n";
+				glsl += "vec4 vertex_tangent(Vertex v) { return vec4(octahedral_decode(unpackSnorm2x16(" + word(f + 1) + ")), (" + word(f + 1) + " & 0x10000u) != 0u ? -1.0 : 1.0); }\n";
+			}
+		}
+
+		uint32_t u = uv_offset;
+		if constexpr (U == UvFormat::Float) {
+			glsl += "vec2 vertex_uv(Vertex v) { return vec2(" + fword(u) + ", " + fword(u + 1) + "); }\n";
+		}
+		else {
+			glsl += "vec2 vertex_uv(Vertex v) { return unpackHalf2x16(" + word(u) + "); }\n";
+		}
+
+		return glsl;
+	}
+};
+
+// 48 bytes, lossless reference
+using FloatVertexLayout = VertexLayout<PositionFormat::Float, TangentFrameFormat::Float, UvFormat::Float>;
+// 20 bytes, half positions lose precision far from the origin
+using PackedVertexLayout = VertexLayout<PositionFormat::Half, TangentFrameFormat::Unorm8, UvFormat::Half>;
+// 20 bytes, bounds relative positions and 16 bit octahedral frames
+using QuantizedVertexLayout = VertexLayout<PositionFormat::Unorm16, TangentFrameFormat::Octahedral16, UvFormat::Half>;
+// 16 bytes, for large scenes
+using CompactVertexLayout = VertexLayout<PositionFormat::Unorm16, TangentFrameFormat::Octahedral8, UvFormat::Half>;
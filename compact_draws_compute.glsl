@@ -0,0 +1,50 @@
+#version 460 core
+
+layout(local_size_x = 64) in;
+
+struct DrawCommand {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+
+layout(std430, binding = 5) readonly buffer CommandBuffer {
+    DrawCommand commands[];
+};
+
+// per command, x is its texture group and y the first command of that group
+layout(std430, binding = 7) readonly buffer CommandGroupBuffer {
+    uvec2 command_groups[];
+};
+
+layout(std430, binding = 8) writeonly buffer DrawCommandBuffer {
+    DrawCommand draw_commands[];
+};
+
+// per texture group and phase, consumed by glMultiDrawElementsIndirectCount
+layout(std430, binding = 9) buffer DrawCountBuffer {
+    uint draw_counts[];
+};
+
+layout(location = 0) uniform uint command_count;
+layout(location = 1) uniform uint phase_command_offset;
+layout(location = 2) uniform uint phase_group_offset;
+
+// packs the commands that received instances to the front of their group's range
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= command_count) {
+        return;
+    }
+
+    DrawCommand command = commands[phase_command_offset + index];
+    if (command.instance_count == 0u) {
+        return;
+    }
+
+    uvec2 group = command_groups[index];
+    uint slot = atomicAdd(draw_counts[phase_group_offset + group.x], 1u);
+    draw_commands[phase_command_offset + group.y + slot] = command;
+}
@@ -0,0 +1,192 @@
+#version 460 core
+
+layout(local_size_x = 64) in;
+
+#define MESH_MAX_LODS 8
+
+#define CULL_PHASE_EARLY 0
+#define CULL_PHASE_LATE 1
+
+#define CULL_OCCLUSION 0x1u
+#define CULL_LOD_SELECTION 0x2u
+
+// clip space w below which a box is treated as reaching the camera
+#define NEAR_W 1e-3
+
+struct CullInstance {
+    vec3 bounds_min; // world space
+    uint object;
+    vec3 bounds_max;
+    float scale; // largest axis scale of the instance transform
+};
+
+struct CullObject {
+    float radius; // of the local bounds
+    uint lod_count;
+    uint first_command;
+    uint padding;
+    float lod_errors[MESH_MAX_LODS];
+};
+
+struct DrawCommand {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
+
+layout(std140, binding = 0) uniform PerFrame {
+    mat4 view;
+    mat4 projection;
+    vec3 camera_position;
+};
+
+// filled by the culling, every command owns a range of it starting at its base_instance
+layout(std430, binding = 2) writeonly buffer InstanceIndexBuffer {
+    uint instance_indices[];
+};
+
+layout(std430, binding = 3) readonly buffer CullInstanceBuffer {
+    CullInstance cull_instances[];
+};
+
+layout(std430, binding = 4) readonly buffer CullObjectBuffer {
+    CullObject cull_objects[];
+};
+
+// one command per object and lod and phase, instance counts start at 0 every frame
+layout(std430, binding = 5) buffer CommandBuffer {
+    DrawCommand commands[];
+};
+
+// 1 for the instances that were visible at the end of the last frame
+layout(std430, binding = 6) buffer VisibilityBuffer {
+    uint visibility[];
+};
+
+layout(binding = 0) uniform sampler2D hiz;
+
+layout(location = 0) uniform uint instance_count;
+layout(location = 1) uniform uint phase;
+layout(location = 2) uniform uint flags;
+layout(location = 3) uniform float lod_error_budget;
+layout(location = 4) uniform float viewport_height;
+layout(location = 5) uniform vec2 hiz_size;
+layout(location = 6) uniform uint phase_command_offset;
+layout(location = 7) uniform vec4 frustum_planes[6];
+
+bool frustum_visible(CullInstance instance) {
+    vec3 center = (instance.bounds_min + instance.bounds_max) * 0.5;
+    vec3 extent = (instance.bounds_max - instance.bounds_min) * 0.5;
+
+    for (int i = 0; i < 6; i++) {
+        vec4 plane = frustum_planes[i];
+        if (dot(plane.xyz, center) + plane.w + dot(abs(plane.xyz), extent) < 0.0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the nearest depth of the box against the farthest depth of the hi-z texels under its screen rectangle
+bool occluded(CullInstance instance) {
+    mat4 view_projection = projection * view;
+
+    vec2 uv_min = vec2(1.0);
+    vec2 uv_max = vec2(0.0);
+    float min_depth = 1.0;
+
+    for (int corner = 0; corner < 8; corner++) {
+        vec3 position = vec3(
+            (corner & 1) != 0 ? instance.bounds_max.x : instance.bounds_min.x,
+            (corner & 2) != 0 ? instance.bounds_max.y : instance.bounds_min.y,
+            (corner & 4) != 0 ? instance.bounds_max.z : instance.bounds_min.z);
+
+        vec4 clip = view_projection * vec4(position, 1.0);
+        if (clip.w < NEAR_W) {
+            return false;
+        }
+
+        vec3 ndc = clip.xyz / clip.w;
+        uv_min = min(uv_min, ndc.xy * 0.5 + 0.5);
+        uv_max = max(uv_max, ndc.xy * 0.5 + 0.5);
+        min_depth = min(min_depth, ndc.z * 0.5 + 0.5);
+    }
+
+    uv_min = clamp(uv_min, vec2(0.0), vec2(1.0));
+    uv_max = clamp(uv_max, vec2(0.0), vec2(1.0));
+
+    // the level where the rectangle spans at most 2x2 texels
+    vec2 size = (uv_max - uv_min) * hiz_size;
+    float level = ceil(log2(max(max(size.x, size.y), 1.0)));
+
+    float depth = textureLod(hiz, uv_min, level).r;
+    depth = max(depth, textureLod(hiz, vec2(uv_max.x, uv_min.y), level).r);
+    depth = max(depth, textureLod(hiz, vec2(uv_min.x, uv_max.y), level).r);
+    depth = max(depth, textureLod(hiz, uv_max, level).r);
+
+    return min_depth > depth;
+}
+
+// same metric as select_lod on the cpu, the coarsest lod whose error stays below the budget in pixels
+uint select_lod(CullInstance instance, CullObject object) {
+    if ((flags & CULL_LOD_SELECTION) == 0u) {
+        return 0u;
+    }
+
+    vec3 center = (instance.bounds_min + instance.bounds_max) * 0.5;
+    float radius = object.radius * instance.scale;
+
+    float distance = length(center - camera_position) - radius;
+    if (distance <= 0.0) {
+        return 0u;
+    }
+
+    float pixels_per_unit = projection[1][1] * 0.5 * viewport_height / distance;
+
+    uint lod = 0u;
+    for (uint i = 1u; i < object.lod_count; i++) {
+        if (object.lod_errors[i] * instance.scale * pixels_per_unit > lod_error_budget) {
+            break;
+        }
+        lod = i;
+    }
+    return lod;
+}
+
+// the early phase draws what was visible last frame, the depth it leaves behind becomes the hi-z pyramid.
+// the late phase tests everything against it, draws what became visible and records visibility for the next frame
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= instance_count) {
+        return;
+    }
+
+    CullInstance instance = cull_instances[index];
+    bool visible = frustum_visible(instance);
+
+    if (phase == CULL_PHASE_EARLY) {
+        if (!visible || visibility[index] == 0u) {
+            return;
+        }
+    }
+    else {
+        if (visible && (flags & CULL_OCCLUSION) != 0u) {
+            visible = !occluded(instance);
+        }
+
+        bool drawn = visibility[index] != 0u;
+        visibility[index] = visible ? 1u : 0u;
+
+        if (!visible || drawn) {
+            return;
+        }
+    }
+
+    CullObject object = cull_objects[instance.object];
+    uint command = phase_command_offset + object.first_command + select_lod(instance, object);
+
+    uint slot = atomicAdd(commands[command].instance_count, 1u);
+    instance_indices[commands[command].base_instance + slot] = index;
+}
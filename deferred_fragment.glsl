@@ -1,5 +1,7 @@
 #version 460 core
 
+#pragma material_textures
+
 layout(location = 0) out vec4 final_positions;
 layout(location = 1) out vec4 final_color;
 layout(location = 2) out vec4 final_normal;
@@ -10,6 +12,7 @@ layout(location = 0) in vec3 world_pos;
 layout(location = 1) in vec3 view_pos_tbn;
 layout(location = 2) in vec2 uv;
 layout(location = 3) in mat3 tbn;
+layout(location = 6) flat in uint material_index;
 
 layout(std140, binding = 0) uniform PerFrame {
     mat4 view;
@@ -22,16 +25,27 @@ layout(std140, binding = 0) uniform PerFrame {
 #define NORMAL_MAP_INDEX 2
 #define EMISSIVE_MAP_INDEX 3
 
-layout(binding = BASE_COLOR_MAP_INDEX) uniform sampler2D base_color_map;
-layout(binding = NORMAL_MAP_INDEX) uniform sampler2D normal_map;
-layout(binding = OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX) uniform sampler2D orm_map;
-layout(binding = EMISSIVE_MAP_INDEX) uniform sampler2D emissive_map;
+// factors of the deduplicated materials, multiplied onto the texture samples. textures are bindless handles
+// or (array, layer), whatever sample_material_texture expects
+struct Material {
+    vec4 base_color;
+    vec4 emissive_color;
+    vec4 specular_color;
+    uvec2 textures[4];
+};
+
+layout(std430, binding = 10) readonly buffer MaterialBuffer {
+    Material materials[];
+};
 
 void main() {
-    vec4 base_color_sample = texture(base_color_map, uv);
-    vec3 normal_sample = texture(normal_map, uv).rgb * 2.0 - 1.0;
-    vec4 orm_sample = texture(orm_map, uv);
-    vec3 emissive_sample = texture(emissive_map, uv).rgb;
+    Material material = materials[material_index];
+    vec4 base_color_sample = sample_material_texture(material.textures[BASE_COLOR_MAP_INDEX], uv) * material.base_color;
+    // baked normal maps only keep x and y (BC5), z follows from the unit length
+    vec2 normal_xy = sample_material_texture(material.textures[NORMAL_MAP_INDEX], uv).rg * 2.0 - 1.0;
+    vec3 normal_sample = vec3(normal_xy, sqrt(max(1.0 - dot(normal_xy, normal_xy), 0.0)));
+    vec4 orm_sample = sample_material_texture(material.textures[OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX], uv);
+    vec3 emissive_sample = sample_material_texture(material.textures[EMISSIVE_MAP_INDEX], uv).rgb * material.emissive_color.rgb;
 
 	final_positions = vec4(world_pos, 1.0);
 	final_color = base_color_sample;
@@ -0,0 +1,33 @@
+#version 460 core
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// the previous level, or the depth buffer for level 0
+layout(binding = 0) uniform sampler2D source;
+layout(r32f, binding = 0) writeonly uniform image2D destination;
+
+layout(location = 0) uniform int source_level;
+layout(location = 1) uniform ivec2 source_size;
+layout(location = 2) uniform ivec2 destination_size;
+
+// every texel keeps the farthest depth of the source texels it covers. level 0 is the power of two below
+// the depth buffer size, so it covers up to 3x3 depth texels and every later level exactly 2x2
+void main() {
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    if (texel.x >= destination_size.x || texel.y >= destination_size.y) {
+        return;
+    }
+
+    ivec2 first = (texel * source_size) / destination_size;
+    ivec2 last = ((texel + 1) * source_size + destination_size - 1) / destination_size - 1;
+    last = min(last, source_size - 1);
+
+    float depth = 0.0;
+    for (int y = first.y; y <= last.y; y++) {
+        for (int x = first.x; x <= last.x; x++) {
+            depth = max(depth, texelFetch(source, ivec2(x, y), source_level).r);
+        }
+    }
+
+    imageStore(destination, texel, vec4(depth));
+}
@@ -1,4 +1,7 @@
 #define _CRT_SECURE_NO_WARNINGS
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
 #include <cmath>
 #include <cstdint>
 #include <fstream>
@@ -7,6 +10,9 @@
 #include <glm/gtc/quaternion.hpp>
 #include <glm/matrix.hpp>
 #include <iostream>
+#include <numeric>
+#include <random>
+#include <cstring>
 #include <vector>
 #include <unordered_map>
 
@@ -21,6 +27,11 @@
 #include "stb_image.h"
 
 #include "Model.h"
+#include "Culling.h"
+#include "Bvh.h"
+#include "OcclusionCulling.h"
+#include "Transforms.h"
+#include "RenderQueue.h"
 
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
@@ -57,12 +68,66 @@ std::vector<char> read_file(const std::string& filename) {
 	fseek(file, 0, SEEK_END);
 	auto size = ftell(file);
 	fseek(file, 0, SEEK_SET);
-	std::vector<char> buffer(size);
-	fread(buffer.data(), 1, size, file);
+	std::vector<char> buffer(size + 1);
+	// text mode can read fewer bytes than ftell reports, terminate after what was actually read
+	auto read = fread(buffer.data(), 1, size, file);
+	buffer.resize(read + 1);
+	buffer[read] = 0;
 	fclose(file);
 	return buffer;
 }
 
+// without ARB_bindless_texture material textures are copied into texture arrays bound from this unit on
+#define MATERIAL_MAX_TEXTURE_ARRAYS 16
+#define MATERIAL_TEXTURE_ARRAY_UNIT 16
+
+bool g_bindless_textures = false;
+
+// sample_material_texture(uvec2 texture, vec2 uv) for the material texture slots, either through bindless handles
+// or by (array, layer). the array is picked with a switch since the material differs between the draws of a multi-draw
+std::string material_textures_glsl() {
+	std::string glsl;
+	if (g_bindless_textures) {
+		glsl += "#extension GL_ARB_bindless_texture : require\n";
+		glsl += "vec4 sample_material_texture(uvec2 handle, vec2 uv) {\n";
+		glsl += "    return texture(sampler2D(handle), uv);\n";
+		glsl += "}\n";
+		return glsl;
+	}
+
+	glsl += "layout(binding = " + std::to_string(MATERIAL_TEXTURE_ARRAY_UNIT) + ") uniform sampler2DArray material_texture_arrays[" + std::to_string(MATERIAL_MAX_TEXTURE_ARRAYS) + "];\n";
+	glsl += "vec4 sample_material_texture(uvec2 location, vec2 uv) {\n";
+	glsl += "    switch (location.x) {\n";
+	for (int array = 0; array < MATERIAL_MAX_TEXTURE_ARRAYS; array++) {
+		glsl += "    case " + std::to_string(array) + ": return texture(material_texture_arrays[" + std::to_string(array) + "], vec3(uv, float(location.y)));\n";
+	}
+	glsl += "    }\n";
+	glsl += "    return vec4(0.0);\n";
+	glsl += "}\n";
+	return glsl;
+}
+
+// reads a shader and replaces the `#pragma vertex_layout` line with the GLSL generated for MeshVertexLayout
+// and `#pragma material_textures` with material_textures_glsl()
+std::string read_shader_source(const std::string& filename) {
+	auto buffer = read_file(filename);
+	std::string source = buffer.data();
+
+	const std::pair<std::string, std::string> directives[] = {
+		{ "#pragma vertex_layout", MeshVertexLayout::Glsl() },
+		{ "#pragma material_textures", material_textures_glsl() },
+	};
+
+	for (const auto& [directive, glsl] : directives) {
+		auto position = source.find(directive);
+		if (position != std::string::npos) {
+			source.replace(position, directive.size(), glsl);
+		}
+	}
+
+	return source;
+}
+
 struct alignas(16) Vertex {
 	glm::vec4 position;
 	glm::vec4 normal;
@@ -108,22 +173,8 @@ void create_sphere(std::vector<MeshVertex>& vertices,
 			ty = 0;
 			tz = 0;
 
-			MeshVertex vertex = {
-				.x = meshopt_quantizeHalf(x),
-				.y = meshopt_quantizeHalf(y),
-				.z = meshopt_quantizeHalf(z),
-				.w = meshopt_quantizeHalf(1),
-				.nx = uint8_t(nx * 127.f + 127.5f),
-				.ny = uint8_t(ny * 127.f + 127.5f),
-				.nz = uint8_t(nz * 127.f + 127.5f),
-				.nw = uint8_t(1 * 127.f + 127.5f),
-				.tx = uint8_t(tx * 127.f + 127.5f),
-				.ty = uint8_t(ty * 127.f + 127.5f),
-				.tz = uint8_t(tz * 127.f + 127.5f),
-				.tw = uint8_t(1 * 127.f + 127.5f),
-				.u = meshopt_quantizeHalf(s),
-				.v = meshopt_quantizeHalf(t)
-			};
+			MeshVertex vertex;
+			EncodeVertex(vertex, { glm::vec3(-radius), glm::vec3(radius) }, glm::vec3(x, y, z), glm::vec3(nx, ny, nz), glm::vec4(tx, ty, tz, 1.0f), glm::vec2(s, t));
 			vertices.push_back(vertex);
 		}
 	}
@@ -183,71 +234,330 @@ void free_image(Image image) {
 }
 
 struct GPUObject {
-	ogl::Buffer vertex_buffer;
-	ogl::Buffer index_buffer;
-	ogl::Texture2D* textures[4];
-	glm::mat4 transform;
-	glm::vec4 base_color;
-	glm::vec4 emissive_color;
-	glm::vec4 specular_color;
+	uint32_t base_vertex; // into the scene vertex buffer
+	uint32_t first_index; // into the scene index buffer, lod index offsets are relative to it
+	ogl::Buffer meshlet_buffer;
+	ogl::Buffer meshlet_vertex_buffer;
+	ogl::Buffer meshlet_triangle_buffer;
+	uint32_t meshlet_count;
+	uint32_t first_instance; // into the instance buffer, the instances of an object are contiguous
+	uint32_t instance_count;
+	glm::mat4 position_dequantization;
+	uint32_t material; // into the scene material buffer
 	AABB bounds;
 	uint32_t indices_count;
-	bool index_buffer_short;
+	MeshLod lods[MESH_MAX_LODS];
+	uint32_t lod_count;
+	// culling results of the current frame, the range of the visible instance list owned by this object
+	uint32_t visible_first;
+	uint32_t visible_count;
 	bool visible;
 };
 
+// every mesh of the scene suballocated into one vertex and one index buffer,
+// so the whole scene is drawn from the same bindings
+struct GPUScene {
+	ogl::Buffer vertex_buffer;
+	ogl::Buffer index_buffer;
+	ogl::Buffer instance_buffer; // InstanceMatrices, read by the vertex shaders through the per frame instance index list
+	std::vector<GPUObject> objects;
+	uint32_t instance_count;
+	TransformSystem transforms; // in instance buffer order
+	ogl::Buffer instance_material_buffer; // material index per instance, so a draw needs nothing but its instance range
+	CullingBounds instance_bounds; // world space, in instance buffer order
+	std::vector<AABB> instance_world_bounds; // the same boxes for the bvh
+	std::vector<uint32_t> instance_objects;
+	Bvh bvh; // over instance_world_bounds
+	std::vector<OccluderMesh> occluders; // per object, the coarsest lod in local space
+};
 
-std::vector<GPUObject> load_model(Model& model) {
+// keeps the coarsest lod of mesh on the cpu, only the vertices it references
+OccluderMesh create_occluder(const Mesh& mesh) {
+	OccluderMesh occluder;
+	if (mesh.lods.empty()) {
+		return occluder;
+	}
+
+	// lods are ordered from fine to coarse with growing error, the full mesh is always within the limit
+	float max_error = glm::length(mesh.bounds.max - mesh.bounds.min) * OCCLUDER_MAX_LOD_ERROR;
+	const MeshLod* lod = &mesh.lods[0];
+	for (const auto& candidate : mesh.lods) {
+		if (candidate.error <= max_error) {
+			lod = &candidate;
+		}
+	}
+
+	std::vector<uint32_t> remap(mesh.vertices.size(), UINT32_MAX);
+	occluder.indices.reserve(lod->index_count);
+
+	for (uint32_t i = lod->index_offset; i < lod->index_offset + lod->index_count; i++) {
+		uint32_t index = mesh.indices[i];
+		if (remap[index] == UINT32_MAX) {
+			remap[index] = uint32_t(occluder.positions.size());
+			occluder.positions.push_back(DecodePosition(mesh.vertices[index], mesh.bounds));
+		}
+		occluder.indices.push_back(remap[index]);
+	}
+
+	return occluder;
+}
+
+GPUScene load_model(Model& model) {
 
-	std::vector<GPUObject> gpu_objects(model.meshes.size());
+	GPUScene scene = {};
+	scene.objects.resize(model.meshes.size());
+	scene.occluders.resize(model.meshes.size());
+
+	size_t vertex_count = 0;
+	size_t index_count = 0;
+	for (const auto& mesh : model.meshes)
+	{
+		vertex_count += mesh.vertices.size();
+		index_count += mesh.indices.size();
+	}
+
+	std::vector<MeshVertex> vertices;
+	std::vector<uint32_t> indices;
+	vertices.reserve(vertex_count);
+	indices.reserve(index_count);
 
 	for (int i = 0; i < model.meshes.size(); i++)
 	{
 
 		GPUObject gpu_object;
 
-		gpu_object.vertex_buffer = ogl::create_buffer(model.meshes[i].vertices.data(), model.meshes[i].vertices.size() * sizeof(MeshVertex), false);
-		if (model.meshes[i].indices.size() > std::numeric_limits<uint16_t>::max())
+		// indices stay relative to the mesh, base_vertex is applied by the draw
+		gpu_object.base_vertex = uint32_t(vertices.size());
+		gpu_object.first_index = uint32_t(indices.size());
+		vertices.insert(vertices.end(), model.meshes[i].vertices.begin(), model.meshes[i].vertices.end());
+		indices.insert(indices.end(), model.meshes[i].indices.begin(), model.meshes[i].indices.end());
+
+		gpu_object.indices_count = uint32_t(model.meshes[i].indices.size());
+
+		// all lods live in the same index buffer
+		scene.occluders[i] = create_occluder(model.meshes[i]);
+
+		gpu_object.lod_count = uint32_t(std::min<size_t>(model.meshes[i].lods.size(), MESH_MAX_LODS));
+		for (uint32_t j = 0; j < gpu_object.lod_count; j++)
 		{
-			gpu_object.index_buffer = ogl::create_buffer(model.meshes[i].indices.data(), model.meshes[i].indices.size() * sizeof(uint32_t), false);
-			gpu_object.index_buffer_short = false;
+			gpu_object.lods[j] = model.meshes[i].lods[j];
 		}
-		else {
-			std::vector<uint16_t> indices16(model.meshes[i].indices.size());
-			for (int j = 0; j < model.meshes[i].indices.size(); j++)
-			{
-				indices16[j] = model.meshes[i].indices[j];
-			}
-			gpu_object.index_buffer = ogl::create_buffer(indices16.data(), indices16.size() * sizeof(uint16_t), false);
-			gpu_object.index_buffer_short = true;
+
+		// meshlets are only built when the model was loaded with MODEL_IMPORT_MESHLETS
+		gpu_object.meshlet_count = uint32_t(model.meshes[i].meshlets.size());
+		gpu_object.meshlet_buffer = {};
+		gpu_object.meshlet_vertex_buffer = {};
+		gpu_object.meshlet_triangle_buffer = {};
+		if (gpu_object.meshlet_count > 0)
+		{
+			gpu_object.meshlet_buffer = ogl::create_buffer(model.meshes[i].meshlets.data(), model.meshes[i].meshlets.size() * sizeof(Meshlet), false);
+			gpu_object.meshlet_vertex_buffer = ogl::create_buffer(model.meshes[i].meshlet_vertices.data(), model.meshes[i].meshlet_vertices.size() * sizeof(uint32_t), false);
+			gpu_object.meshlet_triangle_buffer = ogl::create_buffer(model.meshes[i].meshlet_triangles.data(), model.meshes[i].meshlet_triangles.size(), false);
 		}
 
-		gpu_object.indices_count = uint32_t(model.meshes[i].indices.size());
+		gpu_object.position_dequantization = PositionDequantization(model.meshes[i].bounds);
+		gpu_object.material = model.meshes[i].material;
+		gpu_object.bounds = model.meshes[i].bounds;
+		gpu_object.visible_first = 0;
+		gpu_object.visible_count = 0;
+		gpu_object.visible = true;
 
-		for (int j = 0; j < _countof(model.meshes[i].textures); j++)
+		scene.objects[i] = gpu_object;
+	}
+
+	scene.vertex_buffer = ogl::create_buffer(vertices.data(), std::max<size_t>(vertices.size(), 1) * sizeof(MeshVertex), false);
+	scene.index_buffer = ogl::create_buffer(indices.data(), std::max<size_t>(indices.size(), 1) * sizeof(uint32_t), false);
+
+	// one set of geometry per unique mesh, the scene nodes using it only add a transform
+	std::vector<std::vector<glm::mat4>> object_transforms(scene.objects.size());
+	for (const auto& instance : model.instances)
+	{
+		object_transforms[instance.mesh].push_back(instance.transform);
+	}
+
+	scene.transforms.Reserve(model.instances.size());
+	scene.instance_bounds.Reserve(model.instances.size());
+
+	for (auto& gpu_object : scene.objects)
+	{
+		gpu_object.first_instance = uint32_t(scene.transforms.Size());
+		gpu_object.instance_count = 0;
+
+		for (const auto& transform : object_transforms[&gpu_object - scene.objects.data()])
 		{
-			if (model.meshes[i].textures[j] != nullptr)
-			{
-				gpu_object.textures[j] = model.meshes[i].textures[j];
+			scene.transforms.Add(transform, gpu_object.position_dequantization);
+			gpu_object.instance_count++;
+
+			AABB world_bounds = TransformBounds(gpu_object.bounds, transform);
+			scene.instance_bounds.Add(world_bounds.min, world_bounds.max);
+			scene.instance_world_bounds.push_back(world_bounds);
+			scene.instance_objects.push_back(uint32_t(&gpu_object - scene.objects.data()));
+		}
+	}
+
+	scene.instance_count = uint32_t(scene.transforms.Size());
+	scene.bvh.Build(scene.instance_world_bounds.data(), scene.instance_world_bounds.size());
+
+	// computes every matrix once, after that only instances whose transform is set again are touched
+	scene.transforms.Update();
+	scene.instance_buffer = ogl::create_buffer(scene.transforms.matrices.data(), std::max<size_t>(scene.instance_count, 1) * sizeof(InstanceMatrices), true);
+
+	// uploaded once, materials never change after import
+	std::vector<uint32_t> instance_materials(std::max<size_t>(scene.instance_count, 1), 0);
+	for (uint32_t instance = 0; instance < scene.instance_count; instance++) {
+		instance_materials[instance] = scene.objects[scene.instance_objects[instance]].material;
+	}
+	scene.instance_material_buffer = ogl::create_buffer(instance_materials.data(), instance_materials.size() * sizeof(uint32_t), false);
+
+	return scene;
+}
+
+// a material as the fragment shaders read it. every texture slot is either a bindless handle split into two words or,
+// without ARB_bindless_texture, (array, layer) in the fallback texture arrays. empty slots point at default textures
+struct alignas(16) GPUMaterial {
+	glm::vec4 base_color;
+	glm::vec4 emissive_color;
+	glm::vec4 specular_color;
+	glm::uvec2 textures[4];
+};
+
+struct MaterialTable {
+	ogl::Buffer material_buffer;
+	std::vector<ogl::Texture2DArray> texture_arrays; // only without bindless textures
+};
+
+// uploads the materials of model with every texture slot resolved. with bindless textures every texture is made
+// resident, otherwise textures of equal size, format and mip count are copied into one texture array
+MaterialTable create_material_table(const Model& model, ogl::Texture2D* default_textures[4]) {
+	MaterialTable table = {};
+
+	// the defaults go first so they always get an array, textures that do not fit fall back to them
+	std::vector<ogl::Texture2D*> textures;
+	for (int slot = 0; slot < 4; slot++) {
+		if (std::find(textures.begin(), textures.end(), default_textures[slot]) == textures.end()) {
+			textures.push_back(default_textures[slot]);
+		}
+	}
+	uint32_t model_texture_offset = uint32_t(textures.size());
+	textures.insert(textures.end(), model.textures.begin(), model.textures.end());
+
+	// where every texture of the list ends up on the gpu, UINT32_MAX if nowhere
+	std::vector<glm::uvec2> locations(textures.size(), glm::uvec2(UINT32_MAX));
+
+	if (g_bindless_textures) {
+		for (size_t i = 0; i < textures.size(); i++) {
+			if (textures[i]->id == 0) {
+				continue;
 			}
-			else {
-				gpu_object.textures[j] = nullptr;
+			GLuint64 handle = ogl::make_texture_resident(*textures[i]);
+			locations[i] = glm::uvec2(uint32_t(handle), uint32_t(handle >> 32));
+		}
+	}
+	else {
+		std::vector<ogl::TextureDescription> descriptions;
+		std::vector<std::vector<uint32_t>> array_textures;
+
+		for (size_t i = 0; i < textures.size(); i++) {
+			if (textures[i]->id == 0) {
+				continue;
 			}
+			ogl::TextureDescription description = ogl::describe_texture(*textures[i]);
+
+			size_t array = 0;
+			while (array < descriptions.size() && (descriptions[array].width != description.width || descriptions[array].height != description.height ||
+				descriptions[array].format != description.format || descriptions[array].levels != description.levels)) {
+				array++;
+			}
+
+			if (array == descriptions.size()) {
+				if (array == MATERIAL_MAX_TEXTURE_ARRAYS) {
+					std::cerr << "More than " << MATERIAL_MAX_TEXTURE_ARRAYS << " texture arrays needed, using default textures instead" << std::endl;
+					continue;
+				}
+				descriptions.push_back(description);
+				array_textures.emplace_back();
+			}
+
+			locations[i] = glm::uvec2(uint32_t(array), uint32_t(array_textures[array].size()));
+			array_textures[array].push_back(uint32_t(i));
 		}
 
-		gpu_object.transform = model.meshes[i].transform;
-		gpu_object.base_color = model.meshes[i].base_color;
-		gpu_object.emissive_color = model.meshes[i].emissive_color;
-		gpu_object.specular_color = model.meshes[i].specular_color;
-		gpu_object.bounds = model.meshes[i].bounds;
-		gpu_object.visible = true;
+		for (size_t array = 0; array < descriptions.size(); array++) {
+			const auto& description = descriptions[array];
+			auto texture_array = ogl::create_texture_array(description.width, description.height, int(array_textures[array].size()), description.format, description.levels);
+
+			for (size_t layer = 0; layer < array_textures[array].size(); layer++) {
+				ogl::copy_texture_to_layer(*textures[array_textures[array][layer]], texture_array, int(layer));
+			}
+
+			table.texture_arrays.push_back(texture_array);
+		}
+	}
+
+	auto location_of = [&](ogl::Texture2D* texture) {
+		return locations[std::find(textures.begin(), textures.end(), texture) - textures.begin()];
+	};
 
-		gpu_objects[i] = gpu_object;
+	std::vector<GPUMaterial> materials;
+	for (const auto& material : model.materials) {
+		GPUMaterial gpu_material = {
+			.base_color = material.base_color,
+			.emissive_color = material.emissive_color,
+			.specular_color = material.specular_color,
+		};
+
+		for (int slot = 0; slot < 4; slot++) {
+			uint32_t texture = material.textures[slot];
+			glm::uvec2 location = glm::uvec2(UINT32_MAX);
+			if (texture != MATERIAL_NO_TEXTURE) {
+				location = locations[model_texture_offset + texture];
+			}
+			gpu_material.textures[slot] = location != glm::uvec2(UINT32_MAX) ? location : location_of(default_textures[slot]);
+		}
+
+		materials.push_back(gpu_material);
+	}
+
+	if (materials.empty()) {
+		GPUMaterial gpu_material = { glm::vec4(1.0f), glm::vec4(0.0f), glm::vec4(0.0f) };
+		for (int slot = 0; slot < 4; slot++) {
+			gpu_material.textures[slot] = location_of(default_textures[slot]);
+		}
+		materials.push_back(gpu_material);
 	}
 
-	return gpu_objects;
+	table.material_buffer = ogl::create_buffer(materials.data(), materials.size() * sizeof(GPUMaterial), false);
+	return table;
 }
 
+void bind_material_table(const MaterialTable& table) {
+	ogl::bind_buffer_as_ssbo(table.material_buffer, 10);
+	for (size_t array = 0; array < table.texture_arrays.size(); array++) {
+		ogl::bind_texture_array(table.texture_arrays[array], MATERIAL_TEXTURE_ARRAY_UNIT + int(array));
+	}
+}
+
+// the instances of one object that share a lod this frame, drawn with a single instanced draw.
+// first indexes the per frame instance index list
+struct InstanceBatch {
+	uint32_t object;
+	uint32_t lod;
+	uint32_t first;
+	uint32_t count;
+};
+
+#define CULLING_MODE_NONE 0
+#define CULLING_MODE_FRUSTUM 1
+#define CULLING_MODE_BVH 2
+
+// occluders are picked by bounding box diagonal over distance, the largest ones first
+#define OCCLUSION_MIN_OCCLUDER_SIZE 0.25f
+#define OCCLUSION_MAX_OCCLUDERS 32
+
+// distance the camera keeps to instance boxes when camera collision is enabled
+#define CAMERA_COLLISION_DISTANCE 0.05f
+
+
 
 void mouseCallback(GLFWwindow* window, int button, int action, int mods)
 {
@@ -300,12 +610,15 @@ struct alignas(16) PerObject {
 	glm::vec4 specular_color;
 };
 
+// per frame ring buffer space for uniform blocks, the rest of the region is sized for the scene
+#define RING_BUFFER_UNIFORM_SIZE (64 * 1024)
+
 struct RendererState {
 	PerFrame per_frame;
 	PerObject per_object;
 
-	ogl::Buffer per_frame_buffer;
-	ogl::Buffer per_object_buffer;
+	// per frame and per draw data is written straight into this instead of going through buffer_subdata
+	ogl::RingBuffer ring_buffer;
 	ogl::Program fullscreen_quad_program;
 
 	int exposure_location;
@@ -314,22 +627,49 @@ struct RendererState {
 
 RendererState* g_renderer_state;
 
+// picks the coarsest lod of an instance of object whose geometric error stays below error_budget pixels on screen
+uint32_t select_lod(const GPUObject& object, const glm::mat4& transform, const PerFrame& per_frame, float viewport_height, float error_budget)
+{
+	glm::vec3 center = glm::vec3(transform * glm::vec4((object.bounds.min + object.bounds.max) * 0.5f, 1.0f));
+	float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+	float radius = glm::length(object.bounds.max - object.bounds.min) * 0.5f * scale;
+
+	// distance to the bounding sphere, inside of it everything is drawn at full detail
+	float distance = glm::length(center - per_frame.camera_position) - radius;
+	if (distance <= 0.0f) {
+		return 0;
+	}
+
+	float pixels_per_unit = per_frame.projection[1][1] * 0.5f * viewport_height / distance;
+
+	uint32_t lod = 0;
+	for (uint32_t i = 1; i < object.lod_count; i++) {
+		if (object.lods[i].error * scale * pixels_per_unit > error_budget) {
+			break;
+		}
+		lod = i;
+	}
+
+	return lod;
+}
+
 struct Primitives {
 	ogl::Program program;
 	ogl::Buffer sphere_vertex_buffer;
 	ogl::Buffer sphere_index_buffer;
 	int sphere_index_count;
+	AABB sphere_bounds;
 };
 
 Primitives g_primitives;
 
 void init_primitives() {
 
-	auto vertex_shader_source = read_file("primitives_vertex.glsl");
-	auto fragment_shader_source = read_file("primitives_fragment.glsl");
+	auto vertex_shader_source = read_shader_source("primitives_vertex.glsl");
+	auto fragment_shader_source = read_shader_source("primitives_fragment.glsl");
 
-	auto vs = ogl::create_shader(GL_VERTEX_SHADER, vertex_shader_source.data());
-	auto fs = ogl::create_shader(GL_FRAGMENT_SHADER, fragment_shader_source.data());
+	auto vs = ogl::create_shader(GL_VERTEX_SHADER, vertex_shader_source.c_str());
+	auto fs = ogl::create_shader(GL_FRAGMENT_SHADER, fragment_shader_source.c_str());
 	g_primitives.program = ogl::create_program({ vs, fs });
 
 	{
@@ -338,12 +678,13 @@ void init_primitives() {
 
 		create_sphere(vertices, indices, 1.0f, 12, 12);
 
-		ogl::Buffer vertex_buffer = ogl::create_buffer(vertices.data(), vertices.size() * sizeof(Vertex));
+		ogl::Buffer vertex_buffer = ogl::create_buffer(vertices.data(), vertices.size() * sizeof(MeshVertex));
 		ogl::Buffer index_buffer = ogl::create_buffer(indices.data(), indices.size() * sizeof(uint16_t));
 
 		g_primitives.sphere_vertex_buffer = vertex_buffer;
 		g_primitives.sphere_index_buffer = index_buffer;
 		g_primitives.sphere_index_count = uint32_t(indices.size());
+		g_primitives.sphere_bounds = { glm::vec3(-1.0f), glm::vec3(1.0f) };
 	}
 }
 
@@ -356,10 +697,11 @@ void draw_sphere(glm::vec3 position, glm::vec3 scale, glm::vec3 color) {
 	model = glm::scale(model, scale);
 
 	g_renderer_state->per_object.base_color = glm::vec4(color, 1.0f);
-	g_renderer_state->per_object.model = model;
+	g_renderer_state->per_object.model = model * PositionDequantization(g_primitives.sphere_bounds);
 	g_renderer_state->per_object.normal_matrix = glm::mat3(glm::transpose(glm::inverse(model)));
 
-	ogl::buffer_subdata(g_renderer_state->per_object_buffer, &g_renderer_state->per_object, sizeof(PerObject), 0);
+	auto per_object = ogl::ring_buffer_upload(g_renderer_state->ring_buffer, &g_renderer_state->per_object, sizeof(PerObject));
+	ogl::bind_buffer_range_as_ubo(per_object.buffer, 1, per_object.offset, per_object.size);
 
 	ogl::use_program(g_primitives.program);
 	glDrawElements(GL_TRIANGLES, g_primitives.sphere_index_count, GL_UNSIGNED_SHORT, 0);
@@ -436,25 +778,45 @@ struct Shader {
 	std::string name;
 	std::string vs_path;
 	std::string fs_path;
+	std::string cs_path; // compute programs only have this one
 	ogl::Program program;
-	std::filesystem::file_time_type vertex_glsl_last_modified, fragment_glsl_last_modified;
+	std::filesystem::file_time_type vertex_glsl_last_modified, fragment_glsl_last_modified, compute_glsl_last_modified;
 };
 
 void watch_and_reload_program(Shader& shader) {
+	if (!shader.cs_path.empty()) {
+		auto compute_glsl_last_modified_new = std::filesystem::last_write_time(shader.cs_path);
+		if (compute_glsl_last_modified_new != shader.compute_glsl_last_modified) {
+			shader.compute_glsl_last_modified = compute_glsl_last_modified_new;
+
+			auto compute_shader_source = read_shader_source(shader.cs_path);
+			auto compute_shader = ogl::create_shader(GL_COMPUTE_SHADER, compute_shader_source.c_str());
+
+			if (compute_shader.id != 0) {
+				std::cout << "Reloading shader " << shader.name << std::endl;
+				shader.program = ogl::create_program({ compute_shader });
+			}
+			else {
+				std::cerr << "Failed to create program" << std::endl;
+			}
+		}
+		return;
+	}
+
 	auto vertex_glsl_last_modified_new = std::filesystem::last_write_time(shader.vs_path);
 	auto fragment_glsl_last_modified_new = std::filesystem::last_write_time(shader.fs_path);
 
 	if (vertex_glsl_last_modified_new != shader.vertex_glsl_last_modified || fragment_glsl_last_modified_new != shader.fragment_glsl_last_modified) {
 		shader.vertex_glsl_last_modified = vertex_glsl_last_modified_new;
 
-		auto vertex_shader_source = read_file(shader.vs_path);
-		auto vertex_shader_source_ptr = vertex_shader_source.data();
+		auto vertex_shader_source = read_shader_source(shader.vs_path);
+		auto vertex_shader_source_ptr = vertex_shader_source.c_str();
 		auto vertex_shader = ogl::create_shader(GL_VERTEX_SHADER, vertex_shader_source_ptr);
 
 		shader.fragment_glsl_last_modified = fragment_glsl_last_modified_new;
 
-		auto fragment_shader_source = read_file(shader.fs_path);
-		auto fragment_shader_source_ptr = fragment_shader_source.data();
+		auto fragment_shader_source = read_shader_source(shader.fs_path);
+		auto fragment_shader_source_ptr = fragment_shader_source.c_str();
 		auto fragment_shader = ogl::create_shader(GL_FRAGMENT_SHADER, fragment_shader_source_ptr);
 
 		if (vertex_shader.id != 0 && fragment_shader.id != 0) {
@@ -475,11 +837,11 @@ ShaderLoader g_shader_loader;
 
 void load_shader(const std::string& name, const char* vs_path, const char* fs_path) {
 
-	auto vs_source = read_file(vs_path);
-	auto fs_source = read_file(fs_path);
+	auto vs_source = read_shader_source(vs_path);
+	auto fs_source = read_shader_source(fs_path);
 
-	auto vs_source_ptr = vs_source.data();
-	auto fs_source_ptr = fs_source.data();
+	auto vs_source_ptr = vs_source.c_str();
+	auto fs_source_ptr = fs_source.c_str();
 
 	auto vs = ogl::create_shader(GL_VERTEX_SHADER, vs_source_ptr);
 	auto fs = ogl::create_shader(GL_FRAGMENT_SHADER, fs_source_ptr);
@@ -499,6 +861,21 @@ void load_shader(const std::string& name, const char* vs_path, const char* fs_pa
 	};
 }
 
+void load_compute_shader(const std::string& name, const char* cs_path) {
+
+	auto cs_source = read_shader_source(cs_path);
+	auto cs = ogl::create_shader(GL_COMPUTE_SHADER, cs_source.c_str());
+
+	auto program = ogl::create_program({ cs });
+
+	g_shader_loader.programs[name] = Shader{
+		.name = name,
+		.cs_path = cs_path,
+		.program = program,
+		.compute_glsl_last_modified = std::filesystem::last_write_time(cs_path)
+	};
+}
+
 void reload_shaders() {
 	for (auto& [name, shader] : g_shader_loader.programs) {
 		watch_and_reload_program(shader);
@@ -510,9 +887,478 @@ void use_shader(const std::string& name) {
 	ogl::use_program(shader.program);
 }
 
+// gpu driven culling, see cull_compute.glsl. the cpu only uploads the static data once and dispatches
+
+struct alignas(16) GPUCullInstance {
+	glm::vec3 bounds_min;
+	uint32_t object;
+	glm::vec3 bounds_max;
+	float scale;
+};
+
+struct alignas(16) GPUCullObject {
+	float radius;
+	uint32_t lod_count;
+	uint32_t first_command;
+	uint32_t padding;
+	float lod_errors[MESH_MAX_LODS];
+};
+
+// consecutive commands drawn with one glMultiDrawElementsIndirectCount. materials and textures are read per
+// instance, so the whole scene is a single group until draws need different pipeline state
+struct GPUCommandGroup {
+	uint32_t first_command;
+	uint32_t command_count;
+};
+
+#define CULL_PHASE_EARLY 0
+#define CULL_PHASE_LATE 1
+#define CULL_PHASE_COUNT 2
+
+#define CULL_OCCLUSION 0x1u
+#define CULL_LOD_SELECTION 0x2u
+
+struct GPUCulling {
+	ogl::Buffer cull_instance_buffer;
+	ogl::Buffer cull_object_buffer;
+	ogl::Buffer command_template_buffer; // the commands of every phase with instance_count 0
+	ogl::Buffer command_buffer;
+	ogl::Buffer command_group_buffer;
+	ogl::Buffer draw_command_buffer;
+	ogl::Buffer draw_count_buffer; // one count per group and phase
+	ogl::Buffer instance_index_buffer;
+	ogl::Buffer visibility_buffer;
+	std::vector<GPUCommandGroup> groups;
+	uint32_t command_count; // per phase
+	uint32_t instance_count;
+
+	ogl::Texture2D hiz;
+	int hiz_width, hiz_height, hiz_levels;
+};
+
+GPUCullInstance create_cull_instance(const GPUScene& scene, uint32_t instance) {
+	const auto& transform = scene.transforms.Get(instance);
+
+	return {
+		.bounds_min = scene.instance_world_bounds[instance].min,
+		.object = scene.instance_objects[instance],
+		.bounds_max = scene.instance_world_bounds[instance].max,
+		.scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])))),
+	};
+}
+
+GPUCulling create_gpu_culling(const GPUScene& scene, const std::vector<uint32_t>& draw_order) {
+	GPUCulling culling = {};
+
+	std::vector<ogl::DrawElementsIndirectCommand> commands;
+	std::vector<glm::uvec2> command_groups;
+	std::vector<GPUCullObject> cull_objects(scene.objects.size());
+
+	// every command reserves room for all instances of its object, any of them may pick that lod
+	uint32_t instance_index_count = 0;
+
+	for (uint32_t object_index : draw_order) {
+		const auto& object = scene.objects[object_index];
+
+		if (culling.groups.empty()) {
+			culling.groups.push_back({ uint32_t(commands.size()), 0 });
+		}
+
+		auto& group = culling.groups.back();
+		auto& cull_object = cull_objects[object_index];
+		cull_object.radius = glm::length(object.bounds.max - object.bounds.min) * 0.5f;
+		cull_object.lod_count = object.lod_count;
+		cull_object.first_command = uint32_t(commands.size());
+
+		for (uint32_t lod = 0; lod < object.lod_count; lod++) {
+			cull_object.lod_errors[lod] = object.lods[lod].error;
+
+			commands.push_back({
+				.count = object.lods[lod].index_count,
+				.instance_count = 0,
+				.first_index = object.first_index + object.lods[lod].index_offset,
+				.base_vertex = GLint(object.base_vertex),
+				.base_instance = instance_index_count,
+			});
+			command_groups.push_back(glm::uvec2(uint32_t(culling.groups.size() - 1), group.first_command));
+			group.command_count++;
+
+			instance_index_count += object.instance_count;
+		}
+	}
+
+	culling.command_count = uint32_t(commands.size());
+
+	// the late phase writes its instance indices behind the early ones, so its draws never read what the
+	// early draws are still using
+	std::vector<ogl::DrawElementsIndirectCommand> command_template;
+	for (uint32_t phase = 0; phase < CULL_PHASE_COUNT; phase++) {
+		for (auto command : commands) {
+			command.base_instance += phase * instance_index_count;
+			command_template.push_back(command);
+		}
+	}
+
+	std::vector<GPUCullInstance> cull_instances;
+	cull_instances.reserve(scene.instance_count);
+	for (uint32_t instance = 0; instance < scene.instance_count; instance++) {
+		cull_instances.push_back(create_cull_instance(scene, instance));
+	}
+
+	// everything counts as visible in the first frame, the late phase corrects it
+	std::vector<uint32_t> visibility(std::max<size_t>(scene.instance_count, 1), 1);
+
+	size_t command_buffer_size = std::max<size_t>(command_template.size(), 1) * sizeof(ogl::DrawElementsIndirectCommand);
+
+	culling.instance_count = scene.instance_count;
+	culling.cull_instance_buffer = ogl::create_buffer(cull_instances.data(), std::max<size_t>(cull_instances.size(), 1) * sizeof(GPUCullInstance), true);
+	culling.cull_object_buffer = ogl::create_buffer(cull_objects.data(), std::max<size_t>(cull_objects.size(), 1) * sizeof(GPUCullObject), false);
+	culling.command_template_buffer = ogl::create_buffer(command_template.data(), command_buffer_size, false);
+	culling.command_buffer = ogl::create_buffer(nullptr, command_buffer_size, false);
+	culling.command_group_buffer = ogl::create_buffer(command_groups.data(), std::max<size_t>(command_groups.size(), 1) * sizeof(glm::uvec2), false);
+	culling.draw_command_buffer = ogl::create_buffer(nullptr, command_buffer_size, false);
+	culling.draw_count_buffer = ogl::create_buffer(nullptr, std::max<size_t>(culling.groups.size(), 1) * CULL_PHASE_COUNT * sizeof(uint32_t), false);
+	culling.instance_index_buffer = ogl::create_buffer(nullptr, std::max<size_t>(instance_index_count, 1) * CULL_PHASE_COUNT * sizeof(uint32_t), false);
+	culling.visibility_buffer = ogl::create_buffer(visibility.data(), visibility.size() * sizeof(uint32_t), false);
+
+	return culling;
+}
+
+// applies the transforms set since the last call to the matrices, the world bounds and the bvh, and uploads
+// the changed ranges of the instance and cull instance buffers. does nothing while no transform changes
+void update_scene_transforms(GPUScene& scene, GPUCulling& culling) {
+	if (!scene.transforms.Update()) {
+		return;
+	}
+
+	for (uint32_t instance : scene.transforms.changed) {
+		const auto& object = scene.objects[scene.instance_objects[instance]];
+		AABB world_bounds = TransformBounds(object.bounds, scene.transforms.Get(instance));
+		scene.instance_world_bounds[instance] = world_bounds;
+		scene.instance_bounds.Set(instance, world_bounds.min, world_bounds.max);
+	}
+
+	scene.bvh.Refit(scene.instance_world_bounds.data());
+
+	std::vector<GPUCullInstance> cull_instances;
+	for (const auto& range : scene.transforms.changed_ranges) {
+		ogl::buffer_subdata(scene.instance_buffer, &scene.transforms.matrices[range.first], range.count * sizeof(InstanceMatrices), range.first * sizeof(InstanceMatrices));
+
+		cull_instances.clear();
+		for (uint32_t instance = range.first; instance < range.first + range.count; instance++) {
+			cull_instances.push_back(create_cull_instance(scene, instance));
+		}
+		ogl::buffer_subdata(culling.cull_instance_buffer, cull_instances.data(), range.count * sizeof(GPUCullInstance), range.first * sizeof(GPUCullInstance));
+	}
+}
+
+// level 0 is the largest power of two that fits the depth buffer, so every further level halves exactly
+void resize_hiz(GPUCulling& culling, int width, int height) {
+	int hiz_width = 1;
+	int hiz_height = 1;
+	while (hiz_width * 2 <= width) {
+		hiz_width *= 2;
+	}
+	while (hiz_height * 2 <= height) {
+		hiz_height *= 2;
+	}
+
+	if (culling.hiz.id != 0 && culling.hiz_width == hiz_width && culling.hiz_height == hiz_height) {
+		return;
+	}
+
+	if (culling.hiz.id != 0) {
+		ogl::delete_texture(culling.hiz);
+	}
+
+	culling.hiz_width = hiz_width;
+	culling.hiz_height = hiz_height;
+	culling.hiz_levels = 1;
+	while ((std::max(hiz_width, hiz_height) >> culling.hiz_levels) > 0) {
+		culling.hiz_levels++;
+	}
+
+	culling.hiz = ogl::create_texture(hiz_width, hiz_height, GL_R32F, culling.hiz_levels);
+	glTextureParameteri(culling.hiz.id, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTextureParameteri(culling.hiz.id, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTextureParameteri(culling.hiz.id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(culling.hiz.id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void build_hiz(GPUCulling& culling, ogl::Texture2D depth, int width, int height) {
+	resize_hiz(culling, width, height);
+
+	use_shader("hiz_build");
+
+	for (int level = 0; level < culling.hiz_levels; level++) {
+		glm::ivec2 source_size = level == 0 ? glm::ivec2(width, height) : glm::ivec2(std::max(culling.hiz_width >> (level - 1), 1), std::max(culling.hiz_height >> (level - 1), 1));
+		glm::ivec2 destination_size = glm::ivec2(std::max(culling.hiz_width >> level, 1), std::max(culling.hiz_height >> level, 1));
+
+		ogl::bind_texture(level == 0 ? depth : culling.hiz, 0);
+		ogl::bind_image(culling.hiz, 0, level, GL_WRITE_ONLY, GL_R32F);
+
+		glUniform1i(0, level == 0 ? 0 : level - 1);
+		glUniform2i(1, source_size.x, source_size.y);
+		glUniform2i(2, destination_size.x, destination_size.y);
+
+		glDispatchCompute((destination_size.x + 7) / 8, (destination_size.y + 7) / 8, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+}
+
+// starts a frame, every phase begins with empty commands and zero draws per group
+void reset_gpu_culling(GPUCulling& culling) {
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	size_t command_buffer_size = size_t(culling.command_count) * CULL_PHASE_COUNT * sizeof(ogl::DrawElementsIndirectCommand);
+	if (command_buffer_size > 0) {
+		glCopyNamedBufferSubData(culling.command_template_buffer.id, culling.command_buffer.id, 0, 0, command_buffer_size);
+	}
+
+	glClearNamedBufferData(culling.draw_count_buffer.id, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+}
+
+void dispatch_gpu_culling(GPUCulling& culling, uint32_t phase, uint32_t flags, const Frustum& frustum, float lod_error_budget, float viewport_height) {
+	if (culling.instance_count == 0 || culling.command_count == 0) {
+		return;
+	}
+
+	ogl::bind_buffer_as_ssbo(culling.instance_index_buffer, 2);
+	ogl::bind_buffer_as_ssbo(culling.cull_instance_buffer, 3);
+	ogl::bind_buffer_as_ssbo(culling.cull_object_buffer, 4);
+	ogl::bind_buffer_as_ssbo(culling.command_buffer, 5);
+	ogl::bind_buffer_as_ssbo(culling.visibility_buffer, 6);
+	ogl::bind_buffer_as_ssbo(culling.command_group_buffer, 7);
+	ogl::bind_buffer_as_ssbo(culling.draw_command_buffer, 8);
+	ogl::bind_buffer_as_ssbo(culling.draw_count_buffer, 9);
+
+	// the early phase has no pyramid to test against yet
+	if (phase == CULL_PHASE_EARLY) {
+		flags &= ~CULL_OCCLUSION;
+	}
+	else if (culling.hiz.id != 0) {
+		ogl::bind_texture(culling.hiz, 0);
+	}
+
+	use_shader("cull");
+	glUniform1ui(0, culling.instance_count);
+	glUniform1ui(1, phase);
+	glUniform1ui(2, flags);
+	glUniform1f(3, lod_error_budget);
+	glUniform1f(4, viewport_height);
+	glUniform2f(5, float(culling.hiz_width), float(culling.hiz_height));
+	glUniform1ui(6, phase * culling.command_count);
+	glUniform4fv(7, 6, glm::value_ptr(frustum.planes[0]));
+	glDispatchCompute((culling.instance_count + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	use_shader("compact_draws");
+	glUniform1ui(0, culling.command_count);
+	glUniform1ui(1, phase * culling.command_count);
+	glUniform1ui(2, phase * uint32_t(culling.groups.size()));
+	glDispatchCompute((culling.command_count + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// culls random boxes scattered around a camera with every kernel and prints the throughput,
+// run with --bench culling
+int run_culling_benchmark() {
+	std::mt19937 random(42);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> size(0.1f, 4.0f);
+
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.01f, 1000.0f);
+	// camera at the origin looking down -z, so the view matrix is the identity
+	Frustum frustum = ExtractFrustum(projection);
+
+	struct Kernel {
+		const char* name;
+		size_t (*cull)(const CullingBounds&, const Frustum&, uint32_t*);
+	};
+
+	Kernel kernels[] = {
+		{ "scalar", CullBoundsScalar },
+		{ "sse", CullBoundsSse },
+#if defined(__AVX__)
+		{ "avx", CullBoundsAvx },
+#endif
+	};
+
+	for (size_t box_count : { size_t(10000), size_t(100000), size_t(1000000) }) {
+		CullingBounds bounds;
+		bounds.Reserve(box_count);
+		for (size_t i = 0; i < box_count; i++) {
+			glm::vec3 center(position(random), position(random), position(random));
+			glm::vec3 extent(size(random), size(random), size(random));
+			bounds.Add(center - extent, center + extent);
+		}
+
+		std::vector<uint32_t> visible(box_count);
+
+		for (const auto& kernel : kernels) {
+			// best of a few runs, the first one also warms the caches
+			double best_us = 1e30;
+			size_t visible_count = 0;
+			for (int run = 0; run < 16; run++) {
+				auto start = std::chrono::high_resolution_clock::now();
+				visible_count = kernel.cull(bounds, frustum, visible.data());
+				auto end = std::chrono::high_resolution_clock::now();
+				best_us = std::min(best_us, std::chrono::duration<double, std::micro>(end - start).count());
+			}
+
+			std::cout << box_count << " boxes, " << kernel.name << ": " << best_us << " us, "
+				<< double(box_count) / best_us << " objects/us, " << visible_count << " visible" << std::endl;
+		}
+	}
+
+	return 0;
+}
+
+// sorts random draw keys with the radix sort and with std::sort for comparison.
+// run with --bench sort
+int run_sort_benchmark() {
+	std::mt19937 random(42);
+	std::uniform_int_distribution<uint32_t> program(0, 15);
+	std::uniform_int_distribution<uint32_t> material(0, 1023);
+	std::uniform_real_distribution<float> depth(0.1f, 1000.0f);
+
+	for (size_t key_count : { size_t(10000), size_t(100000), size_t(1000000) }) {
+		RenderQueue queue;
+		for (size_t i = 0; i < key_count; i++) {
+			queue.Push(MakeOpaqueSortKey(program(random), material(random), depth(random)), uint32_t(i));
+		}
+
+		std::vector<uint64_t> keys;
+		std::vector<uint32_t> items;
+		std::vector<uint64_t> temp_keys(key_count);
+		std::vector<uint32_t> temp_items(key_count);
+		std::vector<std::pair<uint64_t, uint32_t>> pairs(key_count);
+
+		double radix_us = 1e30;
+		double std_us = 1e30;
+		for (int run = 0; run < 16; run++) {
+			keys = queue.keys;
+			items = queue.items;
+			auto start = std::chrono::high_resolution_clock::now();
+			RadixSort(keys.data(), items.data(), temp_keys.data(), temp_items.data(), key_count);
+			auto end = std::chrono::high_resolution_clock::now();
+			radix_us = std::min(radix_us, std::chrono::duration<double, std::micro>(end - start).count());
+
+			for (size_t i = 0; i < key_count; i++) {
+				pairs[i] = { queue.keys[i], queue.items[i] };
+			}
+			start = std::chrono::high_resolution_clock::now();
+			std::sort(pairs.begin(), pairs.end());
+			end = std::chrono::high_resolution_clock::now();
+			std_us = std::min(std_us, std::chrono::duration<double, std::micro>(end - start).count());
+		}
+
+		queue.Sort();
+		std::cout << key_count << " keys, radix: " << radix_us << " us, std::sort: " << std_us << " us, "
+			<< "program changes " << queue.stats.unsorted_program_changes << " -> " << queue.stats.program_changes << ", "
+			<< "material changes " << queue.stats.unsorted_material_changes << " -> " << queue.stats.material_changes << std::endl;
+	}
+
+	return 0;
+}
+
+// a closed box with outward facing counter clockwise triangles
+OccluderMesh create_box_occluder(const glm::vec3& min, const glm::vec3& max) {
+	OccluderMesh occluder;
+	for (int corner = 0; corner < 8; corner++) {
+		occluder.positions.push_back(glm::vec3((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y, (corner & 4) ? max.z : min.z));
+	}
+
+	const uint32_t faces[6][4] = { { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 }, { 2, 6, 7, 3 } };
+	for (const auto& face : faces) {
+		occluder.indices.insert(occluder.indices.end(), { face[0], face[1], face[2], face[0], face[2], face[3] });
+	}
+
+	return occluder;
+}
+
+// rasterizes a wall of box occluders and tests random boxes behind and around it, no gpu involved.
+// run with --bench occlusion
+int run_occlusion_benchmark() {
+	std::mt19937 random(42);
+
+	glm::mat4 view_projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.01f, 1000.0f);
+
+	// 8 x 4 wall segments with small gaps 20 units in front of the camera
+	std::vector<OccluderMesh> occluders;
+	for (int y = 0; y < 4; y++) {
+		for (int x = 0; x < 8; x++) {
+			glm::vec3 min = glm::vec3(-20.0f + x * 5.0f, -10.0f + y * 5.0f, -21.0f);
+			occluders.push_back(create_box_occluder(min, min + glm::vec3(4.8f, 4.8f, 1.0f)));
+		}
+	}
+
+	std::vector<const OccluderMesh*> occluder_meshes;
+	std::vector<glm::mat4> occluder_transforms;
+	for (const auto& occluder : occluders) {
+		occluder_meshes.push_back(&occluder);
+		occluder_transforms.push_back(view_projection);
+	}
+
+	OcclusionBuffer occlusion_buffer;
+
+	double best_raster_us = 1e30;
+	for (int run = 0; run < 16; run++) {
+		auto start = std::chrono::high_resolution_clock::now();
+		occlusion_buffer.Clear();
+		occlusion_buffer.RasterizeOccluders(occluder_meshes.data(), occluder_transforms.data(), occluder_meshes.size());
+		auto end = std::chrono::high_resolution_clock::now();
+		best_raster_us = std::min(best_raster_us, std::chrono::duration<double, std::micro>(end - start).count());
+	}
+
+	std::cout << "occlusion: " << occlusion_buffer.stats.occluder_count << " occluders, " << occlusion_buffer.stats.triangle_count
+		<< " triangles rasterized in " << best_raster_us << " us" << std::endl;
+
+	std::uniform_real_distribution<float> lateral(-200.0f, 200.0f);
+	std::uniform_real_distribution<float> depth(-500.0f, -1.0f);
+	std::uniform_real_distribution<float> size(0.1f, 2.0f);
+
+	for (size_t box_count : { size_t(10000), size_t(100000) }) {
+		std::vector<AABB> bounds(box_count);
+		for (auto& box : bounds) {
+			glm::vec3 center(lateral(random) * 0.25f, lateral(random) * 0.15f, depth(random));
+			glm::vec3 extent(size(random));
+			box = { center - extent, center + extent };
+		}
+
+		std::vector<uint32_t> indices(box_count);
+
+		double best_test_us = 1e30;
+		size_t visible_count = 0;
+		for (int run = 0; run < 16; run++) {
+			std::iota(indices.begin(), indices.end(), 0);
+			auto start = std::chrono::high_resolution_clock::now();
+			visible_count = occlusion_buffer.CullBounds(bounds.data(), indices.data(), box_count, view_projection);
+			auto end = std::chrono::high_resolution_clock::now();
+			best_test_us = std::min(best_test_us, std::chrono::duration<double, std::micro>(end - start).count());
+		}
+
+		std::cout << box_count << " boxes tested in " << best_test_us << " us, " << double(box_count) / best_test_us << " objects/us, "
+			<< box_count - visible_count << " occluded" << std::endl;
+	}
+
+	return 0;
+}
+
 int main(int argc, char* argv[]) {
-	(void)argc;
-	(void)argv;
+	if (argc > 2 && strcmp(argv[1], "--bench") == 0) {
+		if (strcmp(argv[2], "culling") == 0) {
+			return run_culling_benchmark();
+		}
+		if (strcmp(argv[2], "occlusion") == 0) {
+			return run_occlusion_benchmark();
+		}
+		if (strcmp(argv[2], "sort") == 0) {
+			return run_sort_benchmark();
+		}
+		std::cout << "unknown benchmark " << argv[2] << std::endl;
+		return -1;
+	}
 
 	GLFWwindow* window = create_window();
 	if (window == nullptr) {
@@ -528,6 +1374,9 @@ int main(int argc, char* argv[]) {
 		return -1;
 	}
 
+	// decides how the shaders sample material textures, so it has to be known before the first shader is loaded
+	g_bindless_textures = ogl::bindless_textures_supported();
+
 	EnableDebugMessages();
 
 	// Setup Dear ImGui context
@@ -557,23 +1406,6 @@ int main(int argc, char* argv[]) {
 
 	init_primitives();
 
-	{
-		ogl::Buffer per_frame_buffer = ogl::create_buffer(nullptr, sizeof(PerFrame), true);
-		ogl::Buffer per_object_buffer = ogl::create_buffer(nullptr, sizeof(PerObject), true);
-
-		g_renderer_state->per_frame_buffer = per_frame_buffer;
-		g_renderer_state->per_object_buffer = per_object_buffer;
-
-
-		ogl::bind_buffer_as_ubo(per_frame_buffer, 0);
-		ogl::bind_buffer_as_ubo(per_object_buffer, 1);
-	}
-
-	ogl::Buffer directional_light_buffer = ogl::create_buffer(nullptr, sizeof(DirectionalLight), true);
-	ogl::Buffer points_light_buffer = ogl::create_buffer(nullptr, sizeof(PointLight) * 4, true);
-	ogl::bind_buffer_as_ubo(directional_light_buffer, 2);
-	ogl::bind_buffer_as_ubo(points_light_buffer, 3);
-
 
 
 	auto vao = ogl::create_vertex_array();
@@ -597,9 +1429,57 @@ int main(int argc, char* argv[]) {
 	auto root = p.parent_path().string();
 	auto filename_str = p.filename().string();
 
+	model.import_options = MODEL_IMPORT_MESHLETS | MODEL_IMPORT_LODS;
 	model.Load(root.c_str(), filename_str.c_str(), 1.0f, true);
 
-	auto gpu_objects = load_model(model);
+	auto scene = load_model(model);
+	ogl::bind_buffer_as_ssbo(scene.instance_buffer, 1);
+	ogl::bind_buffer_as_ssbo(scene.instance_material_buffer, 11);
+
+	uint32_t black_pixel = 0xFF000000;
+	ogl::Texture2D black_texture = ogl::create_texture_from_bytes(&black_pixel, 1, 1, 1, 4, false);
+
+	uint32_t white_pixel = 0xFFFFFFFF;
+	ogl::Texture2D white_texture = ogl::create_texture_from_bytes(&white_pixel, 1, 1, 1, 4, false);
+
+	// (0.5, 0.5, 1), the unperturbed tangent space normal
+	uint32_t flat_normal_pixel = 0xFFFF8080;
+	ogl::Texture2D flat_normal_texture = ogl::create_texture_from_bytes(&flat_normal_pixel, 1, 1, 1, 4, false);
+
+	// what an empty material slot samples, the base color factor alone decides the color
+	ogl::Texture2D* default_textures[4] = {};
+	default_textures[BASE_COLOR_MAP_INDEX] = &white_texture;
+	default_textures[OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX] = &black_texture;
+	default_textures[NORMAL_MAP_INDEX] = &flat_normal_texture;
+	default_textures[EMISSIVE_MAP_INDEX] = &black_texture;
+
+	// nothing binds textures per draw, the table and the fallback arrays stay bound for the whole run
+	auto material_table = create_material_table(model, default_textures);
+	bind_material_table(material_table);
+
+	// objects ordered by material, so draws reading the same textures are adjacent
+	std::vector<uint32_t> draw_order(scene.objects.size());
+	std::iota(draw_order.begin(), draw_order.end(), 0);
+	std::stable_sort(draw_order.begin(), draw_order.end(), [&](uint32_t a, uint32_t b) {
+		return scene.objects[a].material < scene.objects[b].material;
+	});
+
+	auto gpu_culling_state = create_gpu_culling(scene, draw_order);
+
+	// rebuilt every frame, instances grouped by object and lod so every group is one indirect command
+	std::vector<uint32_t> instance_indices;
+	std::vector<uint32_t> instance_lods;
+	std::vector<InstanceBatch> instance_batches;
+	std::vector<uint32_t> visible_instances(scene.instance_count);
+	std::vector<ogl::DrawElementsIndirectCommand> draw_commands;
+	std::vector<ogl::DrawElementsIndirectCommand> sorted_draw_commands;
+	RenderQueue render_queue;
+	bool sort_draws = true;
+	bool state_cache = true;
+
+	// uniform blocks and the sphere draws fit in the fixed part, the cpu culling path needs one instance index
+	// and at most one command per instance (when instancing is disabled) on top of it
+	g_renderer_state->ring_buffer = ogl::create_ring_buffer(RING_BUFFER_UNIFORM_SIZE + std::max<size_t>(scene.instance_count, 1) * (sizeof(uint32_t) + sizeof(ogl::DrawElementsIndirectCommand)));
 
 	model.DestroyCpuSideBuffer();
 
@@ -699,20 +1579,40 @@ int main(int argc, char* argv[]) {
 	load_shader("deferred", "deferred_vertex.glsl", "deferred_fragment.glsl");
 	load_shader("deferred_lighting", "deferred_lighting_vertex.glsl", "deferred_lighting_fragment.glsl");
 	load_shader("forward", "vertex.glsl", "fragment.glsl");
+	load_compute_shader("hiz_build", "hiz_build_compute.glsl");
+	load_compute_shader("cull", "cull_compute.glsl");
+	load_compute_shader("compact_draws", "compact_draws_compute.glsl");
 
 	float exposure = 1.0f;
 
 	bool deferred = false;
 
-	uint32_t black_pixel = 0xFF000000;
-	ogl::Texture2D black_texture = ogl::create_texture_from_bytes(&black_pixel, 1, 1, 1, 4, false);
-
-	uint32_t white_pixel = 0xFFFFFFFF;
-	ogl::Texture2D white_texture = ogl::create_texture_from_bytes(&white_pixel, 1, 1, 1, 4, false);
+	bool lod_selection = true;
+	float lod_error_budget = 1.0f;
+	uint64_t submitted_triangles = 0;
+	bool instancing = true;
+	bool multi_draw = true;
+	bool gpu_culling = true;
+	bool gpu_occlusion = true;
+	int culling_mode = CULLING_MODE_BVH;
+	bool camera_collision = false;
+	bool occlusion_culling = false;
+	uint32_t occlusion_culled_count = 0;
+	OcclusionBuffer occlusion_buffer;
+	std::vector<std::pair<float, uint32_t>> occluder_candidates;
+	std::vector<const OccluderMesh*> occluder_meshes;
+	std::vector<glm::mat4> occluder_transforms;
+	int picked_instance = -1;
+	uint32_t visible_instance_count = 0;
+	uint32_t draw_calls = 0;
 
 	while (!glfwWindowShouldClose(window)) {
 		frames++;
 
+		ogl::ring_buffer_begin_frame(g_renderer_state->ring_buffer);
+		ogl::reset_state_stats();
+		update_scene_transforms(scene, gpu_culling_state);
+
 		if (frames % 60 == 0) {
 			reload_shaders();
 		}
@@ -744,8 +1644,18 @@ int main(int argc, char* argv[]) {
 			float cameraMotionSpeed = cameraBoost ? 2.f : 0.5f;
 			float cameraRotationSpeed = glm::radians(10.f);
 
-			camera_position += float(cameraMotion.y * delta_time * cameraMotionSpeed) * (camera_orientation * glm::vec3(1, 0, 0));
-			camera_position += float(cameraMotion.x * delta_time * cameraMotionSpeed) * (camera_orientation * glm::vec3(0, 0, -1));
+			glm::vec3 camera_motion = float(cameraMotion.y * delta_time * cameraMotionSpeed) * (camera_orientation * glm::vec3(1, 0, 0));
+			camera_motion += float(cameraMotion.x * delta_time * cameraMotionSpeed) * (camera_orientation * glm::vec3(0, 0, -1));
+
+			// stop in front of the first instance box along the motion, a camera already inside a box can leave it
+			float motion_length = glm::length(camera_motion);
+			BvhHit hit;
+			if (camera_collision && motion_length > 0.0f &&
+				scene.bvh.Raycast(scene.instance_world_bounds.data(), camera_position, camera_motion / motion_length, motion_length, hit) && hit.distance > 0.0f) {
+				camera_motion *= std::max(hit.distance - CAMERA_COLLISION_DISTANCE, 0.0f) / motion_length;
+			}
+
+			camera_position += camera_motion;
 			camera_orientation = glm::rotate(glm::quat(0, 0, 0, 1), float(-cameraRotation.x * delta_time * cameraRotationSpeed), glm::vec3(0, 1, 0)) * camera_orientation;
 			camera_orientation = glm::rotate(glm::quat(0, 0, 0, 1), float(-cameraRotation.y * delta_time * cameraRotationSpeed), camera_orientation * glm::vec3(1, 0, 0)) * camera_orientation;
 
@@ -799,11 +1709,14 @@ int main(int argc, char* argv[]) {
 			g_renderer_state->per_frame.camera_position = glm::vec4(camera_position, 1.0f);
 		}
 
-		ogl::buffer_subdata(g_renderer_state->per_frame_buffer, &g_renderer_state->per_frame, sizeof(PerFrame), 0);
+		auto per_frame = ogl::ring_buffer_upload(g_renderer_state->ring_buffer, &g_renderer_state->per_frame, sizeof(PerFrame));
+		ogl::bind_buffer_range_as_ubo(per_frame.buffer, 0, per_frame.offset, per_frame.size);
 
 		sun.direction = glm::normalize(sun_direction);
-		ogl::buffer_subdata(directional_light_buffer, &sun, sizeof(DirectionalLight), 0);
-		ogl::buffer_subdata(points_light_buffer, &point_lights, sizeof(point_lights), 0);
+		auto directional_light = ogl::ring_buffer_upload(g_renderer_state->ring_buffer, &sun, sizeof(DirectionalLight));
+		auto points_light = ogl::ring_buffer_upload(g_renderer_state->ring_buffer, &point_lights, sizeof(point_lights));
+		ogl::bind_buffer_range_as_ubo(directional_light.buffer, 2, directional_light.offset, directional_light.size);
+		ogl::bind_buffer_range_as_ubo(points_light.buffer, 3, points_light.offset, points_light.size);
 
 
 		if (deferred) {
@@ -817,55 +1730,243 @@ int main(int argc, char* argv[]) {
 			use_shader("forward");
 		}
 
-		for (const auto& mesh : gpu_objects) {
-			ogl::bind_buffer_as_ssbo(mesh.vertex_buffer, 0);
-			ogl::bind_buffer_as_ebo(mesh.index_buffer);
+		submitted_triangles = 0;
+		draw_calls = 0;
+
+		// picks the closest instance box under the cursor
+		if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS && glfwGetInputMode(window, GLFW_CURSOR) == GLFW_CURSOR_NORMAL && !io.WantCaptureMouse)
+		{
+			double cursor_x, cursor_y;
+			int window_width, window_height;
+			glfwGetCursorPos(window, &cursor_x, &cursor_y);
+			glfwGetWindowSize(window, &window_width, &window_height);
+
+			glm::vec2 ndc = glm::vec2(float(cursor_x) / float(window_width) * 2.0f - 1.0f, 1.0f - float(cursor_y) / float(window_height) * 2.0f);
+			glm::mat4 inverse_view_projection = glm::inverse(g_renderer_state->per_frame.projection * g_renderer_state->per_frame.view);
+			glm::vec4 near_point = inverse_view_projection * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+			glm::vec4 far_point = inverse_view_projection * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+			glm::vec3 ray_origin = glm::vec3(near_point) / near_point.w;
+			glm::vec3 ray_direction = glm::normalize(glm::vec3(far_point) / far_point.w - ray_origin);
+
+			BvhHit hit;
+			picked_instance = scene.bvh.Raycast(scene.instance_world_bounds.data(), ray_origin, ray_direction, FLT_MAX, hit) ? int(hit.primitive) : -1;
+		}
+
+		if (gpu_culling) {
+			// visibility, lod selection and the commands are all produced on the gpu, the cpu only dispatches
+			Frustum frustum = ExtractFrustum(g_renderer_state->per_frame.projection * g_renderer_state->per_frame.view);
+			uint32_t flags = (gpu_occlusion ? CULL_OCCLUSION : 0u) | (lod_selection ? CULL_LOD_SELECTION : 0u);
+			ogl::Framebuffer& scene_framebuffer = deferred ? gbuffer_framebuffer : hdr_forward_framebuffer;
+
+			reset_gpu_culling(gpu_culling_state);
 
-			if (mesh.textures[BASE_COLOR_MAP_INDEX] != nullptr && mesh.textures[BASE_COLOR_MAP_INDEX]->id != 0) {
-				ogl::bind_texture(*mesh.textures[BASE_COLOR_MAP_INDEX], BASE_COLOR_MAP_INDEX);
+			for (uint32_t phase = 0; phase < CULL_PHASE_COUNT; phase++) {
+				if (phase == CULL_PHASE_LATE) {
+					build_hiz(gpu_culling_state, ogl::Texture2D{ scene_framebuffer.depth_attachment.id }, scene_framebuffer.width, scene_framebuffer.height);
+				}
+
+				dispatch_gpu_culling(gpu_culling_state, phase, flags, frustum, lod_error_budget, float(height));
+
+				use_shader(deferred ? "deferred" : "forward");
+				ogl::bind_buffer_as_ssbo(scene.vertex_buffer, 0);
+				ogl::bind_buffer_as_ssbo(gpu_culling_state.instance_index_buffer, 2);
+				ogl::bind_buffer_as_ebo(scene.index_buffer);
+				ogl::bind_buffer_as_indirect(gpu_culling_state.draw_command_buffer);
+				ogl::bind_buffer_as_parameter(gpu_culling_state.draw_count_buffer);
+
+				for (uint32_t group_index = 0; group_index < gpu_culling_state.groups.size(); group_index++) {
+					const auto& group = gpu_culling_state.groups[group_index];
+					size_t command_offset = (size_t(phase) * gpu_culling_state.command_count + group.first_command) * sizeof(ogl::DrawElementsIndirectCommand);
+					size_t count_offset = (size_t(phase) * gpu_culling_state.groups.size() + group_index) * sizeof(uint32_t);
+
+					glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)command_offset, GLintptr(count_offset), GLsizei(group.command_count), 0);
+					draw_calls++;
+				}
+			}
+		}
+		else {
+			if (culling_mode == CULLING_MODE_FRUSTUM) {
+				Frustum frustum = ExtractFrustum(g_renderer_state->per_frame.projection * g_renderer_state->per_frame.view);
+				visible_instance_count = uint32_t(CullBounds(scene.instance_bounds, frustum, visible_instances.data()));
+			}
+			else if (culling_mode == CULLING_MODE_BVH) {
+				// the bvh emits in traversal order, the per object split below needs the list ascending
+				Frustum frustum = ExtractFrustum(g_renderer_state->per_frame.projection * g_renderer_state->per_frame.view);
+				visible_instance_count = uint32_t(scene.bvh.Cull(scene.instance_world_bounds.data(), frustum, visible_instances.data()));
+				std::sort(visible_instances.begin(), visible_instances.begin() + visible_instance_count);
 			}
 			else {
-				ogl::bind_texture(black_texture, BASE_COLOR_MAP_INDEX);
+				std::iota(visible_instances.begin(), visible_instances.end(), 0);
+				visible_instance_count = scene.instance_count;
 			}
 
-			if (mesh.textures[OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX] != nullptr && mesh.textures[OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX]->id != 0) {
-				ogl::bind_texture(*mesh.textures[OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX], OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX);
+			// the largest visible instances on screen become occluders for everything else
+			occlusion_culled_count = 0;
+			if (occlusion_culling) {
+				glm::mat4 view_projection = g_renderer_state->per_frame.projection * g_renderer_state->per_frame.view;
+
+				occluder_candidates.clear();
+				for (uint32_t i = 0; i < visible_instance_count; i++) {
+					uint32_t instance = visible_instances[i];
+					const AABB& bounds = scene.instance_world_bounds[instance];
+					float distance = std::max(glm::length((bounds.min + bounds.max) * 0.5f - camera_position), 1e-3f);
+					float size = glm::length(bounds.max - bounds.min) / distance;
+					if (size >= OCCLUSION_MIN_OCCLUDER_SIZE && !scene.occluders[scene.instance_objects[instance]].indices.empty()) {
+						occluder_candidates.push_back({ size, instance });
+					}
+				}
+
+				size_t occluder_count = std::min<size_t>(occluder_candidates.size(), OCCLUSION_MAX_OCCLUDERS);
+				std::partial_sort(occluder_candidates.begin(), occluder_candidates.begin() + occluder_count, occluder_candidates.end(),
+					[](const auto& a, const auto& b) { return a.first > b.first; });
+
+				occluder_meshes.clear();
+				occluder_transforms.clear();
+				for (size_t i = 0; i < occluder_count; i++) {
+					uint32_t instance = occluder_candidates[i].second;
+					occluder_meshes.push_back(&scene.occluders[scene.instance_objects[instance]]);
+					occluder_transforms.push_back(view_projection * scene.transforms.Get(instance));
+				}
+
+				occlusion_buffer.Clear();
+				occlusion_buffer.RasterizeOccluders(occluder_meshes.data(), occluder_transforms.data(), occluder_meshes.size());
+				visible_instance_count = uint32_t(occlusion_buffer.CullBounds(scene.instance_world_bounds.data(), visible_instances.data(), visible_instance_count, view_projection));
+				occlusion_culled_count = occlusion_buffer.stats.culled_count;
 			}
-			else {
-				ogl::bind_texture(black_texture, OCCLUSION_METALLIC_ROUGHNESS_MAP_INDEX);
+
+			// the visible list is ascending and the instances of an object are contiguous,
+			// so every object owns one range of it
+			{
+				uint32_t cursor = 0;
+				for (auto& object : scene.objects) {
+					uint32_t end_instance = object.first_instance + object.instance_count;
+					object.visible_first = cursor;
+					while (cursor < visible_instance_count && visible_instances[cursor] < end_instance) {
+						cursor++;
+					}
+					object.visible_count = cursor - object.visible_first;
+					object.visible = object.visible_count > 0;
+				}
 			}
 
-			if (mesh.textures[NORMAL_MAP_INDEX] != nullptr && mesh.textures[NORMAL_MAP_INDEX]->id != 0) {
-				ogl::bind_texture(*mesh.textures[NORMAL_MAP_INDEX], NORMAL_MAP_INDEX);
+			instance_indices.clear();
+			instance_batches.clear();
+
+			for (uint32_t object_index : draw_order) {
+				const auto& object = scene.objects[object_index];
+				if (!object.visible) {
+					continue;
+				}
+
+				const uint32_t* object_instances = &visible_instances[object.visible_first];
+				uint32_t lod_counts[MESH_MAX_LODS] = {};
+
+				instance_lods.resize(object.visible_count);
+				for (uint32_t i = 0; i < object.visible_count; i++) {
+					const auto& transform = scene.transforms.Get(object_instances[i]);
+					instance_lods[i] = lod_selection ? select_lod(object, transform, g_renderer_state->per_frame, float(height), lod_error_budget) : 0;
+					lod_counts[instance_lods[i]]++;
+				}
+
+				uint32_t lod_first[MESH_MAX_LODS];
+				for (uint32_t lod = 0; lod < object.lod_count; lod++) {
+					lod_first[lod] = uint32_t(instance_indices.size());
+					if (lod_counts[lod] > 0) {
+						instance_batches.push_back({ object_index, lod, lod_first[lod], lod_counts[lod] });
+					}
+					instance_indices.resize(instance_indices.size() + lod_counts[lod]);
+				}
+
+				for (uint32_t i = 0; i < object.visible_count; i++) {
+					instance_indices[lod_first[instance_lods[i]]++] = object_instances[i];
+				}
 			}
-			else {
-				ogl::bind_texture(white_texture, NORMAL_MAP_INDEX);
+
+			// base_instance points into the instance index list, the vertex shaders add gl_InstanceID to it.
+			// every command goes through the render queue, keyed by material and its nearest instance
+			draw_commands.clear();
+			render_queue.Clear();
+
+			auto instance_depth = [&](uint32_t instance) {
+				const AABB& bounds = scene.instance_world_bounds[instance];
+				return glm::length(glm::max(glm::max(bounds.min - camera_position, camera_position - bounds.max), glm::vec3(0.0f)));
+			};
+
+			for (const auto& batch : instance_batches) {
+				const auto& object = scene.objects[batch.object];
+				const auto& lod = object.lods[batch.lod];
+
+				ogl::DrawElementsIndirectCommand command = {
+					.count = lod.index_count,
+					.instance_count = batch.count,
+					.first_index = object.first_index + lod.index_offset,
+					.base_vertex = GLint(object.base_vertex),
+					.base_instance = batch.first,
+				};
+
+				submitted_triangles += uint64_t(lod.index_count / 3) * batch.count;
+
+				// every scene draw uses the same program and everything is opaque for now
+				if (instancing) {
+					float depth = FLT_MAX;
+					for (uint32_t i = 0; i < batch.count; i++) {
+						depth = std::min(depth, instance_depth(instance_indices[batch.first + i]));
+					}
+
+					render_queue.Push(MakeOpaqueSortKey(0, object.material, depth), uint32_t(draw_commands.size()));
+					draw_commands.push_back(command);
+				}
+				else {
+					command.instance_count = 1;
+					for (uint32_t i = 0; i < batch.count; i++) {
+						command.base_instance = batch.first + i;
+						render_queue.Push(MakeOpaqueSortKey(0, object.material, instance_depth(instance_indices[batch.first + i])), uint32_t(draw_commands.size()));
+						draw_commands.push_back(command);
+					}
+				}
 			}
 
+			if (sort_draws) {
+				render_queue.Sort();
 
-			if (mesh.textures[EMISSIVE_MAP_INDEX] != nullptr && mesh.textures[EMISSIVE_MAP_INDEX]->id != 0) {
-				ogl::bind_texture(*mesh.textures[EMISSIVE_MAP_INDEX], EMISSIVE_MAP_INDEX);
+				sorted_draw_commands.clear();
+				for (uint32_t item : render_queue.items) {
+					sorted_draw_commands.push_back(draw_commands[item]);
+				}
+				draw_commands.swap(sorted_draw_commands);
+			}
+
+			ogl::RingAllocation instance_index_allocation = {};
+			ogl::RingAllocation command_allocation = {};
+			if (!draw_commands.empty()) {
+				instance_index_allocation = ogl::ring_buffer_upload(g_renderer_state->ring_buffer, instance_indices.data(), instance_indices.size() * sizeof(uint32_t));
+				command_allocation = ogl::ring_buffer_upload(g_renderer_state->ring_buffer, draw_commands.data(), draw_commands.size() * sizeof(ogl::DrawElementsIndirectCommand));
+			}
+			if (command_allocation.data == nullptr || instance_index_allocation.data == nullptr) {
+				draw_commands.clear();
 			}
 			else {
-				ogl::bind_texture(black_texture, EMISSIVE_MAP_INDEX);
+				ogl::bind_buffer_range_as_ssbo(instance_index_allocation.buffer, 2, instance_index_allocation.offset, instance_index_allocation.size);
+				ogl::bind_buffer_as_indirect(command_allocation.buffer);
 			}
 
-			g_renderer_state->per_object.model = mesh.transform;
-			g_renderer_state->per_object.normal_matrix = glm::transpose(glm::inverse(mesh.transform));
-			g_renderer_state->per_object.base_color = mesh.base_color;
-			g_renderer_state->per_object.emissive_color = mesh.emissive_color;
-			g_renderer_state->per_object.specular_color = mesh.specular_color;
+			ogl::bind_buffer_as_ssbo(scene.vertex_buffer, 0);
+			ogl::bind_buffer_as_ebo(scene.index_buffer);
 
-			ogl::buffer_subdata(g_renderer_state->per_object_buffer, &g_renderer_state->per_object, sizeof(PerObject), 0);
-
-			if (mesh.index_buffer_short) {
-				glDrawElements(GL_TRIANGLES, mesh.indices_count, GL_UNSIGNED_SHORT, nullptr);
+			// materials come from the material table, so every visible instance goes into one multi-draw
+			if (multi_draw && !draw_commands.empty()) {
+				glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)command_allocation.offset, GLsizei(draw_commands.size()), 0);
+				draw_calls++;
 			}
 			else {
-				glDrawElements(GL_TRIANGLES, mesh.indices_count, GL_UNSIGNED_INT, nullptr);
+				for (size_t i = 0; i < draw_commands.size(); i++) {
+					glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(command_allocation.offset + i * sizeof(ogl::DrawElementsIndirectCommand)));
+					draw_calls++;
+				}
 			}
 		}
 
+
 		if (deferred) {
 			ogl::bind_framebuffer(hdr_framebuffer);
 
@@ -909,6 +2010,46 @@ int main(int argc, char* argv[]) {
 
 
 		ImGui::Checkbox("Deferred", &deferred);
+		ImGui::Checkbox("LOD Selection", &lod_selection);
+		ImGui::SliderFloat("LOD Error (px)", &lod_error_budget, 0.1f, 16.0f);
+		ImGui::Checkbox("Instancing", &instancing);
+		ImGui::Checkbox("Multi-draw", &multi_draw);
+		ImGui::Checkbox("GPU Culling", &gpu_culling);
+		if (gpu_culling) {
+			ImGui::Checkbox("Hi-Z Occlusion", &gpu_occlusion);
+			ImGui::Text("Groups %zu, commands %u per phase", gpu_culling_state.groups.size(), gpu_culling_state.command_count);
+		}
+		// the cpu culling options and counts only apply when the cpu builds the draws
+		if (!gpu_culling) {
+			ImGui::Combo("Culling", &culling_mode, "None\0Frustum (SIMD)\0BVH\0");
+			ImGui::Checkbox("Sort Draws", &sort_draws);
+			if (sort_draws) {
+				ImGui::Text("Material changes %u (%u unsorted)", render_queue.stats.material_changes, render_queue.stats.unsorted_material_changes);
+			}
+			ImGui::Checkbox("Occlusion Culling", &occlusion_culling);
+			if (occlusion_culling) {
+				ImGui::Text("Occluders %u, %u triangles", occlusion_buffer.stats.occluder_count, occlusion_buffer.stats.triangle_count);
+				ImGui::Text("Occlusion culled %u / %u", occlusion_culled_count, occlusion_buffer.stats.tested_count);
+			}
+		}
+		ImGui::Checkbox("Camera Collision", &camera_collision);
+		ImGui::Text("BVH nodes %zu", scene.bvh.nodes.size());
+		if (picked_instance >= 0) {
+			ImGui::Text("Picked instance %d", picked_instance);
+		}
+		else {
+			ImGui::Text("Picked instance none");
+		}
+		if (!gpu_culling) {
+			ImGui::Text("Visible instances %u / %u", visible_instance_count, scene.instance_count);
+			ImGui::Text("Triangles %llu", (unsigned long long)submitted_triangles);
+		}
+		ImGui::Text("Draw calls %u", draw_calls);
+		ogl::StateStats state_stats = ogl::get_state_stats();
+		ImGui::Text("GL binds %u issued, %u elided", state_stats.issued, state_stats.elided);
+		if (ImGui::Checkbox("State Cache", &state_cache)) {
+			ogl::set_state_cache_enabled(state_cache);
+		}
 		ImGui::DragFloat3("Sun Direction", glm::value_ptr(sun_direction), 0.01f, -1.0f, 1.0f);
 		ImGui::DragFloat("Sun Intensity", &sun.intensity, 0.1f, 0.0f, 10.0f);
 		ImGui::ColorEdit3("Sun Color", glm::value_ptr(sun.color));
@@ -955,11 +2096,16 @@ int main(int argc, char* argv[]) {
 
 		ImGui::Render();
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		// imgui binds its own program, buffers and textures behind ogl's back
+		ogl::invalidate_state();
 
 		// --------------- ImGui ----------------------- //
+		ogl::ring_buffer_end_frame(g_renderer_state->ring_buffer);
 		glfwSwapBuffers(window);
 	}
 
+	ogl::delete_ring_buffer(g_renderer_state->ring_buffer);
+
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
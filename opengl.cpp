@@ -1,13 +1,135 @@
 #include "opengl.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 namespace ogl {
 
+    #define STATE_UNKNOWN 0xFFFFFFFFu
+
+    struct BufferBinding {
+        GLuint id;
+        GLintptr offset;
+        GLsizeiptr size; // 0 for the whole buffer
+    };
+
+    // what the bind functions last bound, STATE_UNKNOWN when it can't be known (after invalidate_state)
+    struct BoundState {
+        GLuint program;
+        GLuint vertex_array;
+        GLuint framebuffer;
+        GLuint element_buffer; // part of the vertex array state
+        GLuint array_buffer;
+        GLuint indirect_buffer;
+        GLuint parameter_buffer;
+        GLuint textures[STATE_CACHE_TEXTURE_UNITS];
+        BufferBinding uniform_buffers[STATE_CACHE_BUFFER_BINDINGS];
+        BufferBinding storage_buffers[STATE_CACHE_BUFFER_BINDINGS];
+    };
+
+    static BoundState bound_state;
+    static StateStats state_stats = {};
+    static bool state_cache_enabled = true;
+
+    // records value as bound, returns false if the call can be skipped
+    static bool update_state(GLuint& bound, GLuint value) {
+        if (state_cache_enabled && bound == value) {
+            state_stats.elided++;
+            return false;
+        }
+        bound = value;
+        state_stats.issued++;
+        return true;
+    }
+
+    static bool update_buffer_binding(BufferBinding* bindings, int binding, GLuint id, GLintptr offset, GLsizeiptr size) {
+        if (binding < 0 || binding >= STATE_CACHE_BUFFER_BINDINGS) {
+            state_stats.issued++;
+            return true;
+        }
+
+        BufferBinding& bound = bindings[binding];
+        if (state_cache_enabled && bound.id == id && bound.offset == offset && bound.size == size) {
+            state_stats.elided++;
+            return false;
+        }
+        bound = { id, offset, size };
+        state_stats.issued++;
+        return true;
+    }
+
+    static bool update_texture_unit(int unit, GLuint id) {
+        if (unit < 0 || unit >= STATE_CACHE_TEXTURE_UNITS) {
+            state_stats.issued++;
+            return true;
+        }
+        return update_state(bound_state.textures[unit], id);
+    }
+
+    // deleted objects are unbound by gl and their names can be handed out again, so they must not stay tracked
+    static void forget_texture(GLuint id) {
+        for (GLuint& texture : bound_state.textures) {
+            if (texture == id) {
+                texture = STATE_UNKNOWN;
+            }
+        }
+    }
+
+    static void forget_buffer(GLuint id) {
+        for (GLuint* buffer : { &bound_state.element_buffer, &bound_state.array_buffer, &bound_state.indirect_buffer, &bound_state.parameter_buffer }) {
+            if (*buffer == id) {
+                *buffer = STATE_UNKNOWN;
+            }
+        }
+        for (int binding = 0; binding < STATE_CACHE_BUFFER_BINDINGS; binding++) {
+            if (bound_state.uniform_buffers[binding].id == id) {
+                bound_state.uniform_buffers[binding].id = STATE_UNKNOWN;
+            }
+            if (bound_state.storage_buffers[binding].id == id) {
+                bound_state.storage_buffers[binding].id = STATE_UNKNOWN;
+            }
+        }
+    }
+
+    StateStats get_state_stats() {
+        return state_stats;
+    }
+
+    void reset_state_stats() {
+        state_stats = {};
+    }
+
+    void invalidate_state() {
+        bound_state.program = STATE_UNKNOWN;
+        bound_state.vertex_array = STATE_UNKNOWN;
+        bound_state.framebuffer = STATE_UNKNOWN;
+        bound_state.element_buffer = STATE_UNKNOWN;
+        bound_state.array_buffer = STATE_UNKNOWN;
+        bound_state.indirect_buffer = STATE_UNKNOWN;
+        bound_state.parameter_buffer = STATE_UNKNOWN;
+        for (GLuint& texture : bound_state.textures) {
+            texture = STATE_UNKNOWN;
+        }
+        for (int binding = 0; binding < STATE_CACHE_BUFFER_BINDINGS; binding++) {
+            bound_state.uniform_buffers[binding] = { STATE_UNKNOWN, 0, 0 };
+            bound_state.storage_buffers[binding] = { STATE_UNKNOWN, 0, 0 };
+        }
+    }
+
+    void set_state_cache_enabled(bool enabled) {
+        state_cache_enabled = enabled;
+    }
+
     bool init() {
+        invalidate_state();
+
         if (glewInit() != GLEW_OK) {
             return false;
         }
 
+        // pixel rows are tightly packed, rgb mip levels rarely have a width that is a multiple of 4
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
         return true;
     }
 
@@ -78,7 +200,11 @@ namespace ogl {
         return program;
     }
 
-    void use_program(Program program) { glUseProgram(program.id); }
+    void use_program(Program program) {
+        if (update_state(bound_state.program, program.id)) {
+            glUseProgram(program.id);
+        }
+    }
 
     VertexArray create_vertex_array() {
         VertexArray vertex_array;
@@ -87,10 +213,18 @@ namespace ogl {
     }
 
     void bind_vertex_array(VertexArray vertex_array) {
-        glBindVertexArray(vertex_array.id);
+        if (update_state(bound_state.vertex_array, vertex_array.id)) {
+            glBindVertexArray(vertex_array.id);
+            // the element buffer binding belongs to the vertex array
+            bound_state.element_buffer = STATE_UNKNOWN;
+        }
     }
 
     void delete_vertex_array(VertexArray vertex_array) {
+        if (bound_state.vertex_array == vertex_array.id) {
+            bound_state.vertex_array = STATE_UNKNOWN;
+            bound_state.element_buffer = STATE_UNKNOWN;
+        }
         glDeleteVertexArrays(1, &vertex_array.id);
     }
 
@@ -112,28 +246,271 @@ namespace ogl {
         return buffer;
     }
 
-    void delete_buffer(Buffer buffer) { glDeleteBuffers(1, &buffer.id); }
+    void delete_buffer(Buffer buffer) {
+        forget_buffer(buffer.id);
+        glDeleteBuffers(1, &buffer.id);
+    }
 
     void bind_buffer_as_ssbo(Buffer buffer, int binding) {
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer.id);
+        if (update_buffer_binding(bound_state.storage_buffers, binding, buffer.id, 0, 0)) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer.id);
+        }
     }
 
     void bind_buffer_as_ubo(Buffer buffer, int binding) {
-        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer.id);
+        if (update_buffer_binding(bound_state.uniform_buffers, binding, buffer.id, 0, 0)) {
+            glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer.id);
+        }
     }
 
     void bind_buffer_as_vbo(Buffer buffer) {
-        glBindBuffer(GL_ARRAY_BUFFER, buffer.id);
+        if (update_state(bound_state.array_buffer, buffer.id)) {
+            glBindBuffer(GL_ARRAY_BUFFER, buffer.id);
+        }
     }
 
     void bind_buffer_as_ebo(Buffer buffer) {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.id);
+        if (update_state(bound_state.element_buffer, buffer.id)) {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.id);
+        }
+    }
+
+    void bind_buffer_as_indirect(Buffer buffer) {
+        if (update_state(bound_state.indirect_buffer, buffer.id)) {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer.id);
+        }
+    }
+
+    void bind_buffer_as_parameter(Buffer buffer) {
+        if (update_state(bound_state.parameter_buffer, buffer.id)) {
+            glBindBuffer(GL_PARAMETER_BUFFER, buffer.id);
+        }
     }
 
     void buffer_subdata(Buffer buffer, void* data, size_t size, size_t offset) {
         glNamedBufferSubData(buffer.id, offset, size, data);
     }
 
+    void bind_buffer_range_as_ubo(Buffer buffer, int binding, size_t offset, size_t size) {
+        if (update_buffer_binding(bound_state.uniform_buffers, binding, buffer.id, GLintptr(offset), GLsizeiptr(size))) {
+            glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer.id, offset, size);
+        }
+    }
+
+    void bind_buffer_range_as_ssbo(Buffer buffer, int binding, size_t offset, size_t size) {
+        if (update_buffer_binding(bound_state.storage_buffers, binding, buffer.id, GLintptr(offset), GLsizeiptr(size))) {
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer.id, offset, size);
+        }
+    }
+
+    static void wait_for_fence(GLsync fence) {
+        GLbitfield wait_flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (true) {
+            GLenum result = glClientWaitSync(fence, wait_flags, 1000000000ull);
+            if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) {
+                break;
+            }
+            wait_flags = 0;
+        }
+    }
+
+    RingBuffer create_ring_buffer(size_t frame_size) {
+        RingBuffer ring = {};
+
+        GLint uniform_alignment = 0;
+        GLint storage_alignment = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment);
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storage_alignment);
+        ring.alignment = std::max<size_t>(std::max(uniform_alignment, storage_alignment), 16);
+
+        // regions start aligned so offsets inside them only need the allocation alignment
+        ring.frame_size = (frame_size + ring.alignment - 1) / ring.alignment * ring.alignment;
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glCreateBuffers(1, &ring.buffer.id);
+        glNamedBufferStorage(ring.buffer.id, ring.frame_size * RING_BUFFER_FRAMES, nullptr, flags);
+        ring.data = (uint8_t*)glMapNamedBufferRange(ring.buffer.id, 0, ring.frame_size * RING_BUFFER_FRAMES, flags);
+
+        return ring;
+    }
+
+    void delete_ring_buffer(RingBuffer& ring) {
+        for (GLsync& fence : ring.fences) {
+            if (fence != nullptr) {
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+        }
+
+        glUnmapNamedBuffer(ring.buffer.id);
+        delete_buffer(ring.buffer);
+        ring = {};
+    }
+
+    void ring_buffer_begin_frame(RingBuffer& ring) {
+        ring.frame = (ring.frame + 1) % RING_BUFFER_FRAMES;
+        ring.offset = 0;
+
+        GLsync& fence = ring.fences[ring.frame];
+        if (fence == nullptr) {
+            return;
+        }
+
+        // normally signaled long ago, only blocks when the cpu runs more than RING_BUFFER_FRAMES frames ahead
+        wait_for_fence(fence);
+
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    void ring_buffer_end_frame(RingBuffer& ring) {
+        if (ring.fences[ring.frame] != nullptr) {
+            glDeleteSync(ring.fences[ring.frame]);
+        }
+        ring.fences[ring.frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    RingAllocation ring_buffer_allocate(RingBuffer& ring, size_t size) {
+        size_t offset = (ring.offset + ring.alignment - 1) / ring.alignment * ring.alignment;
+        if (offset + size > ring.frame_size) {
+            std::cerr << "Ring buffer frame region of " << ring.frame_size << " bytes is full" << std::endl;
+            return {};
+        }
+
+        ring.offset = offset + size;
+
+        size_t buffer_offset = ring.frame * ring.frame_size + offset;
+        return RingAllocation{ ring.buffer, ring.data + buffer_offset, buffer_offset, size };
+    }
+
+    RingAllocation ring_buffer_upload(RingBuffer& ring, const void* data, size_t size) {
+        RingAllocation allocation = ring_buffer_allocate(ring, size);
+        if (allocation.data != nullptr) {
+            memcpy(allocation.data, data, size);
+        }
+        return allocation;
+    }
+
+    StagingBuffer* create_staging_buffer(size_t size) {
+        StagingBuffer* staging = new StagingBuffer();
+        staging->size = size;
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glCreateBuffers(1, &staging->buffer.id);
+        glNamedBufferStorage(staging->buffer.id, size, nullptr, flags);
+        staging->data = (uint8_t*)glMapNamedBufferRange(staging->buffer.id, 0, size, flags);
+
+        return staging;
+    }
+
+    void delete_staging_buffer(StagingBuffer* staging) {
+        for (StagingRegion& region : staging->regions) {
+            if (region.fence != nullptr) {
+                wait_for_fence(region.fence);
+                glDeleteSync(region.fence);
+            }
+        }
+
+        glUnmapNamedBuffer(staging->buffer.id);
+        delete_buffer(staging->buffer);
+        delete staging;
+    }
+
+    // the caller holds the mutex
+    static StagingAllocation staging_buffer_allocate_locked(StagingBuffer* staging, size_t size) {
+        size = (size + STAGING_BUFFER_ALIGNMENT - 1) / STAGING_BUFFER_ALIGNMENT * STAGING_BUFFER_ALIGNMENT;
+
+        size_t offset;
+        if (staging->regions.empty()) {
+            if (size > staging->size) {
+                return {};
+            }
+            offset = 0;
+        }
+        else {
+            size_t tail = staging->regions.front().offset;
+            bool wrapped = staging->regions.back().offset < tail;
+            if (wrapped) {
+                // free space is the gap between the newest and the oldest region
+                if (staging->head + size > tail) {
+                    return {};
+                }
+                offset = staging->head;
+            }
+            else if (staging->head + size <= staging->size) {
+                offset = staging->head;
+            }
+            else if (size <= tail) {
+                offset = 0;
+            }
+            else {
+                return {};
+            }
+        }
+
+        staging->head = offset + size;
+        uint64_t id = staging->next_id++;
+        staging->regions.push_back({ offset, size, id, nullptr });
+        return StagingAllocation{ staging->data + offset, offset, size, id };
+    }
+
+    StagingAllocation staging_buffer_try_allocate(StagingBuffer* staging, size_t size) {
+        std::lock_guard<std::mutex> lock(staging->mutex);
+        return staging_buffer_allocate_locked(staging, size);
+    }
+
+    StagingAllocation staging_buffer_allocate(StagingBuffer* staging, size_t size) {
+        std::unique_lock<std::mutex> lock(staging->mutex);
+        while (true) {
+            StagingAllocation allocation = staging_buffer_allocate_locked(staging, size);
+            if (allocation.data != nullptr) {
+                return allocation;
+            }
+
+            // only regions with an issued upload can be waited for, one still being written by a worker can't
+            if (staging->regions.empty() || staging->regions.front().fence == nullptr) {
+                return {};
+            }
+
+            // workers keep allocating during the wait. the region stays queued until its fence signaled so nobody
+            // writes over memory the gpu may still read, fences are only deleted on this thread so it stays valid
+            StagingRegion region = staging->regions.front();
+            lock.unlock();
+            wait_for_fence(region.fence);
+            lock.lock();
+
+            if (!staging->regions.empty() && staging->regions.front().id == region.id) {
+                staging->regions.pop_front();
+                glDeleteSync(region.fence);
+            }
+        }
+    }
+
+    void staging_buffer_fence(StagingBuffer* staging, StagingAllocation allocation) {
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        std::lock_guard<std::mutex> lock(staging->mutex);
+        for (StagingRegion& region : staging->regions) {
+            if (region.id == allocation.id) {
+                region.fence = fence;
+                return;
+            }
+        }
+        glDeleteSync(fence);
+    }
+
+    void staging_buffer_retire(StagingBuffer* staging) {
+        std::lock_guard<std::mutex> lock(staging->mutex);
+        while (!staging->regions.empty()) {
+            StagingRegion& region = staging->regions.front();
+            if (region.fence == nullptr || glClientWaitSync(region.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED) {
+                break;
+            }
+            glDeleteSync(region.fence);
+            staging->regions.pop_front();
+        }
+    }
+
     Framebuffer create_framebuffer(int width, int height)
     {
         Framebuffer framebuffer = {};
@@ -145,16 +522,23 @@ namespace ogl {
 
 	void bind_framebuffer(Framebuffer& framebuffer) 
     {
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.id);
+        if (update_state(bound_state.framebuffer, framebuffer.id)) {
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.id);
+        }
 	}
 
     void bind_default_framebuffer()
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (update_state(bound_state.framebuffer, 0)) {
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
 	}
 
 	void delete_framebuffer(Framebuffer& framebuffer) 
     {
+        if (bound_state.framebuffer == framebuffer.id) {
+            bound_state.framebuffer = STATE_UNKNOWN;
+        }
 		glDeleteFramebuffers(1, &framebuffer.id);
 	}
 
@@ -184,6 +568,7 @@ namespace ogl {
     }
 
 	void delete_framebuffer_attachment(FramebufferAttachment attachment) {
+        forget_texture(attachment.id);
 		glDeleteTextures(1, &attachment.id);
 	}
 
@@ -247,19 +632,16 @@ namespace ogl {
 
 
 
-    Texture2D create_texture(int width, int height, int format)
+    Texture2D create_texture(int width, int height, int format, int levels)
     {
-		Texture2D texture;
+		Texture2D texture = {};
 		glCreateTextures(GL_TEXTURE_2D, 1, &texture.id);
-		glTextureStorage2D(texture.id, 1, format, width, height);
+		glTextureStorage2D(texture.id, levels, format, width, height);
 		return texture;
 	}
 
-    Texture2D create_texture_from_bytes(void* data, int size, int width, int height, int channels, bool srgb, bool compressed, int internal_format, int pixel_format) {
-        Texture2D texture;
-
-        glCreateTextures(GL_TEXTURE_2D, 1, &texture.id);
-
+    // fills in the formats implied by the channel count of uncompressed pixels
+    static bool resolve_texture_formats(int channels, bool srgb, bool compressed, int& internal_format, int& pixel_format) {
         if (internal_format == 0) {
             switch (channels) {
             case 1:
@@ -276,7 +658,7 @@ namespace ogl {
                 break;
             default:
                 std::cerr << "Invalid number of channels " << channels << std::endl;
-                return {};
+                return false;
             }
         }
         if (pixel_format == 0 && !compressed) {
@@ -295,34 +677,147 @@ namespace ogl {
                 break;
             default:
                 std::cerr << "Invalid number of channels " << channels << std::endl;
-                return {};
+                return false;
             }
         }
+        return true;
+    }
+
+    int mip_level_count(int width, int height) {
+        int levels = 1;
+        while ((std::max(width, height) >> levels) > 0 && levels < TEXTURE_MAX_LEVELS) {
+            levels++;
+        }
+        return levels;
+    }
 
-        glTextureStorage2D(texture.id, 1, internal_format, width, height);
+    // data is a pointer into client memory, or an offset when a pixel unpack buffer is bound
+    static Texture2D create_texture_with_pixels(const uint8_t* data, int size, int width, int height, bool compressed, int internal_format, int pixel_format, const TextureLevels* levels) {
+        Texture2D texture = {};
+
+        // without given levels uncompressed textures get the whole chain, filled by glGenerateTextureMipmap below
+        int upload_levels = levels != nullptr ? levels->count : 1;
+        int level_count = levels != nullptr ? levels->count : compressed ? 1 : mip_level_count(width, height);
+
+        glCreateTextures(GL_TEXTURE_2D, 1, &texture.id);
+        glTextureStorage2D(texture.id, level_count, internal_format, width, height);
 
-        glTextureParameteri(texture.id, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTextureParameteri(texture.id, GL_TEXTURE_MIN_FILTER, level_count > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 		glTextureParameteri(texture.id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTextureParameteri(texture.id, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTextureParameteri(texture.id, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-        if (compressed) {
-            glCompressedTextureSubImage2D(texture.id, 0, 0, 0, width, height, pixel_format, size, data);
+        for (int level = 0; level < upload_levels; level++) {
+            int level_width = std::max(width >> level, 1);
+            int level_height = std::max(height >> level, 1);
+            const uint8_t* level_data = levels != nullptr ? data + levels->offsets[level] : data;
+            int level_size = levels != nullptr ? int(levels->sizes[level]) : size;
+
+            if (compressed) {
+                glCompressedTextureSubImage2D(texture.id, level, 0, 0, level_width, level_height, pixel_format, level_size, level_data);
+            }
+            else {
+                glTextureSubImage2D(texture.id, level, 0, 0, level_width, level_height, pixel_format, GL_UNSIGNED_BYTE, level_data);
+            }
         }
-        else {
-            glTextureSubImage2D(texture.id, 0, 0, 0, width, height, pixel_format, GL_UNSIGNED_BYTE, data);
+
+        if (levels == nullptr && !compressed) {
             glGenerateTextureMipmap(texture.id);
         }
 
         return texture;
     }
 
+    Texture2D create_texture_from_bytes(void* data, int size, int width, int height, int channels, bool srgb, bool compressed, int internal_format, int pixel_format, const TextureLevels* levels) {
+        if (!resolve_texture_formats(channels, srgb, compressed, internal_format, pixel_format)) {
+            return {};
+        }
+        return create_texture_with_pixels((const uint8_t*)data, size, width, height, compressed, internal_format, pixel_format, levels);
+    }
+
+    Texture2D create_texture_from_staging(StagingBuffer* staging, StagingAllocation allocation, int width, int height, int channels, bool srgb, bool compressed, int internal_format, int pixel_format, const TextureLevels* levels) {
+        if (!resolve_texture_formats(channels, srgb, compressed, internal_format, pixel_format)) {
+            staging_buffer_fence(staging, allocation);
+            return {};
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging->buffer.id);
+        Texture2D texture = create_texture_with_pixels((const uint8_t*)allocation.offset, int(allocation.size), width, height, compressed, internal_format, pixel_format, levels);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        staging_buffer_fence(staging, allocation);
+        return texture;
+    }
+
     void delete_texture(Texture2D texture) {
+        if (texture.handle != 0) {
+            glMakeTextureHandleNonResidentARB(texture.handle);
+        }
+        forget_texture(texture.id);
         glDeleteTextures(1, &texture.id);
     }
 
     void bind_texture(Texture2D texture, int unit) {
-        glBindTextureUnit(unit, texture.id);
+        if (update_texture_unit(unit, texture.id)) {
+            glBindTextureUnit(unit, texture.id);
+        }
+    }
+
+    void bind_image(Texture2D texture, int unit, int level, GLenum access, GLenum format) {
+        glBindImageTexture(unit, texture.id, level, GL_FALSE, 0, access, format);
+    }
+
+    TextureDescription describe_texture(Texture2D texture) {
+        TextureDescription description = {};
+        glGetTextureLevelParameteriv(texture.id, 0, GL_TEXTURE_WIDTH, &description.width);
+        glGetTextureLevelParameteriv(texture.id, 0, GL_TEXTURE_HEIGHT, &description.height);
+        glGetTextureLevelParameteriv(texture.id, 0, GL_TEXTURE_INTERNAL_FORMAT, &description.format);
+        glGetTextureParameteriv(texture.id, GL_TEXTURE_IMMUTABLE_LEVELS, &description.levels);
+        return description;
+    }
+
+    bool bindless_textures_supported() {
+        return GLEW_ARB_bindless_texture != 0;
+    }
+
+    GLuint64 make_texture_resident(Texture2D& texture) {
+        if (texture.handle == 0) {
+            texture.handle = glGetTextureHandleARB(texture.id);
+            glMakeTextureHandleResidentARB(texture.handle);
+        }
+        return texture.handle;
+    }
+
+    Texture2DArray create_texture_array(int width, int height, int layers, int format, int levels) {
+        Texture2DArray texture = {};
+        glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &texture.id);
+        glTextureStorage3D(texture.id, levels, format, width, height, layers);
+
+        glTextureParameteri(texture.id, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTextureParameteri(texture.id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTextureParameteri(texture.id, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTextureParameteri(texture.id, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        return texture;
+    }
+
+    void copy_texture_to_layer(Texture2D source, Texture2DArray destination, int layer) {
+        TextureDescription description = describe_texture(source);
+        for (int level = 0; level < description.levels; level++) {
+            int width = std::max(description.width >> level, 1);
+            int height = std::max(description.height >> level, 1);
+            glCopyImageSubData(source.id, GL_TEXTURE_2D, level, 0, 0, 0, destination.id, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1);
+        }
+    }
+
+    void delete_texture_array(Texture2DArray texture) {
+        forget_texture(texture.id);
+        glDeleteTextures(1, &texture.id);
+    }
+
+    void bind_texture_array(Texture2DArray texture, int unit) {
+        if (update_texture_unit(unit, texture.id)) {
+            glBindTextureUnit(unit, texture.id);
+        }
     }
 
 
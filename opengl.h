@@ -1,6 +1,9 @@
 #pragma once
 
 #include <GL/glew.h>
+#include <cstdint>
+#include <deque>
+#include <mutex>
 #include <vector>
 
 namespace ogl {
@@ -23,6 +26,27 @@ namespace ogl {
 
     struct Texture2D {
         GLuint id;
+        GLuint64 handle; // resident bindless handle, 0 when the texture is only bound to units
+    };
+
+    struct Texture2DArray {
+        GLuint id;
+    };
+
+    #define TEXTURE_MAX_LEVELS 16
+
+    // mip levels stored back to back, offsets are relative to the first byte of level 0
+    struct TextureLevels {
+        int count;
+        size_t offsets[TEXTURE_MAX_LEVELS];
+        size_t sizes[TEXTURE_MAX_LEVELS];
+    };
+
+    // the immutable storage of a texture
+    struct TextureDescription {
+        int width, height;
+        int format;
+        int levels;
     };
 
     struct FramebufferAttachment {
@@ -39,6 +63,80 @@ namespace ogl {
         FramebufferAttachment depth_attachment;
     };
 
+    // bindings tracked by the state cache, binds beyond them are always issued
+    #define STATE_CACHE_TEXTURE_UNITS 64
+    #define STATE_CACHE_BUFFER_BINDINGS 32
+
+    // bind calls made through ogl since the last reset_state_stats, elided ones matched what was already bound
+    struct StateStats {
+        uint32_t issued;
+        uint32_t elided;
+    };
+
+    #define RING_BUFFER_FRAMES 3
+
+    // persistently mapped buffer split into one region per frame in flight. a region is only written again
+    // once the fence placed at the end of the frame that used it has signaled, so writes never stall on the driver
+    struct RingBuffer {
+        Buffer buffer;
+        uint8_t* data;
+        size_t frame_size;
+        size_t offset; // into the current frame's region
+        uint32_t frame;
+        size_t alignment; // satisfies uniform and storage buffer offset alignment
+        GLsync fences[RING_BUFFER_FRAMES];
+    };
+
+    // a block of the current frame's region, data is written directly and is visible to the gpu without flushing
+    struct RingAllocation {
+        Buffer buffer;
+        void* data;
+        size_t offset; // into buffer
+        size_t size;
+    };
+
+    // offsets into a staging buffer satisfy any pixel unpack alignment and compressed block size
+    #define STAGING_BUFFER_ALIGNMENT 16
+
+    // a block of a staging buffer, id finds it again when the upload reading it is fenced
+    struct StagingAllocation {
+        void* data;
+        size_t offset;
+        size_t size;
+        uint64_t id;
+    };
+
+    struct StagingRegion {
+        size_t offset;
+        size_t size;
+        uint64_t id;
+        GLsync fence; // nullptr until the upload reading the region was issued
+    };
+
+    /**
+    * persistently mapped pixel unpack buffer used as a ring, regions are freed in allocation order once the fence
+    * of the upload that read them has signaled. allocations can be made and written on any thread, everything that
+    * touches fences or issues uploads only on the gl thread
+    */
+    struct StagingBuffer {
+        Buffer buffer;
+        uint8_t* data;
+        size_t size;
+        size_t head; // where the next allocation starts
+        uint64_t next_id;
+        std::deque<StagingRegion> regions; // in use, oldest first
+        std::mutex mutex;
+    };
+
+    // layout consumed by glMultiDrawElementsIndirect
+    struct DrawElementsIndirectCommand {
+        GLuint count;
+        GLuint instance_count;
+        GLuint first_index;
+        GLint base_vertex;
+        GLuint base_instance;
+    };
+
     bool init();
 
     Framebuffer create_framebuffer(int width, int height);
@@ -53,14 +151,50 @@ namespace ogl {
 
     FramebufferAttachment create_framebuffer_attachment(Framebuffer& framebuffer, int format, bool draw);
 
-    Texture2D create_texture(int width, int height, int format);
+    Texture2D create_texture(int width, int height, int format, int levels = 1);
+
+    // levels in a full chain down to 1x1, capped at TEXTURE_MAX_LEVELS
+    int mip_level_count(int width, int height);
+
+    // levels describes a full mip chain stored in data, without it data is level 0 and uncompressed mips are
+    // generated on the gpu. loaders should prefer passing levels built on their own threads
+    Texture2D create_texture_from_bytes(void* data, int size, int width, int height, int channels, bool srgb,bool compressed = false, int internal_format = 0, int pixel_format = 0, const TextureLevels* levels = nullptr);
 
-    Texture2D create_texture_from_bytes(void* data, int size, int width, int height, int channels, bool srgb,bool compressed = false, int internal_format = 0, int pixel_format = 0);
+    // like create_texture_from_bytes but the pixels are read from a staging allocation, the copy runs asynchronously
+    Texture2D create_texture_from_staging(StagingBuffer* staging, StagingAllocation allocation, int width, int height, int channels, bool srgb, bool compressed = false, int internal_format = 0, int pixel_format = 0, const TextureLevels* levels = nullptr);
 
     void delete_texture(Texture2D texture);
 
     void bind_texture(Texture2D texture, int unit);
 
+    void bind_image(Texture2D texture, int unit, int level, GLenum access, GLenum format);
+
+    TextureDescription describe_texture(Texture2D texture);
+
+    bool bindless_textures_supported();
+
+    // creates the bindless handle of texture and makes it resident, the texture must not change afterwards
+    GLuint64 make_texture_resident(Texture2D& texture);
+
+    Texture2DArray create_texture_array(int width, int height, int layers, int format, int levels);
+
+    // copies every level of source into one layer of destination, both need the same size and format
+    void copy_texture_to_layer(Texture2D source, Texture2DArray destination, int layer);
+
+    void delete_texture_array(Texture2DArray texture);
+
+    void bind_texture_array(Texture2DArray texture, int unit);
+
+    StateStats get_state_stats();
+
+    void reset_state_stats();
+
+    // forgets every tracked binding, call after code that binds without going through ogl (e.g. imgui)
+    void invalidate_state();
+
+    // with the cache disabled every bind is issued, for measuring what the elision saves
+    void set_state_cache_enabled(bool enabled);
+
     VertexArray create_vertex_array();
 
     void bind_vertex_array(VertexArray vertex_array);
@@ -81,6 +215,10 @@ namespace ogl {
 
     void bind_buffer_as_ubo(Buffer buffer, int binding);
 
+    void bind_buffer_as_indirect(Buffer buffer);
+
+    void bind_buffer_as_parameter(Buffer buffer);
+
     void delete_vertex_array(VertexArray vertex_array);
 
     void set_index_buffer(VertexArray vao, Buffer buffer);
@@ -89,4 +227,40 @@ namespace ogl {
 
     void buffer_subdata(Buffer buffer, void* data, size_t size, size_t offset);
 
+    void bind_buffer_range_as_ubo(Buffer buffer, int binding, size_t offset, size_t size);
+
+    void bind_buffer_range_as_ssbo(Buffer buffer, int binding, size_t offset, size_t size);
+
+    RingBuffer create_ring_buffer(size_t frame_size);
+
+    void delete_ring_buffer(RingBuffer& ring);
+
+    // waits until the gpu is done with the region this frame reuses, call once before the first allocation of a frame
+    void ring_buffer_begin_frame(RingBuffer& ring);
+
+    // fences the commands that read the current region, call after the last draw of a frame
+    void ring_buffer_end_frame(RingBuffer& ring);
+
+    // returns an allocation with data == nullptr when the frame's region is full
+    RingAllocation ring_buffer_allocate(RingBuffer& ring, size_t size);
+
+    RingAllocation ring_buffer_upload(RingBuffer& ring, const void* data, size_t size);
+
+    StagingBuffer* create_staging_buffer(size_t size);
+
+    // waits for the uploads still reading the buffer
+    void delete_staging_buffer(StagingBuffer* staging);
+
+    // never blocks and makes no gl calls, safe on worker threads. data == nullptr when there is no room right now
+    StagingAllocation staging_buffer_try_allocate(StagingBuffer* staging, size_t size);
+
+    // gl thread only, waits for pending uploads to free enough room. data == nullptr if waiting can't help
+    StagingAllocation staging_buffer_allocate(StagingBuffer* staging, size_t size);
+
+    // gl thread only, fences the commands issued so far as the readers of allocation
+    void staging_buffer_fence(StagingBuffer* staging, StagingAllocation allocation);
+
+    // gl thread only, frees the regions whose uploads have finished without waiting
+    void staging_buffer_retire(StagingBuffer* staging);
+
 }
\ No newline at end of file
@@ -1,12 +1,6 @@
 #version 460 core
-#extension GL_NV_gpu_shader5 : enable
 
-struct Vertex {
-    f16vec4 position;
-    u8vec4 normal;
-    u8vec4 tangent;
-    f16vec2 uv;
-};
+#pragma vertex_layout
 
 layout(std430, binding = 0) readonly buffer VertexBuffer {
     Vertex vertices[];
@@ -30,7 +24,7 @@ layout(std140, binding = 1) uniform PerObject {
 void main() {    
     Vertex vertex = vertices[gl_VertexID];
 
-    vec4 pos = model * vec4(vertex.position);
+    vec4 pos = model * vec4(vertex_position(vertex), 1.0);
     
     gl_Position = projection * view * pos;	
 }
\ No newline at end of file
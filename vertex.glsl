@@ -1,49 +1,60 @@
 #version 460 core
-#extension GL_NV_gpu_shader5 : enable
 
-struct Vertex {
-    f16vec4 position;
-    u8vec4 normal;
-    u8vec4 tangent;
-    f16vec2 uv;
-};
+#pragma vertex_layout
 
 layout(std430, binding = 0) readonly buffer VertexBuffer {
     Vertex vertices[];
 };
 
+struct Instance {
+    mat4 model;
+    mat4 normal_matrix;
+};
+
+layout(std430, binding = 1) readonly buffer InstanceBuffer {
+    Instance instances[];
+};
+
+// instances of the current frame grouped by mesh and lod, every indirect command points
+// at its range with base_instance
+layout(std430, binding = 2) readonly buffer InstanceIndexBuffer {
+    uint instance_indices[];
+};
+
+layout(std430, binding = 11) readonly buffer InstanceMaterialBuffer {
+    uint instance_materials[];
+};
+
 layout(std140, binding = 0) uniform PerFrame {
     mat4 view;
     mat4 projection;
     vec3 camera_position;
 };
 
-layout(std140, binding = 1) uniform PerObject {
-    mat4 model;
-    mat4 normal_matrix;
-    vec4 base_color;
-	vec4 emissive_color;
-	vec4 specular_color;
-};
-
 layout(location = 0) out vec3 world_pos;
 layout(location = 1) out vec3 view_pos_tbn;
 layout(location = 2) out vec2 uv;
 layout(location = 3) out mat3 tbn;
+layout(location = 6) flat out uint material_index;
 
 void main() {    
     Vertex vertex = vertices[gl_VertexID];
+    uint instance_index = instance_indices[gl_BaseInstance + gl_InstanceID];
+    Instance instance = instances[instance_index];
+    material_index = instance_materials[instance_index];
+    mat4 model = instance.model;
+    mat4 normal_matrix = instance.normal_matrix;
 
-    vec4 pos = model * vec4(vertex.position);
+    vec4 pos = model * vec4(vertex_position(vertex), 1.0);
     
     gl_Position = projection * view * pos;
 	
 	world_pos = pos.xyz;
 
-	vec3 N = normalize((normal_matrix * (vec4(vertex.normal.xyzw) / 127.0 - 1.0)).xyz);
-	vec3 T = normalize((normal_matrix * (vec4(vertex.tangent.xyzw) / 127.0 - 1.0)).xyz);
-	float handedness = float(vertex.tangent.w) / 127.0 - 1.0;
-	vec3 B = normalize(cross(N, T));
+	vec3 N = normalize((normal_matrix * vec4(vertex_normal(vertex), 0.0)).xyz);
+	vec4 tangent = vertex_tangent(vertex);
+	vec3 T = normalize((normal_matrix * vec4(tangent.xyz, 0.0)).xyz);
+	vec3 B = normalize(cross(N, T)) * tangent.w;
 
 	mat3 TBN = mat3(T, B, N);
 
@@ -53,5 +64,5 @@ void main() {
 	
 	tbn = TBN;
 
-    uv = vertex.uv;
+    uv = vertex_uv(vertex);
 }
\ No newline at end of file